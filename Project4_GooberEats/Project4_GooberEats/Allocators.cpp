@@ -0,0 +1,143 @@
+#include "Allocators.h"
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+using namespace std;
+
+// round n up to a multiple of a power of two
+static size_t roundUp(size_t n, size_t a)
+{
+	return (n + a - 1) & ~(a - 1);
+}
+
+//******************** Arena **************************************************
+
+Arena::Arena(size_t blockSize)
+{
+	m_blocks = nullptr;
+	m_next = nullptr;
+	m_end = nullptr;
+	m_blockSize = blockSize;
+	m_allocated = 0;
+}
+
+Arena::~Arena()
+{
+	while (m_blocks != nullptr)
+	{
+		Block* b = m_blocks;
+		m_blocks = b->next;
+		::operator delete(b);
+	}
+}
+
+void Arena::newBlock(size_t atLeast)
+{
+	size_t size = max(m_blockSize, atLeast);
+	Block* b = static_cast<Block*>(::operator new(roundUp(sizeof(Block), alignof(max_align_t)) + size));
+	b->next = m_blocks;
+	b->size = size;
+	m_blocks = b;
+	m_next = reinterpret_cast<char*>(b) + roundUp(sizeof(Block), alignof(max_align_t));
+	m_end = m_next + size;
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment)
+{
+	uintptr_t p = roundUp(reinterpret_cast<uintptr_t>(m_next), alignment);
+	if (m_next == nullptr || p + bytes > reinterpret_cast<uintptr_t>(m_end))
+	{
+		newBlock(bytes + alignment);
+		p = roundUp(reinterpret_cast<uintptr_t>(m_next), alignment);
+	}
+	m_next = reinterpret_cast<char*>(p + bytes);
+	m_allocated += bytes;
+	return reinterpret_cast<void*>(p);
+}
+
+void Arena::release()
+{
+	if (m_blocks == nullptr)
+		return;
+
+	// keep the newest block, which is at least as big as any ordinary one
+	while (m_blocks->next != nullptr)
+	{
+		Block* b = m_blocks->next;
+		m_blocks->next = b->next;
+		::operator delete(b);
+	}
+	m_next = reinterpret_cast<char*>(m_blocks) + roundUp(sizeof(Block), alignof(max_align_t));
+	m_end = m_next + m_blocks->size;
+	m_allocated = 0;
+}
+
+//******************** NodePool ***********************************************
+
+NodePool::NodePool(size_t chunkSize)
+{
+	m_chunkSize = chunkSize;
+	m_blockSize = 0;
+	m_free = nullptr;
+	m_chunks = nullptr;
+	m_next = nullptr;
+	m_end = nullptr;
+	m_reserved = 0;
+}
+
+NodePool::~NodePool()
+{
+	while (m_chunks != nullptr)
+	{
+		void* next = *static_cast<void**>(m_chunks);
+		::operator delete(m_chunks);
+		m_chunks = next;
+	}
+}
+
+void* NodePool::allocate(size_t bytes)
+{
+	size_t size = roundUp(max(bytes, sizeof(FreeBlock)), alignof(max_align_t));
+	if (m_blockSize == 0)
+		m_blockSize = size;
+	if (size != m_blockSize)
+		return ::operator new(bytes);
+
+	if (m_free != nullptr)
+	{
+		FreeBlock* b = m_free;
+		m_free = b->next;
+		return b;
+	}
+
+	if (m_next == nullptr || m_next + m_blockSize > m_end)
+	{
+		// the chunk's first max_align_t holds the link to the previous chunk
+		size_t header = alignof(max_align_t);
+		size_t chunk = max(m_chunkSize, header + m_blockSize);
+		char* c = static_cast<char*>(::operator new(chunk));
+		*reinterpret_cast<void**>(c) = m_chunks;
+		m_chunks = c;
+		m_reserved += chunk;
+		m_next = c + header;
+		m_end = c + chunk;
+	}
+	void* p = m_next;
+	m_next += m_blockSize;
+	return p;
+}
+
+void NodePool::deallocate(void* p, size_t bytes)
+{
+	size_t size = roundUp(max(bytes, sizeof(FreeBlock)), alignof(max_align_t));
+	if (size != m_blockSize)
+	{
+		::operator delete(p);
+		return;
+	}
+
+	FreeBlock* b = static_cast<FreeBlock*>(p);
+	b->next = m_free;
+	m_free = b;
+}
@@ -0,0 +1,144 @@
+// Allocators.h
+// Memory resources for node-based containers such as ExpandableHashMap, and
+// the std-style allocators that draw from them.
+//
+// Arena: hands out memory by bumping a pointer through large blocks and never
+// frees anything individually; everything goes at once when the arena is
+// released or destroyed.  For maps that live for one operation.
+//
+// NodePool: recycles fixed-size blocks through a free list, carved from large
+// chunks.  For long-lived maps that do single-node inserts and erases, such
+// as EdgeWeightProfile's street index.
+//
+// Neither resource is thread-safe; give each thread its own.  Allocators
+// compare equal when they share a resource, so containers using the same
+// one can splice nodes between them.
+
+#ifndef Allocators_h
+#define Allocators_h
+
+#include <cstddef>
+#include <new>
+
+class Arena
+{
+public:
+	explicit Arena(std::size_t blockSize = 64 * 1024);
+	~Arena();
+	void* allocate(std::size_t bytes, std::size_t alignment);
+	// Frees everything allocated so far, keeping one block for reuse
+	void release();
+	std::size_t bytesAllocated() const { return m_allocated; }
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+private:
+	struct Block
+	{
+		Block* next;
+		std::size_t size;	// usable bytes after the header
+	};
+
+	Block* m_blocks;	// most recent first
+	char* m_next;
+	char* m_end;
+	std::size_t m_blockSize;
+	std::size_t m_allocated;
+
+	void newBlock(std::size_t atLeast);
+};
+
+class NodePool
+{
+public:
+	explicit NodePool(std::size_t chunkSize = 64 * 1024);
+	~NodePool();
+	// The pool's block size is fixed by its first allocation; other sizes are
+	// passed through to operator new.
+	void* allocate(std::size_t bytes);
+	void deallocate(void* p, std::size_t bytes);
+	// every chunk carved so far, used or not
+	std::size_t bytesReserved() const { return m_reserved; }
+
+	NodePool(const NodePool&) = delete;
+	NodePool& operator=(const NodePool&) = delete;
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+
+	std::size_t m_chunkSize;
+	std::size_t m_blockSize;	// 0 until the first allocation
+	FreeBlock* m_free;
+	void* m_chunks;		// linked through each chunk's first word
+	char* m_next;		// uncarved part of the newest chunk
+	char* m_end;
+	std::size_t m_reserved;
+};
+
+template<typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(Arena* arena) : m_arena(arena) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : m_arena(other.arena()) {}
+
+	T* allocate(std::size_t n) { return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T))); }
+	void deallocate(T*, std::size_t) {}	// freed with the arena
+
+	Arena* arena() const { return m_arena; }
+
+private:
+	Arena* m_arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() == b.arena(); }
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() != b.arena(); }
+
+// Single objects come from the pool; arrays (such as a bucket vector) go to
+// operator new.
+template<typename T>
+class PoolAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit PoolAllocator(NodePool* pool) : m_pool(pool) {}
+	template<typename U>
+	PoolAllocator(const PoolAllocator<U>& other) : m_pool(other.pool()) {}
+
+	T* allocate(std::size_t n)
+	{
+		static_assert(alignof(T) <= alignof(std::max_align_t), "NodePool blocks are only max_align_t aligned");
+		if (n == 1)
+			return static_cast<T*>(m_pool->allocate(sizeof(T)));
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+	void deallocate(T* p, std::size_t n)
+	{
+		if (n == 1)
+			m_pool->deallocate(p, sizeof(T));
+		else
+			::operator delete(p);
+	}
+
+	NodePool* pool() const { return m_pool; }
+
+private:
+	NodePool* m_pool;
+};
+
+template<typename T, typename U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b) { return a.pool() == b.pool(); }
+template<typename T, typename U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b) { return a.pool() != b.pool(); }
+
+#endif
@@ -1,25 +1,135 @@
 #include "provided.h"
+#include "GeoMath.h"
+#include "DistanceOracle.h"
+#include "RoadGraph.h"
+#include "Trace.h"
 #include <vector>
+#include <memory>
+#include <algorithm>
 using namespace std;
 
 class DeliveryOptimizerImpl
 {
 public:
-    DeliveryOptimizerImpl(const StreetMap* sm);
+    DeliveryOptimizerImpl(const StreetMap* sm, const DistanceOracle* oracle);
     ~DeliveryOptimizerImpl();
     void optimizeDeliveryOrder(
         const GeoCoord& depot,
         vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
         double& newCrowDistance) const;
+    bool validateDeliveries(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& unreachable) const;
+
+private:
+	const StreetMap* m_map;
+	const DistanceOracle* m_oracle;
+
+	bool networkMatrix(const CoordArrays& points, const vector<GeoCoord>& coords, vector<double>& dist) const;
+	double tourLength(const vector<int>& tour, const vector<double>& dist) const;
+	void nearestNeighborTour(const vector<double>& dist, vector<int>& tour) const;
+	void twoOpt(vector<int>& tour, const vector<double>& dist) const;
 };
 
-DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
+DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm, const DistanceOracle* oracle)
 {
+	m_map = sm;
+	m_oracle = oracle;
 }
 
 DeliveryOptimizerImpl::~DeliveryOptimizerImpl()
 {
+	m_map = nullptr;
+	m_oracle = nullptr;
+}
+
+// Road distances between every pair of points from the hub labels.  Returns
+// false (and the caller falls back to crow distances) if there is no usable
+// oracle or some point is off the map or unreachable.
+bool DeliveryOptimizerImpl::networkMatrix(const CoordArrays& points, const vector<GeoCoord>& coords, vector<double>& dist) const
+{
+	if (m_oracle == nullptr || !m_oracle->ready())
+		return false;
+
+	shared_ptr<const RoadGraph> graph = m_map->snapshot();
+	int n = points.size();
+	vector<int> node(n);
+	for (int i = 0; i < n; i++)
+	{
+		node[i] = graph->findNode(coords[i]);
+		if (node[i] == -1)
+			return false;
+	}
+
+	dist.resize(n * n);
+	for (int i = 0; i < n; i++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			dist[i * n + j] = m_oracle->distance(node[i], node[j]);
+			if (dist[i * n + j] < 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+double DeliveryOptimizerImpl::tourLength(const vector<int>& tour, const vector<double>& dist) const
+{
+	int n = tour.size();
+	double length = 0;
+	for (int i = 0; i < n; i++)
+		length += dist[tour[i] * n + tour[(i + 1) % n]];
+	return length;
+}
+
+void DeliveryOptimizerImpl::nearestNeighborTour(const vector<double>& dist, vector<int>& tour) const
+{
+	int n = tour.size();
+	vector<bool> used(n, false);
+	tour[0] = 0;
+	used[0] = true;
+	for (int i = 1; i < n; i++)
+	{
+		int from = tour[i - 1];
+		int best = -1;
+		for (int j = 1; j < n; j++)
+			if (!used[j] && (best == -1 || dist[from * n + j] < dist[from * n + best]))
+				best = j;
+		tour[i] = best;
+		used[best] = true;
+	}
+}
+
+// Reverses stretches of the tour while that shortens it.  Position 0 (the
+// depot) never moves.  Assumes dist is symmetric, which both crow and road
+// distances are here.
+void DeliveryOptimizerImpl::twoOpt(vector<int>& tour, const vector<double>& dist) const
+{
+	int n = tour.size();
+	bool improved = true;
+	while (improved)
+	{
+		improved = false;
+		for (int i = 0; i + 2 < n; i++)
+		{
+			for (int k = i + 2; k < n; k++)
+			{
+				int a = tour[i];
+				int b = tour[i + 1];
+				int c = tour[k];
+				int d = tour[(k + 1) % n];
+				double delta = dist[a * n + c] + dist[b * n + d] - dist[a * n + b] - dist[c * n + d];
+				if (delta < -1e-9)
+				{
+					reverse(tour.begin() + i + 1, tour.begin() + k + 1);
+					improved = true;
+				}
+			}
+		}
+	}
 }
 
 void DeliveryOptimizerImpl::optimizeDeliveryOrder(
@@ -30,31 +140,81 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 {
     oldCrowDistance = 0;
     newCrowDistance = 0;
+	TraceSpan span("DeliveryOptimizer::optimize");
+
+	if (deliveries.empty())
+		return;
+
+	// point 0 is the depot, point i is deliveries[i - 1]
+	TraceSpan matrix("optimize/matrix");
+	CoordArrays points;
+	vector<GeoCoord> coords;
+	points.reserve(deliveries.size() + 1);
+	points.add(depot);
+	coords.push_back(depot);
+	for (int i = 0; i < deliveries.size(); i++)
+	{
+		points.add(deliveries[i].location);
+		coords.push_back(deliveries[i].location);
+	}
+	int n = points.size();
 
-	//vector<DeliveryRequest> toVisit;
-	//vector<DeliveryRequest> visited;
+	vector<double> crow;
+	distanceMatrixMiles(points, crow);
 
-	//for (int j = 0; j < deliveries.size(); j++)
-	//{
-	//	toVisit.push_back(deliveries[j]);
-	//}
+	// order by road distance when the oracle can provide it
+	vector<double> road;
+	const vector<double>& dist = networkMatrix(points, coords, road) ? road : crow;
 
-	oldCrowDistance += distanceEarthMiles(depot, deliveries[0].location);
-	for (int i = 0; i < deliveries.size() - 1; i++)
-	{
-		oldCrowDistance += distanceEarthMiles(deliveries[i].location, deliveries[i + 1].location);
-	}
-	oldCrowDistance += distanceEarthMiles(deliveries[deliveries.size() - 1].location, depot);
+	matrix.end();
 
+	TraceSpan tours("optimize/tour");
+	vector<int> given(n);
+	for (int i = 0; i < n; i++)
+		given[i] = i;
+	oldCrowDistance = tourLength(given, crow);
 
-	//DeliveryRequest current("current", depot);
-	//current = toVisit[0];
-	//for (int k = 0; k < toVisit.size(); k++)
-	//{
+	vector<int> tour(n);
+	nearestNeighborTour(dist, tour);
+	twoOpt(tour, dist);
+	twoOpt(given, dist);
+	if (tourLength(given, dist) <= tourLength(tour, dist))
+		tour = given;
 
-	//}
+	vector<DeliveryRequest> reordered;
+	for (int i = 1; i < n; i++)
+		reordered.push_back(deliveries[tour[i] - 1]);
+	deliveries.swap(reordered);
 
-	newCrowDistance = oldCrowDistance;
+	newCrowDistance = tourLength(tour, crow);
+}
+
+bool DeliveryOptimizerImpl::validateDeliveries(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    vector<int>& unreachable) const
+{
+	TraceSpan span("DeliveryOptimizer::validate");
+	unreachable.clear();
+
+	// on a tiled map every stop's tile has to be in before its node is known;
+	// the labels come with the tiles, so nothing in between is loaded
+	vector<GeoCoord> stops;
+	stops.push_back(depot);
+	for (int i = 0; i < deliveries.size(); i++)
+		stops.push_back(deliveries[i].location);
+	if (m_map->snapshot()->tileUse != nullptr)
+		m_map->loadTilesFor(stops, false);
+
+	shared_ptr<const RoadGraph> graph = m_map->snapshot();
+	int hub = graph->findNode(depot);
+	for (int i = 0; i < deliveries.size(); i++)
+	{
+		int node = graph->findNode(deliveries[i].location);
+		if (hub == -1 || node == -1 || !graph->mayReach(hub, node) || !graph->mayReach(node, hub))
+			unreachable.push_back(i);
+	}
+	return unreachable.empty();
 }
 
 //******************** DeliveryOptimizer functions ****************************
@@ -64,7 +224,12 @@ void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 
 DeliveryOptimizer::DeliveryOptimizer(const StreetMap* sm)
 {
-    m_impl = new DeliveryOptimizerImpl(sm);
+    m_impl = new DeliveryOptimizerImpl(sm, nullptr);
+}
+
+DeliveryOptimizer::DeliveryOptimizer(const StreetMap* sm, const DistanceOracle* oracle)
+{
+    m_impl = new DeliveryOptimizerImpl(sm, oracle);
 }
 
 DeliveryOptimizer::~DeliveryOptimizer()
@@ -80,3 +245,11 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
 {
     return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
 }
+
+bool DeliveryOptimizer::validateDeliveries(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        vector<int>& unreachable) const
+{
+    return m_impl->validateDeliveries(depot, deliveries, unreachable);
+}
@@ -2,6 +2,11 @@
 #include <vector>
 #include <utility>
 #include <list>
+#include <memory>
+#include "RoadGraph.h"
+#include "Trace.h"
+#include "RouteExecutor.h"
+#include "TiledMap.h"
 using namespace std;
 
 class DeliveryPlannerImpl
@@ -14,26 +19,51 @@ public:
         const vector<DeliveryRequest>& deliveries,
         vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        DeliveryPlan& plan,
+        const RouteOptions& options) const;
+    DeliveryResult replan(
+        const DeliveryPlan& previous,
+        const GeoCoord& position,
+        const vector<DeliveryRequest>& deliveries,
+        DeliveryPlan& plan,
+        const RouteOptions& options) const;
+    future<PlanResult> planAsync(
+        RouteExecutor& executor,
+        const GeoCoord& depot,
+        const vector<DeliveryRequest>& deliveries,
+        const RouteOptions& options) const;
 
 private:
 	const StreetMap* m_map;
 	PointToPointRouter* router;
 
+	DeliveryResult planTour(const GeoCoord& start, const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const DeliveryPlan* previous, const RouteOptions& options, DeliveryPlan& out) const;
+	DeliveryResult planLegs(const RoadGraph& graph, const vector<GeoCoord>& stops, const vector<DeliveryRequest>& deliveries, const DeliveryPlan* previous, const RouteOptions& options, DeliveryPlan& plan) const;
+	void describe(DeliveryLeg& leg) const;
+
+	// a run of consecutive route edges on the same street
 	struct streetInfo
 	{
-		streetInfo(StreetSegment s)
+		streetInfo(const RoadGraph& graph, int e)
 		{
-			name = s.name;
-			length = 0.0;
-			start = s.start;
-			end = s.end;
+			street = graph.edgeStreet[e];
+			length = graph.edgeLength[e];
+			bearing = graph.edgeBearing[e];
+			start = graph.edgeFrom[e];
+			end = graph.edgeTo[e];
+			numEdges = 1;
 		}
 
-		string name;
+		int street;
 		double length;
+		double bearing;
 
-		GeoCoord start;
-		GeoCoord end;
+		int start;
+		int end;
+		int numEdges;
 
 		streetInfo() {}
 		~streetInfo() {}
@@ -41,23 +71,16 @@ private:
 
 	double getAngle(streetInfo currentS, streetInfo nextS) const
 	{
-		double deg = 0.0;
-		StreetSegment current(currentS.start, currentS.end, "");
-		StreetSegment next(nextS.start, nextS.end, "");
-
-		deg = angleBetween2Lines(current, next);
+		double deg = nextS.bearing - currentS.bearing;
+		if (deg < 0)
+			deg += 360;
 
 		return deg;
 	}
 
 	double getAngle(streetInfo currentS) const
 	{
-		double deg = 0.0;
-		StreetSegment current(currentS.start, currentS.end, "");
-
-		deg = angleOfLine(current);
-
-		return deg;
+		return currentS.bearing;
 	}
 
 	string getDirection(streetInfo street) const
@@ -107,119 +130,242 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
     double& totalDistanceTravelled) const
 {
 	totalDistanceTravelled = 0;
-	DeliveryRequest ends("", depot);
+	DeliveryPlan plan;
+	DeliveryResult result = generateDeliveryPlan(depot, deliveries, plan, RouteOptions());
+	if (result == TIMED_OUT || result == CANCELLED || result == INCOMPLETE_MAP || result == STALE_WEIGHTS)
+		return NO_ROUTE;	// keeps to the three results callers know
+	if (result != DELIVERY_SUCCESS)
+		return result;
+	plan.appendCommands(commands);
+	totalDistanceTravelled = plan.miles();
+	return DELIVERY_SUCCESS;
+}
+
+DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, DeliveryPlan& plan, const RouteOptions& options) const
+{
+	TraceSpan span("DeliveryPlanner::plan");
 	if (deliveries.size() == 0)
 		return NO_ROUTE;
+	return planTour(depot, depot, deliveries, nullptr, options, plan);
+}
 
+DeliveryResult DeliveryPlannerImpl::replan(const DeliveryPlan& previous, const GeoCoord& position, const vector<DeliveryRequest>& deliveries, DeliveryPlan& plan, const RouteOptions& options) const
+{
+	TraceSpan span("DeliveryPlanner::replan");
+	return planTour(position, previous.depot, deliveries, &previous, options, plan);
+}
+
+future<PlanResult> DeliveryPlannerImpl::planAsync(RouteExecutor& executor, const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const RouteOptions& options) const
+{
+	shared_ptr<packaged_task<PlanResult()>> task = make_shared<packaged_task<PlanResult()>>([this, depot, deliveries, options]() {
+		PlanResult r;
+		r.result = generateDeliveryPlan(depot, deliveries, r.plan, options);
+		return r;
+	});
+	future<PlanResult> answer = task->get_future();
+	executor.submit([task]() { (*task)(); });
+	return answer;
+}
 
-	for (int i = 0; i < deliveries.size() + 1; i++)
+// A tour from start through every delivery, in order, to depot.
+DeliveryResult DeliveryPlannerImpl::planTour(const GeoCoord& start, const GeoCoord& depot, const vector<DeliveryRequest>& deliveries, const DeliveryPlan* previous, const RouteOptions& options, DeliveryPlan& out) const
+{
+	vector<GeoCoord> stops;
+	stops.push_back(start);
+	for (int i = 0; i < deliveries.size(); i++)
+		stops.push_back(deliveries[i].location);
+	stops.push_back(depot);
+
+	// On a tiled map the legs bring in the tiles they need as they go, each
+	// making a new version.  Rather than mix versions in one plan, the plan is
+	// made again on the latest version until a pass needs nothing new.  The
+	// tiles the legs cross are held until the plan is done, so a later leg's
+	// tiles can't push out an earlier one's.
+	const int MAX_TILE_ROUNDS = 10;
+	TilePins held;
+	RouteOptions planOptions = options;
+	if (planOptions.tiles == nullptr)
+		planOptions.tiles = &held;
+	if (m_map->snapshot()->tileUse != nullptr)
+		m_map->loadTilesFor(stops, false, planOptions.tiles);
+	DeliveryResult result;
+	for (int round = 0; ; round++)
+	{
+		// every leg is routed and described on the same version of the map
+		shared_ptr<const RoadGraph> pinned = m_map->snapshot();
+		out.depot = depot;
+		out.legs.clear();
+		out.legsRouted = 0;
+		result = planLegs(*pinned, stops, deliveries, previous, planOptions, out);
+		if (pinned->tileUse == nullptr || round == MAX_TILE_ROUNDS || result == TIMED_OUT || result == CANCELLED
+			|| result == STALE_WEIGHTS || m_map->snapshot()->version == pinned->version)
+			break;
+	}
+	m_map->releaseTiles(held);
+	return result;
+}
+
+// Legs of previous made on graph are reused: one between the same two stops
+// whole, and one that passes through a leg's start on the way to its end
+// from there on, as when the driver is partway along it.
+DeliveryResult DeliveryPlannerImpl::planLegs(const RoadGraph& graph, const vector<GeoCoord>& stops, const vector<DeliveryRequest>& deliveries, const DeliveryPlan* previous, const RouteOptions& options, DeliveryPlan& plan) const
+{
+	RouteOptions legOptions = options;
+	legOptions.graph = &graph;
+
+	// a tour crossing between pieces of the map no road joins fails before
+	// any leg is routed; stops not on this version are left to the router
+	for (int i = 0; i + 1 < stops.size(); i++)
 	{
-		list<StreetSegment> segs;
-		DeliveryCommand cmd;
-		double distance = 0.0;
+		int from = graph.findNode(stops[i]);
+		int to = graph.findNode(stops[i + 1]);
+		if (from != -1 && to != -1 && !graph.mayReach(from, to))
+			return NO_ROUTE;
+	}
 
-		if (i == 0)//generates list of street segments
+	bool incomplete = false;
+	for (int i = 0; i + 1 < stops.size(); i++)
+	{
+		plan.legs.push_back(DeliveryLeg());
+		DeliveryLeg& leg = plan.legs.back();
+		leg.from = stops[i];
+		leg.to = stops[i + 1];
+		leg.deliver = i < deliveries.size();
+		if (leg.deliver)
+			leg.item = deliveries[i].item;
+
+		const DeliveryLeg* reuse = nullptr;
+		int skip = 0;
+		if (previous != nullptr)
 		{
-			if (router->generatePointToPointRoute(depot, deliveries[i].location, segs, distance) != DELIVERY_SUCCESS)
-				return NO_ROUTE;
+			int from = graph.findNode(leg.from);
+			for (int k = 0; k < previous->legs.size() && reuse == nullptr; k++)
+			{
+				const DeliveryLeg& old = previous->legs[k];
+				if (old.to != leg.to || old.route.empty() || &old.route.graph() != &graph)
+					continue;
+				for (int e = 0; e < old.route.size() && reuse == nullptr; e++)
+					if (graph.edgeFrom[old.route.edges()[e]] == from)
+					{
+						reuse = &old;
+						skip = e;
+					}
+			}
 		}
-		else if(i == (deliveries.size()))
+
+		if (reuse != nullptr)
 		{
-			if (router->generatePointToPointRoute(deliveries[i - 1].location, depot, segs, distance) != DELIVERY_SUCCESS)
-				return NO_ROUTE;
+			leg.route = reuse->route;
+			leg.route.eraseFront(skip);
+			if (skip == 0 && reuse->deliver == leg.deliver && reuse->item == leg.item)
+			{
+				leg.commands = reuse->commands;
+				continue;
+			}
 		}
 		else
 		{
-			if (router->generatePointToPointRoute(deliveries[i - 1].location, deliveries[i].location, segs, distance) != DELIVERY_SUCCESS)
-				return NO_ROUTE;
+			DeliveryResult result = router->generatePointToPointRoute(leg.from, leg.to, leg.route, legOptions);
+			if (result == INCOMPLETE_MAP)
+			{
+				// the router has brought in what this leg lacks; route the
+				// rest too, so the next version has every leg's tiles
+				incomplete = true;
+				continue;
+			}
+			if (result != DELIVERY_SUCCESS)
+				return result == TIMED_OUT || result == CANCELLED || result == STALE_WEIGHTS ? result : NO_ROUTE;
+			plan.legsRouted++;
 		}
+		describe(leg);
+	}
+	return incomplete ? INCOMPLETE_MAP : DELIVERY_SUCCESS;
+}
 
-		totalDistanceTravelled += distance;
+// Fills leg.commands from leg.route, on the version the route came from.
+void DeliveryPlannerImpl::describe(DeliveryLeg& leg) const
+{
+	TraceSpan span("plan/commands");
+	const RoadGraph& graph = leg.route.graph();
+	DeliveryCommand cmd;
+	leg.commands.clear();
 
-		if (segs.empty())
+	if (leg.route.empty())
+	{
+		//make delivery at location
+		if (leg.deliver)
 		{
-			//make delivery at location
-			cmd.initAsDeliverCommand(deliveries[i].item);
-			commands.push_back(cmd);
+			cmd.initAsDeliverCommand(leg.item);
+			leg.commands.push_back(cmd);
 		}
-		else
+	}
+	else
+	{
+		// merge consecutive edges on the same street; lengths and bearings
+		// come from the map, only a merged run needs its bearing worked out
+		vector<streetInfo> streetList;
+		for (int k = 0; k < leg.route.size(); k++)
 		{
-			list<streetInfo> streetList;
-			double streetLength = 0.0;
-
-			list<StreetSegment>::iterator it = segs.begin();
-			for (; it != segs.end(); it++) //not loading correctly for some reason
+			int e = leg.route.edges()[k];
+			if (!streetList.empty() && streetList.back().street == graph.edgeStreet[e])
 			{
-				streetLength = distanceEarthMiles(it->start, it->end);
-				streetInfo street(*it);
-				street.length = streetLength;
-				streetList.push_back(street);
+				streetInfo& run = streetList.back();
+				run.length += graph.edgeLength[e];
+				run.end = graph.edgeTo[e];
+				run.numEdges++;
 			}
+			else
+				streetList.push_back(streetInfo(graph, e));
+		}
 
-			list<streetInfo>::iterator iter = streetList.begin();
-			list<streetInfo>::iterator iterPre = streetList.begin();
-			advance(iter, 1);
-			for (; iter != streetList.end(); iter++) 
+		for (int k = 0; k < streetList.size(); k++)
+		{
+			streetInfo& run = streetList[k];
+			if (run.numEdges > 1)
+				run.bearing = bearingDegrees(graph.coords, run.start, run.end);
+		}
+
+		string dir;
+		double angle = 0.0;
+		for (int k = 0; k < streetList.size(); k++)
+		{
+			const streetInfo& street = streetList[k];
+			const string& name = graph.streetNames[street.street];
+			if (k + 1 == streetList.size())
 			{
-				if (iter->name == iterPre->name)
+				//one proceeds cmd then one delivery cmd
+				dir = getDirection(street);//finds direction of road
+				cmd.initAsProceedCommand(dir, name, street.length);
+				leg.commands.push_back(cmd);
+				if (leg.deliver)
 				{
-					iterPre->length += iter->length;
-					iterPre->end = iter->end;
-					streetList.erase(iter);
-					iter = iterPre;
-				}
-				else
-				{
-					iterPre++;
+					cmd.initAsDeliverCommand(leg.item);
+					leg.commands.push_back(cmd);
 				}
+				break;
 			}
-
-			list<streetInfo>::iterator iter2 = streetList.begin();
-			list<streetInfo>::iterator iterNext = streetList.begin();
-			advance(iterNext, 1);
-			string dir;
-			double angle = 0.0;
-			for (; iter2 != streetList.end(); iter2++)
+			else
 			{
-				if (iterNext == streetList.end())
-				{
-					//one proceeds cmd then one delivery cmd
-					dir = getDirection(*iter2);//finds direction of road
-					cmd.initAsProceedCommand(dir, iter2->name, iter2->length);
-					commands.push_back(cmd);
-					if (i < deliveries.size())
-					{
-						cmd.initAsDeliverCommand(deliveries[i].item);
-						commands.push_back(cmd);
-					}
-					break;
-				}
-				else
-				{
-					//one proceeds cmd then one turn cmd
-					dir = getDirection(*iter2);
-					cmd.initAsProceedCommand(dir, iter2->name, iter2->length);
-					commands.push_back(cmd);
-
-					angle = getAngle(*iter2, *iterNext);
-					if(angle < 1 || angle > 359) {}
-					else if(angle >= 1 && angle < 180)
-						cmd.initAsTurnCommand("left", iterNext->name);
-					else if(angle >= 180 && angle <= 359)
-						cmd.initAsTurnCommand("right", iterNext->name);
-					
-					commands.push_back(cmd);
-				}
-				iterNext++;
+				//one proceeds cmd then one turn cmd
+				const streetInfo& nextStreet = streetList[k + 1];
+				dir = getDirection(street);
+				cmd.initAsProceedCommand(dir, name, street.length);
+				leg.commands.push_back(cmd);
+
+				angle = getAngle(street, nextStreet);
+				if(angle < 1 || angle > 359) {}
+				else if(angle >= 1 && angle < 180)
+					cmd.initAsTurnCommand("left", graph.streetNames[nextStreet.street]);
+				else if(angle >= 180 && angle <= 359)
+					cmd.initAsTurnCommand("right", graph.streetNames[nextStreet.street]);
+				
+				leg.commands.push_back(cmd);
 			}
-
-
-
 		}
 
-    }
 
-	return DELIVERY_SUCCESS;
+
+	}
 }
 
 //******************** DeliveryPlanner functions ******************************
@@ -245,3 +391,31 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
 {
     return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
+
+DeliveryResult DeliveryPlanner::generateDeliveryPlan(
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryPlan& plan,
+    const RouteOptions& options) const
+{
+    return m_impl->generateDeliveryPlan(depot, deliveries, plan, options);
+}
+
+DeliveryResult DeliveryPlanner::replan(
+    const DeliveryPlan& previous,
+    const GeoCoord& position,
+    const vector<DeliveryRequest>& deliveries,
+    DeliveryPlan& plan,
+    const RouteOptions& options) const
+{
+    return m_impl->replan(previous, position, deliveries, plan, options);
+}
+
+future<PlanResult> DeliveryPlanner::planAsync(
+    RouteExecutor& executor,
+    const GeoCoord& depot,
+    const vector<DeliveryRequest>& deliveries,
+    const RouteOptions& options) const
+{
+    return m_impl->planAsync(executor, depot, deliveries, options);
+}
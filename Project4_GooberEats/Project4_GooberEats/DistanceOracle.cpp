@@ -0,0 +1,472 @@
+#include "provided.h"
+#include "DistanceOracle.h"
+#include "RoadGraph.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <cmath>
+#include <memory>
+using namespace std;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ORACLE_SSE2
+#endif
+
+class DistanceOracleImpl
+{
+public:
+    DistanceOracleImpl(const StreetMap* sm);
+    ~DistanceOracleImpl();
+    void build();
+    bool save(string file) const;
+    bool load(string file);
+    bool ready() const;
+    double distance(int from, int to) const;
+    double distance(const GeoCoord& from, const GeoCoord& to) const;
+    long long labelEntries() const;
+
+private:
+	const StreetMap* m_map;
+
+	// Node n's label is [m_labelBegin[n], m_labelBegin[n + 1]) of m_hub and
+	// m_hubDist, sorted by hub.  Hubs are ranks, not node IDs: rank 0 is the
+	// node whose search ran first.  Every label is padded with at least one
+	// sentinel hub of numNodes to a multiple of LABEL_BLOCK entries, so the
+	// merge in distance() can work a block at a time with no bounds checks.
+	vector<int> m_labelBegin;
+	vector<int> m_hub;
+	vector<double> m_hubDist;
+
+	// identifies the map the labels were built from
+	int m_numNodes;
+	int m_numEdges;
+	double m_totalLength;
+	unsigned long long m_version;	// RoadGraph::version they are good for
+
+	void fingerprint(const RoadGraph& graph, int& numNodes, int& numEdges, double& totalLength) const;
+	void rankNodes(const RoadGraph& graph, vector<int>& order) const;
+};
+
+static const char ORACLE_MAGIC[8] = { 'G', 'E', 'H', 'U', 'B', 'L', 'B', '2' };
+static const int LABEL_BLOCK = 4;
+
+DistanceOracleImpl::DistanceOracleImpl(const StreetMap* sm)
+{
+	m_map = sm;
+	m_numNodes = -1;
+	m_numEdges = -1;
+	m_totalLength = 0;
+	m_version = 0;
+}
+
+DistanceOracleImpl::~DistanceOracleImpl()
+{
+	m_map = nullptr;
+}
+
+void DistanceOracleImpl::fingerprint(const RoadGraph& graph, int& numNodes, int& numEdges, double& totalLength) const
+{
+	numNodes = graph.numNodes();
+	numEdges = graph.numEdges();
+	totalLength = 0;
+	for (int e = 0; e < numEdges; e++)
+		totalLength += graph.edgeLength[e];
+}
+
+// Labels stay small when the nodes searched first are the ones most shortest
+// paths run through.  Those are estimated by growing shortest path trees from
+// a sample of roots and counting, for every node, how many nodes lie below it.
+void DistanceOracleImpl::rankNodes(const RoadGraph& graph, vector<int>& order) const
+{
+	int n = graph.numNodes();
+	const int SAMPLES = 64;
+
+	vector<double> score(n, 0.0);
+	vector<double> dist(n);
+	vector<int> parent(n);
+	vector<int> settled;
+	vector<double> below(n);
+	vector<pair<double, int>> heap;
+	typedef greater<pair<double, int>> minFirst;
+
+	for (int s = 0; s < SAMPLES && n > 0; s++)
+	{
+		int root = (int)((long long)s * n / SAMPLES);
+		fill(dist.begin(), dist.end(), HUGE_VAL);
+		settled.clear();
+
+		dist[root] = 0;
+		parent[root] = -1;
+		heap.assign(1, make_pair(0.0, root));
+		while (!heap.empty())
+		{
+			pop_heap(heap.begin(), heap.end(), minFirst());
+			pair<double, int> top = heap.back();
+			heap.pop_back();
+			if (top.first > dist[top.second])
+				continue;
+			settled.push_back(top.second);
+
+			for (int e = graph.edgesBegin(top.second); e != graph.edgesEnd(top.second); e++)
+			{
+				int next = graph.edgeTo[e];
+				double nd = top.first + graph.edgeLength[e];
+				if (nd < dist[next])
+				{
+					dist[next] = nd;
+					parent[next] = top.second;
+					heap.push_back(make_pair(nd, next));
+					push_heap(heap.begin(), heap.end(), minFirst());
+				}
+			}
+		}
+
+		// subtree sizes, leaves first
+		for (int i = 0; i < settled.size(); i++)
+			below[settled[i]] = 1;
+		for (int i = settled.size() - 1; i > 0; i--)
+			below[parent[settled[i]]] += below[settled[i]];
+		for (int i = 0; i < settled.size(); i++)
+			score[settled[i]] += below[settled[i]];
+	}
+
+	order.resize(n);
+	for (int i = 0; i < n; i++)
+		order[i] = i;
+	stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		if (score[a] != score[b])
+			return score[a] > score[b];
+		return graph.edgesEnd(a) - graph.edgesBegin(a) > graph.edgesEnd(b) - graph.edgesBegin(b);
+	});
+}
+
+// Pruned landmark labeling: a Dijkstra search from each node in rank order
+// that stops expanding wherever the labels built so far already give a
+// distance at least as short.
+void DistanceOracleImpl::build()
+{
+	// one version of the map for the whole build, even if an edit lands meanwhile
+	shared_ptr<const RoadGraph> pinned = m_map->snapshot();
+	const RoadGraph& graph = *pinned;
+	int n = graph.numNodes();
+
+	vector<int> order;
+	rankNodes(graph, order);
+
+	vector<vector<pair<int, double>>> labels(n);
+	vector<double> rootDist(n + 1, HUGE_VAL);	// the root's label, by hub
+	vector<double> dist(n, HUGE_VAL);
+	vector<int> touched;
+	vector<pair<double, int>> heap;
+	typedef greater<pair<double, int>> minFirst;
+
+	for (int rank = 0; rank < n; rank++)
+	{
+		int root = order[rank];
+		for (int i = 0; i < labels[root].size(); i++)
+			rootDist[labels[root][i].first] = labels[root][i].second;
+
+		dist[root] = 0;
+		touched.assign(1, root);
+		heap.assign(1, make_pair(0.0, root));
+		while (!heap.empty())
+		{
+			pop_heap(heap.begin(), heap.end(), minFirst());
+			pair<double, int> top = heap.back();
+			heap.pop_back();
+			double d = top.first;
+			int node = top.second;
+			if (d > dist[node])
+				continue;
+
+			// already covered by an earlier hub?
+			bool covered = false;
+			const vector<pair<int, double>>& label = labels[node];
+			for (int i = 0; i < label.size() && !covered; i++)
+				covered = rootDist[label[i].first] + label[i].second <= d;
+			if (covered)
+				continue;
+
+			labels[node].push_back(make_pair(rank, d));
+
+			for (int e = graph.edgesBegin(node); e != graph.edgesEnd(node); e++)
+			{
+				int next = graph.edgeTo[e];
+				double nd = d + graph.edgeLength[e];
+				if (nd < dist[next])
+				{
+					if (dist[next] == HUGE_VAL)
+						touched.push_back(next);
+					dist[next] = nd;
+					heap.push_back(make_pair(nd, next));
+					push_heap(heap.begin(), heap.end(), minFirst());
+				}
+			}
+		}
+
+		for (int i = 0; i < touched.size(); i++)
+			dist[touched[i]] = HUGE_VAL;
+		for (int i = 0; i < labels[root].size(); i++)
+			rootDist[labels[root][i].first] = HUGE_VAL;
+	}
+
+	// flatten into contiguous arrays, each label closed by sentinels
+	m_labelBegin.assign(n + 1, 0);
+	m_hub.clear();
+	m_hubDist.clear();
+	for (int node = 0; node < n; node++)
+	{
+		m_labelBegin[node] = m_hub.size();
+		for (int i = 0; i < labels[node].size(); i++)
+		{
+			m_hub.push_back(labels[node][i].first);
+			m_hubDist.push_back(labels[node][i].second);
+		}
+		do
+		{
+			m_hub.push_back(n);
+			m_hubDist.push_back(HUGE_VAL);
+		} while (m_hub.size() % LABEL_BLOCK != 0);
+	}
+	m_labelBegin[n] = m_hub.size();
+
+	fingerprint(graph, m_numNodes, m_numEdges, m_totalLength);
+	m_version = graph.version;
+}
+
+template<typename T>
+static void writeArray(ofstream& out, const vector<T>& v)
+{
+	long long size = v.size();
+	out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	out.write(reinterpret_cast<const char*>(v.data()), size * sizeof(T));
+}
+
+template<typename T>
+static bool readArray(ifstream& in, vector<T>& v)
+{
+	long long size = 0;
+	if (!in.read(reinterpret_cast<char*>(&size), sizeof(size)) || size < 0)
+		return false;
+	v.resize(size);
+	return (bool)in.read(reinterpret_cast<char*>(v.data()), size * sizeof(T));
+}
+
+bool DistanceOracleImpl::save(string file) const
+{
+	if (!ready())
+		return false;
+
+	ofstream out(file, ios::binary);
+	if (!out)
+		return false;
+
+	out.write(ORACLE_MAGIC, sizeof(ORACLE_MAGIC));
+	out.write(reinterpret_cast<const char*>(&m_numNodes), sizeof(m_numNodes));
+	out.write(reinterpret_cast<const char*>(&m_numEdges), sizeof(m_numEdges));
+	out.write(reinterpret_cast<const char*>(&m_totalLength), sizeof(m_totalLength));
+	writeArray(out, m_labelBegin);
+	writeArray(out, m_hub);
+	writeArray(out, m_hubDist);
+	return (bool)out;
+}
+
+bool DistanceOracleImpl::load(string file)
+{
+	ifstream in(file, ios::binary);
+	if (!in)
+		return false;
+
+	char magic[sizeof(ORACLE_MAGIC)];
+	int numNodes, numEdges;
+	double totalLength;
+	if (!in.read(magic, sizeof(magic)) || !equal(magic, magic + sizeof(magic), ORACLE_MAGIC))
+		return false;
+	if (!in.read(reinterpret_cast<char*>(&numNodes), sizeof(numNodes)) ||
+		!in.read(reinterpret_cast<char*>(&numEdges), sizeof(numEdges)) ||
+		!in.read(reinterpret_cast<char*>(&totalLength), sizeof(totalLength)))
+		return false;
+
+	shared_ptr<const RoadGraph> pinned = m_map->snapshot();
+	int mapNodes, mapEdges;
+	double mapLength;
+	fingerprint(*pinned, mapNodes, mapEdges, mapLength);
+	if (numNodes != mapNodes || numEdges != mapEdges || totalLength != mapLength)
+		return false;
+
+	vector<int> labelBegin, hub;
+	vector<double> hubDist;
+	if (!readArray(in, labelBegin) || !readArray(in, hub) || !readArray(in, hubDist))
+		return false;
+	if (labelBegin.size() != numNodes + 1 || hub.size() != hubDist.size() || labelBegin[numNodes] != hub.size())
+		return false;
+	for (int i = 0; i < numNodes; i++)
+	{
+		int begin = labelBegin[i];
+		int end = labelBegin[i + 1];
+		if (begin % LABEL_BLOCK != 0 || end <= begin || hub[end - 1] != numNodes)
+			return false;
+	}
+
+	m_labelBegin.swap(labelBegin);
+	m_hub.swap(hub);
+	m_hubDist.swap(hubDist);
+	m_numNodes = numNodes;
+	m_numEdges = numEdges;
+	m_totalLength = totalLength;
+	m_version = pinned->version;
+	return true;
+}
+
+bool DistanceOracleImpl::ready() const
+{
+	return m_numNodes >= 0 && m_version == m_map->snapshot()->version;
+}
+
+double DistanceOracleImpl::distance(int from, int to) const
+{
+	if (from < 0 || from >= m_numNodes || to < 0 || to >= m_numNodes)
+		return -1;
+
+	const int* hubA = &m_hub[m_labelBegin[from]];
+	const int* hubB = &m_hub[m_labelBegin[to]];
+	const double* distA = &m_hubDist[m_labelBegin[from]];
+	const double* distB = &m_hubDist[m_labelBegin[to]];
+
+	double best = HUGE_VAL;
+
+#if defined(ORACLE_SSE2)
+	// Compare a block of four hubs from each label all against all (the B
+	// block rotated three times), then move past whichever block ends lower,
+	// or both.  Shared hubs are rare, so a match is resolved with scalar code.
+	for (;;)
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hubA));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hubB));
+		__m128i eq = _mm_cmpeq_epi32(a, b);
+		eq = _mm_or_si128(eq, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 3, 2, 1))));
+		eq = _mm_or_si128(eq, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(1, 0, 3, 2))));
+		eq = _mm_or_si128(eq, _mm_cmpeq_epi32(a, _mm_shuffle_epi32(b, _MM_SHUFFLE(2, 1, 0, 3))));
+
+		int matches = _mm_movemask_ps(_mm_castsi128_ps(eq));
+		for (int i = 0; matches != 0; i++, matches >>= 1)
+		{
+			if ((matches & 1) == 0)
+				continue;
+			for (int j = 0; j < LABEL_BLOCK; j++)
+			{
+				if (hubB[j] == hubA[i])
+				{
+					best = min(best, distA[i] + distB[j]);
+					break;
+				}
+			}
+		}
+
+		int lastA = hubA[LABEL_BLOCK - 1];
+		int lastB = hubB[LABEL_BLOCK - 1];
+		if (lastA == m_numNodes && lastB == m_numNodes)
+			break;
+		int stepA = (lastA <= lastB) * LABEL_BLOCK;
+		int stepB = (lastB <= lastA) * LABEL_BLOCK;
+		hubA += stepA;
+		distA += stepA;
+		hubB += stepB;
+		distB += stepB;
+	}
+#else
+	// the sentinels stop the merge
+	for (;;)
+	{
+		if (*hubA == *hubB)
+		{
+			if (*hubA == m_numNodes)
+				break;
+			best = min(best, *distA++ + *distB++);
+			hubA++;
+			hubB++;
+		}
+		else if (*hubA < *hubB)
+		{
+			hubA++;
+			distA++;
+		}
+		else
+		{
+			hubB++;
+			distB++;
+		}
+	}
+#endif
+
+	return best == HUGE_VAL ? -1 : best;
+}
+
+double DistanceOracleImpl::distance(const GeoCoord& from, const GeoCoord& to) const
+{
+	shared_ptr<const RoadGraph> pinned = m_map->snapshot();
+	return distance(pinned->findNode(from), pinned->findNode(to));
+}
+
+long long DistanceOracleImpl::labelEntries() const
+{
+	// not counting the sentinels
+	long long entries = 0;
+	for (int i = 0; i < m_hub.size(); i++)
+		if (m_hub[i] != m_numNodes)
+			entries++;
+	return entries;
+}
+
+//******************** DistanceOracle functions *******************************
+
+// These functions simply delegate to DistanceOracleImpl's functions.
+
+DistanceOracle::DistanceOracle(const StreetMap* sm)
+{
+    m_impl = new DistanceOracleImpl(sm);
+}
+
+DistanceOracle::~DistanceOracle()
+{
+    delete m_impl;
+}
+
+void DistanceOracle::build()
+{
+    m_impl->build();
+}
+
+bool DistanceOracle::save(string file) const
+{
+    return m_impl->save(file);
+}
+
+bool DistanceOracle::load(string file)
+{
+    return m_impl->load(file);
+}
+
+bool DistanceOracle::ready() const
+{
+    return m_impl->ready();
+}
+
+double DistanceOracle::distance(int from, int to) const
+{
+    return m_impl->distance(from, to);
+}
+
+double DistanceOracle::distance(const GeoCoord& from, const GeoCoord& to) const
+{
+    return m_impl->distance(from, to);
+}
+
+long long DistanceOracle::labelEntries() const
+{
+    return m_impl->labelEntries();
+}
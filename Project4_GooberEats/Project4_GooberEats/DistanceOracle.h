@@ -0,0 +1,45 @@
+// DistanceOracle.h
+// Exact road distances between map nodes without a graph search, using hub
+// labels: every node stores a sorted list of (hub, distance) pairs such that
+// any two nodes share a hub on a shortest path between them, so a query is a
+// single merge of two short arrays.  Building the labels takes a few seconds;
+// they can be saved and loaded for a given map file.
+
+#ifndef DistanceOracle_h
+#define DistanceOracle_h
+
+#include "provided.h"
+#include <string>
+
+class DistanceOracleImpl;
+
+class DistanceOracle
+{
+public:
+    DistanceOracle(const StreetMap* sm);
+    ~DistanceOracle();
+      // Computes labels for the map as it is now loaded
+    void build();
+      // Labels only match the map they were built from; load() returns false
+      // if the file is unreadable or was built from a different map.
+    bool save(std::string file) const;
+    bool load(std::string file);
+      // False until built or loaded, and again once the map is edited (see
+      // StreetMap::applyEdits), as the labels then describe an older version
+    bool ready() const;
+      // Road distance in miles between two nodes (IDs as in RoadGraph.h), or
+      // -1 if there is no route.  Treats every segment as two-way, as
+      // StreetMap::load does.
+    double distance(int from, int to) const;
+      // As above, or -1 if either coordinate is not a map node
+    double distance(const GeoCoord& from, const GeoCoord& to) const;
+      // Total (hub, distance) entries over all nodes
+    long long labelEntries() const;
+      // We prevent a DistanceOracle object from being copied or assigned.
+    DistanceOracle(const DistanceOracle&) = delete;
+    DistanceOracle& operator=(const DistanceOracle&) = delete;
+private:
+    DistanceOracleImpl* m_impl;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "provided.h"
+#include "EdgeWeightProfile.h"
+#include "RoadGraph.h"
+#include "ExpandableHashMap.h"
+#include "Allocators.h"
+#include <string>
+#include <vector>
+#include <cmath>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+const double EdgeWeightProfile::CLOSED = HUGE_VAL;
+
+class EdgeWeightProfileImpl
+{
+public:
+    EdgeWeightProfileImpl(const StreetMap* sm);
+    ~EdgeWeightProfileImpl();
+    bool setStreetFactor(const string& streetName, double factor);
+    bool setEdgeFactor(int edge, double factor);
+    void clearFactors();
+    void customize();
+    shared_ptr<const EdgeCosts> costs() const;
+    shared_ptr<const EdgeCosts> costsFor(const RoadGraph& g) const;
+    double minFactor() const;
+    unsigned long long version() const;
+
+private:
+	const StreetMap* m_map;
+	// lives as long as the profile and only ever gains streets, one at a
+	// time, so its nodes come from a pool of their own
+	NodePool m_streetNodes;
+	ExpandableHashMap<string, int, PoolAllocator<char>> m_streetIndex;
+
+	vector<double> m_streetFactor;	// by street ID
+	vector<double> m_edgeFactor;	// by edge ID; 0 means use the street's
+	unsigned long long m_edgeVersion;	// the version those edge IDs are from
+
+	// the last customize()'s costs and the street factors they were made
+	// with, and on a tiled map the costs last made from those for another
+	// version; only swapping the pointers is locked
+	mutable mutex m_publishLock;
+	shared_ptr<const EdgeCosts> m_published;
+	shared_ptr<const vector<double>> m_publishedStreets;
+	mutable shared_ptr<const EdgeCosts> m_tiledCosts;
+
+	void addStreets(const RoadGraph& graph);
+
+	static bool validFactor(double factor) { return factor > 0; }
+	static shared_ptr<EdgeCosts> price(const RoadGraph& graph, const vector<double>& streetFactor, const vector<double>* edgeFactor);
+};
+
+EdgeWeightProfileImpl::EdgeWeightProfileImpl(const StreetMap* sm)
+ : m_streetIndex(0.5, PoolAllocator<char>(&m_streetNodes))
+{
+	m_map = sm;
+	clearFactors();
+	customize();
+}
+
+EdgeWeightProfileImpl::~EdgeWeightProfileImpl()
+{
+	m_map = nullptr;
+}
+
+bool EdgeWeightProfileImpl::setStreetFactor(const string& streetName, double factor)
+{
+	const int* s = m_streetIndex.find(streetName);
+	if (s == nullptr || !validFactor(factor))
+		return false;
+
+	m_streetFactor[*s] = factor;
+	return true;
+}
+
+bool EdgeWeightProfileImpl::setEdgeFactor(int edge, double factor)
+{
+	if (edge < 0 || edge >= m_edgeFactor.size() || !validFactor(factor) || m_map->snapshot()->tileUse != nullptr)
+		return false;
+
+	m_edgeFactor[edge] = factor;
+	return true;
+}
+
+// Street IDs never change, but edits can add streets.
+void EdgeWeightProfileImpl::addStreets(const RoadGraph& graph)
+{
+	for (int s = m_streetFactor.size(); s < graph.streetNames.size(); s++)
+	{
+		m_streetIndex.associate(graph.streetNames[s], s);
+		m_streetFactor.push_back(1.0);
+	}
+}
+
+void EdgeWeightProfileImpl::clearFactors()
+{
+	shared_ptr<const RoadGraph> graph = m_map->snapshot();
+	m_streetFactor.assign(m_streetFactor.size(), 1.0);
+	addStreets(*graph);
+	m_edgeFactor.assign(graph->numEdges(), 0.0);
+	m_edgeVersion = graph->version;
+}
+
+// Every edge of graph at its factor: its own in edgeFactor, if given and
+// set, else its street's
+shared_ptr<EdgeCosts> EdgeWeightProfileImpl::price(const RoadGraph& graph, const vector<double>& streetFactor, const vector<double>* edgeFactor)
+{
+	int numEdges = graph.numEdges();
+	shared_ptr<EdgeCosts> out = make_shared<EdgeCosts>();
+	out->version = graph.version;
+	out->costs.resize(numEdges);
+	out->minFactor = HUGE_VAL;
+	for (int e = 0; e < numEdges; e++)
+	{
+		double factor = edgeFactor != nullptr ? (*edgeFactor)[e] : 0;
+		if (factor == 0)
+			factor = streetFactor[graph.edgeStreet[e]];
+
+		// not length * factor: a zero-length closed edge would cost NaN
+		out->costs[e] = factor == EdgeWeightProfile::CLOSED ? HUGE_VAL : graph.edgeLength[e] * factor;
+		if (factor < out->minFactor)
+			out->minFactor = factor;
+	}
+
+	if (out->minFactor == HUGE_VAL)	// everything closed
+		out->minFactor = 1.0;
+	return out;
+}
+
+void EdgeWeightProfileImpl::customize()
+{
+	shared_ptr<const RoadGraph> pinned = m_map->snapshot();
+	const RoadGraph& graph = *pinned;
+
+	addStreets(graph);
+	if (m_edgeVersion != graph.version)
+	{
+		m_edgeFactor.assign(graph.numEdges(), 0.0);
+		m_edgeVersion = graph.version;
+	}
+
+	// built aside, so queries using the last costs never see these half done
+	shared_ptr<const EdgeCosts> next = price(graph, m_streetFactor, &m_edgeFactor);
+	shared_ptr<const vector<double>> streets = make_shared<vector<double>>(m_streetFactor);
+	shared_ptr<const EdgeCosts> tiled;
+	{
+		lock_guard<mutex> lock(m_publishLock);
+		m_published.swap(next);
+		m_publishedStreets.swap(streets);
+		m_tiledCosts.swap(tiled);
+	}
+}
+
+shared_ptr<const EdgeCosts> EdgeWeightProfileImpl::costs() const
+{
+	lock_guard<mutex> lock(m_publishLock);
+	return m_published;
+}
+
+shared_ptr<const EdgeCosts> EdgeWeightProfileImpl::costsFor(const RoadGraph& g) const
+{
+	shared_ptr<const vector<double>> streets;
+	{
+		lock_guard<mutex> lock(m_publishLock);
+		if (m_published->version == g.version)
+			return m_published;
+		if (m_tiledCosts != nullptr && m_tiledCosts->version == g.version)
+			return m_tiledCosts;
+		streets = m_publishedStreets;
+	}
+	if (g.tileUse == nullptr || streets->size() < g.streetNames.size())
+		return nullptr;
+
+	// queries on the same version meanwhile may each price it; any will do
+	shared_ptr<const EdgeCosts> made = price(g, *streets, nullptr);
+	lock_guard<mutex> lock(m_publishLock);
+	if (m_publishedStreets == streets)		// no customize() since
+		m_tiledCosts = made;
+	return made;
+}
+
+double EdgeWeightProfileImpl::minFactor() const
+{
+	return costs()->minFactor;
+}
+
+unsigned long long EdgeWeightProfileImpl::version() const
+{
+	return costs()->version;
+}
+
+//******************** EdgeWeightProfile functions ****************************
+
+// These functions simply delegate to EdgeWeightProfileImpl's functions.
+
+EdgeWeightProfile::EdgeWeightProfile(const StreetMap* sm)
+{
+    m_impl = new EdgeWeightProfileImpl(sm);
+}
+
+EdgeWeightProfile::~EdgeWeightProfile()
+{
+    delete m_impl;
+}
+
+bool EdgeWeightProfile::setStreetFactor(const string& streetName, double factor)
+{
+    return m_impl->setStreetFactor(streetName, factor);
+}
+
+bool EdgeWeightProfile::setEdgeFactor(int edge, double factor)
+{
+    return m_impl->setEdgeFactor(edge, factor);
+}
+
+void EdgeWeightProfile::clearFactors()
+{
+    m_impl->clearFactors();
+}
+
+void EdgeWeightProfile::customize()
+{
+    m_impl->customize();
+}
+
+shared_ptr<const EdgeCosts> EdgeWeightProfile::costs() const
+{
+    return m_impl->costs();
+}
+
+shared_ptr<const EdgeCosts> EdgeWeightProfile::costsFor(const RoadGraph& g) const
+{
+    return m_impl->costsFor(g);
+}
+
+double EdgeWeightProfile::minFactor() const
+{
+    return m_impl->minFactor();
+}
+
+unsigned long long EdgeWeightProfile::version() const
+{
+    return m_impl->version();
+}
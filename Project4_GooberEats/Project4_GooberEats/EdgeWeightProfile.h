@@ -0,0 +1,82 @@
+// EdgeWeightProfile.h
+// Edge costs other than plain distance, e.g. rush-hour slowdowns or closures.
+// Building a profile indexes the map's streets once (this part does not depend
+// on any costs); changing costs afterwards only records factors, and
+// customize() turns them into a cost for every edge in one linear pass, with
+// no map reload.  Pass the profile to a query through RouteOptions::weights.
+//
+// Costs belong to one version of the map (see StreetMap::applyEdits), and a
+// query on any other version fails with STALE_WEIGHTS, so customize() must be
+// run again after every edit.  Street factors carry over to later versions,
+// but edge IDs do not, so customize() on a newer version drops the edge
+// factors; set them again first.
+//
+// On a tiled map every change to the tiles in memory is a new version, often
+// part way through a query, so there the costs are keyed by street instead:
+// for each version a query routes on, costsFor() prices its edges from the
+// street factors of the last customize().  Edge IDs there last only until
+// the next tile load, so setEdgeFactor() refuses them.
+//
+// Queries may run while customize() does: it builds the costs anew and
+// publishes them when done, and a query keeps the costs it started with.
+// The setters and customize() are for one thread at a time.
+
+#ifndef EdgeWeightProfile_h
+#define EdgeWeightProfile_h
+
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+class EdgeWeightProfileImpl;
+struct RoadGraph;
+
+  // One customize()'s costs, never changed once published
+struct EdgeCosts
+{
+    std::vector<double> costs;      // by edge ID
+    unsigned long long version;     // the map version (RoadGraph::version) they are for
+    double minFactor;               // the smallest cost per mile of any open edge
+};
+
+class EdgeWeightProfile
+{
+public:
+      // A factor that makes an edge unusable
+    static const double CLOSED;
+
+    EdgeWeightProfile(const StreetMap* sm);
+    ~EdgeWeightProfile();
+      // An edge costs its length times its factor.  An edge factor (edge IDs as
+      // in RoadGraph.h) overrides the factor of the edge's street.  Factors
+      // must be positive or CLOSED.  Returns false for an unknown street or
+      // edge, a bad factor, or any edge of a tiled map.
+    bool setStreetFactor(const std::string& streetName, double factor);
+    bool setEdgeFactor(int edge, double factor);
+      // Back to every factor being 1
+    void clearFactors();
+      // Recomputes every edge's cost from the current factors
+    void customize();
+      // The costs as of the last customize(), for a query to hold while it
+      // runs.  Taking them locks the profile briefly; the router does so
+      // once per search.  A CLOSED edge costs +infinity, whatever its length.
+    std::shared_ptr<const EdgeCosts> costs() const;
+      // The costs to route on version g with: costs() if they are for it; on
+      // a tiled map, g's edges priced by the last customize()'s street
+      // factors (built once per version); otherwise null, and the router
+      // fails with STALE_WEIGHTS.
+    std::shared_ptr<const EdgeCosts> costsFor(const RoadGraph& g) const;
+      // The map version (RoadGraph::version) costs() is for
+    unsigned long long version() const;
+      // The smallest cost per mile of any open edge; lets the router scale its
+      // distance heuristic so it stays admissible
+    double minFactor() const;
+      // We prevent an EdgeWeightProfile object from being copied or assigned.
+    EdgeWeightProfile(const EdgeWeightProfile&) = delete;
+    EdgeWeightProfile& operator=(const EdgeWeightProfile&) = delete;
+private:
+    EdgeWeightProfileImpl* m_impl;
+};
+
+#endif
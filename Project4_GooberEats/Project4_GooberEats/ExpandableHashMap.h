@@ -3,15 +3,28 @@
 #include<vector>
 // Skeleton for the ExpandableHashMap class template.  You must implement the first six
 // member functions.
+//
+//
+// Threading: any number of threads may call find() on a map that none of them
+// is modifying; associate() and reset() need the map to themselves.  The
+// hasher() functions this calls must not touch shared state (the ones in
+// StreetMap.cpp don't).
+//
+// Allocator: every node and bucket array comes from a copy of the given
+// std-style allocator, rebound as needed; see Allocators.h for an arena (free
+// everything in one go) and a node pool.  Growing the map moves nodes into
+// the new buckets without reallocating them.
 
 #ifndef ExpandableHashMap_h
 #define ExpandableHashMap_h
 
-template<typename KeyType, typename ValueType>
+#include <memory>
+
+template<typename KeyType, typename ValueType, typename Allocator = std::allocator<char>>
 class ExpandableHashMap
 {
 public:
-	ExpandableHashMap(double maximumLoadFactor = 0.5);
+	ExpandableHashMap(double maximumLoadFactor = 0.5, const Allocator& alloc = Allocator());
 	~ExpandableHashMap();
 	void reset();
 	int size() const;
@@ -26,6 +39,12 @@ public:
 		return const_cast<ValueType*>(const_cast<const ExpandableHashMap*>(this)->find(key));
 	}
 
+	// Memory the map holds, not counting anything its keys and values point
+	// to: the bucket array, and a list node per item wherever the allocator
+	// put it (so a pooled map's nodes are also in its pool's bytesReserved)
+	std::size_t bucketBytes() const { return sizeof(BucketArray) + m_vals->capacity() * sizeof(Bucket); }
+	std::size_t nodeBytes() const { return size() * (sizeof(Node) + 2 * sizeof(void*)); }	// value and list links
+
 	// C++11 syntax for preventing copying and assignment
 	ExpandableHashMap(const ExpandableHashMap&) = delete;
 	ExpandableHashMap& operator=(const ExpandableHashMap&) = delete;
@@ -37,27 +56,31 @@ private:
 		ValueType val;
 	};
 
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Node> NodeAllocator;
+	typedef std::list<Node, NodeAllocator> Bucket;
+	typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Bucket> BucketAllocator;
+	typedef std::vector<Bucket, BucketAllocator> BucketArray;
+
 	double m_numItems;
 	int m_numBuckets;
 	double maxLoad;
-	std::vector<std::list<Node>>* m_vals;
+	Allocator m_alloc;
+	BucketArray* m_vals;
 
 	unsigned int getBucketNumber(const KeyType& key) const;
+	BucketArray* newBuckets(int count) const
+	{
+		return new BucketArray(count, Bucket(NodeAllocator(m_alloc)), BucketAllocator(m_alloc));
+	}
 };
 
-template<typename KeyType, typename ValueType>
-ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFactor)
+template<typename KeyType, typename ValueType, typename Allocator>
+ExpandableHashMap<KeyType, ValueType, Allocator>::ExpandableHashMap(double maximumLoadFactor, const Allocator& alloc)
+ : m_alloc(alloc)
 {
-	m_vals = new std::vector<std::list<Node>>;
-
 	m_numItems = 0;
 	m_numBuckets = 8;
-
-	for (int i = 0; i < m_numBuckets; i++)
-	{
-		std::list<Node> tempList;
-		m_vals->push_back(tempList);
-	}
+	m_vals = newBuckets(m_numBuckets);
 
 	if (maximumLoadFactor > 0)
 		maxLoad = maximumLoadFactor;
@@ -65,14 +88,14 @@ ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFacto
 		maxLoad = 0.5;
 }
 
-template<typename KeyType, typename ValueType>
-ExpandableHashMap<KeyType, ValueType>::~ExpandableHashMap()
+template<typename KeyType, typename ValueType, typename Allocator>
+ExpandableHashMap<KeyType, ValueType, Allocator>::~ExpandableHashMap()
 {
 	delete m_vals;
 }
 
-template<typename KeyType, typename ValueType>
-unsigned int ExpandableHashMap<KeyType, ValueType>::getBucketNumber(const KeyType& key) const
+template<typename KeyType, typename ValueType, typename Allocator>
+unsigned int ExpandableHashMap<KeyType, ValueType, Allocator>::getBucketNumber(const KeyType& key) const
 {
 	unsigned int hasher(const KeyType & k); // prototype
 	unsigned int h = hasher(key);
@@ -80,36 +103,29 @@ unsigned int ExpandableHashMap<KeyType, ValueType>::getBucketNumber(const KeyTyp
 	return h;
 }
 
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::reset()  
+template<typename KeyType, typename ValueType, typename Allocator>
+void ExpandableHashMap<KeyType, ValueType, Allocator>::reset()  
 {
 	delete m_vals;
 
-	m_vals = new std::vector<std::list<Node>>;
-	for (int i = 0; i < m_numBuckets; i++)
-	{
-		std::list<Node> tempList;
-		m_vals->push_back(tempList);
-	}
-
 	m_numBuckets = 8;
 	m_numItems = 0;
-
+	m_vals = newBuckets(m_numBuckets);
 }
 
-template<typename KeyType, typename ValueType>
-int ExpandableHashMap<KeyType, ValueType>::size() const
+template<typename KeyType, typename ValueType, typename Allocator>
+int ExpandableHashMap<KeyType, ValueType, Allocator>::size() const
 {
 	return m_numItems;
 }
 
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+template<typename KeyType, typename ValueType, typename Allocator>
+void ExpandableHashMap<KeyType, ValueType, Allocator>::associate(const KeyType& key, const ValueType& value)
 {
 	int h = getBucketNumber(key);
 	bool contained = false;
 
-	typename std::list<Node>::iterator it;
+	typename Bucket::iterator it;
 	for (it = (*m_vals)[h].begin(); it != (*m_vals)[h].end(); it++)
 	{
 		if (it->key == key)
@@ -124,26 +140,20 @@ void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const
 		if ((m_numItems + 1) / m_numBuckets > maxLoad)
 		{
 			m_numBuckets *= 2;
-			std::vector<std::list<Node>> tempMap;
-			for (int i = 0; i < m_numBuckets; i++)
-			{
-				std::list<Node> temp;
-				tempMap.push_back(temp);
-			}
+			BucketArray* tempMap = newBuckets(m_numBuckets);
 
+			// relink every node into its new bucket; nothing is copied
 			for (int k = 0; k < (m_numBuckets / 2); k++)
 			{
-				std::list<Node> tempList2 = (*m_vals)[k];
-				typename std::list<Node>::iterator it2;
-				for (auto it2 = tempList2.begin(); it2 != tempList2.end(); it2++)
+				Bucket& tempList2 = (*m_vals)[k];
+				while (!tempList2.empty())
 				{
-					int h2 = getBucketNumber(it2->key);
-					tempMap[h2].push_back(*it2);
+					int h2 = getBucketNumber(tempList2.front().key);
+					(*tempMap)[h2].splice((*tempMap)[h2].end(), tempList2, tempList2.begin());
 				}
 			}
 			delete m_vals;
-			m_vals = new std::vector<std::list<Node>>;
-			*m_vals = tempMap;
+			m_vals = tempMap;
 		}
 		
 		h = getBucketNumber(key);
@@ -156,12 +166,12 @@ void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const
 	}
 }
 
-template<typename KeyType, typename ValueType>
-const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key) const
+template<typename KeyType, typename ValueType, typename Allocator>
+const ValueType* ExpandableHashMap<KeyType, ValueType, Allocator>::find(const KeyType& key) const
 {
 	int h = getBucketNumber(key);
 	
-	typename std::list<Node>::const_iterator it;
+	typename Bucket::const_iterator it;
 
 	for (auto it = (*m_vals)[h].begin(); it != (*m_vals)[h].end(); it++)
 	{
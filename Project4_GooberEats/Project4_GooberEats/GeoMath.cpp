@@ -0,0 +1,267 @@
+#include "GeoMath.h"
+#include <cmath>
+#include <vector>
+using namespace std;
+
+#if defined(GEOMATH_SCALAR)
+// plain C++ whatever the target, for checking the SIMD paths against
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define GEOMATH_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GEOMATH_SSE2
+#endif
+
+// Half-chords above this (about 1000 miles of arc) are handed to std::asin;
+// below it the series in asinSmall is accurate to better than 1e-12.
+static const double ASIN_POLY_LIMIT = 0.125;
+
+// Taylor coefficients of asin(x) = x + x^3 * (A1 + x^2 * (A2 + ...))
+static const double A1 = 1.0 / 6;
+static const double A2 = 3.0 / 40;
+static const double A3 = 5.0 / 112;
+static const double A4 = 35.0 / 1152;
+static const double A5 = 63.0 / 2816;
+
+int CoordArrays::add(double latitudeDeg, double longitudeDeg)
+{
+	double lat = deg2rad(latitudeDeg);
+	double lon = deg2rad(longitudeDeg);
+	double cl = cos(lat);
+
+	latDeg.push_back(latitudeDeg);
+	lonDeg.push_back(longitudeDeg);
+	latRad.push_back(lat);
+	lonRad.push_back(lon);
+	cosLat.push_back(cl);
+	x.push_back(cl * cos(lon));
+	y.push_back(cl * sin(lon));
+	z.push_back(sin(lat));
+	return size() - 1;
+}
+
+void CoordArrays::reserve(int n)
+{
+	latDeg.reserve(n);
+	lonDeg.reserve(n);
+	latRad.reserve(n);
+	lonRad.reserve(n);
+	cosLat.reserve(n);
+	x.reserve(n);
+	y.reserve(n);
+	z.reserve(n);
+}
+
+void CoordArrays::clear()
+{
+	latDeg.clear();
+	lonDeg.clear();
+	latRad.clear();
+	lonRad.clear();
+	cosLat.clear();
+	x.clear();
+	y.clear();
+	z.clear();
+}
+
+void CoordArrays::reorder(const vector<int>& order)
+{
+	vector<double>* arrays[] = { &latDeg, &lonDeg, &latRad, &lonRad, &cosLat, &x, &y, &z };
+	vector<double> moved(order.size());
+	for (vector<double>* a : arrays)
+	{
+		for (int i = 0; i < order.size(); i++)
+			moved[i] = (*a)[order[i]];
+		a->swap(moved);
+		moved.resize(order.size());
+	}
+}
+
+// distanceEarthKM's arithmetic in its order, on the stored radians and
+// cosines, which are what it would work out
+double haversineMiles(const CoordArrays& c, int a, int b)
+{
+	const double earthRadiusKm = 6371.0;
+	const double milesPerKm = 1 / 1.609344;
+	double u = sin((c.latRad[b] - c.latRad[a]) / 2);
+	double v = sin((c.lonRad[b] - c.lonRad[a]) / 2);
+	return 2.0 * earthRadiusKm * asin(sqrt(u * u + c.cosLat[a] * c.cosLat[b] * v * v)) * milesPerKm;
+}
+
+double bearingDegrees(const CoordArrays& c, int a, int b)
+{
+	double result = rad2deg(atan2(c.latDeg[b] - c.latDeg[a], c.lonDeg[b] - c.lonDeg[a]));
+	if (result < 0)
+		result += 360;
+	return result;
+}
+
+// great-circle distance for a chord given in miles
+static inline double arcFromChord(double chordMiles)
+{
+	// the haversine formula's sqrt(u*u + cos*cos*v*v) is half the chord
+	double s = chordMiles / (2 * EARTH_RADIUS_MILES);
+	if (s > 1)
+		s = 1;
+	return 2 * EARTH_RADIUS_MILES * asin(s);
+}
+
+static inline double chordMiles(const CoordArrays& c, double fx, double fy, double fz, int b)
+{
+	double dx = c.x[b] - fx;
+	double dy = c.y[b] - fy;
+	double dz = c.z[b] - fz;
+	return EARTH_RADIUS_MILES * sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+double distanceMiles(const CoordArrays& c, int a, int b)
+{
+	return arcFromChord(chordMiles(c, c.x[a], c.y[a], c.z[a], b));
+}
+
+#if defined(GEOMATH_AVX2)
+
+static inline __m256d asinSmall(__m256d s)
+{
+	__m256d x2 = _mm256_mul_pd(s, s);
+	__m256d p = _mm256_set1_pd(A5);
+	p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(A4));
+	p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(A3));
+	p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(A2));
+	p = _mm256_add_pd(_mm256_mul_pd(p, x2), _mm256_set1_pd(A1));
+	return _mm256_add_pd(s, _mm256_mul_pd(_mm256_mul_pd(s, x2), p));
+}
+
+#elif defined(GEOMATH_SSE2)
+
+static inline __m128d asinSmall(__m128d s)
+{
+	__m128d x2 = _mm_mul_pd(s, s);
+	__m128d p = _mm_set1_pd(A5);
+	p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(A4));
+	p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(A3));
+	p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(A2));
+	p = _mm_add_pd(_mm_mul_pd(p, x2), _mm_set1_pd(A1));
+	return _mm_add_pd(s, _mm_mul_pd(_mm_mul_pd(s, x2), p));
+}
+
+#endif
+
+// the origin is passed as its unit-sphere position so it need not be one of
+// c's points
+template<bool EXACT>
+static void batchKernel(const CoordArrays& c, double fromX, double fromY, double fromZ, const int* to, int count, double* out)
+{
+	int i = 0;
+
+#if defined(GEOMATH_AVX2)
+	const __m256d fx = _mm256_set1_pd(fromX);
+	const __m256d fy = _mm256_set1_pd(fromY);
+	const __m256d fz = _mm256_set1_pd(fromZ);
+	const __m256d radius = _mm256_set1_pd(EARTH_RADIUS_MILES);
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d limit = _mm256_set1_pd(ASIN_POLY_LIMIT);
+	const __m256d slack = _mm256_set1_pd(LOWER_BOUND_SLACK_MILES);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(to + i));
+		__m256d dx = _mm256_sub_pd(_mm256_i32gather_pd(c.x.data(), idx, 8), fx);
+		__m256d dy = _mm256_sub_pd(_mm256_i32gather_pd(c.y.data(), idx, 8), fy);
+		__m256d dz = _mm256_sub_pd(_mm256_i32gather_pd(c.z.data(), idx, 8), fz);
+		__m256d sum = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+		__m256d chord = _mm256_sqrt_pd(sum);
+
+		if (!EXACT)
+		{
+			__m256d bound = _mm256_sub_pd(_mm256_mul_pd(chord, radius), slack);
+			_mm256_storeu_pd(out + i, _mm256_max_pd(bound, _mm256_setzero_pd()));
+			continue;
+		}
+
+		__m256d s = _mm256_mul_pd(chord, half);
+		__m256d arc = _mm256_mul_pd(asinSmall(s), _mm256_add_pd(radius, radius));
+		_mm256_storeu_pd(out + i, arc);
+
+		int farLanes = _mm256_movemask_pd(_mm256_cmp_pd(s, limit, _CMP_GT_OQ));
+		for (int k = 0; farLanes != 0; k++, farLanes >>= 1)
+			if (farLanes & 1)
+				out[i + k] = arcFromChord(chordMiles(c, fromX, fromY, fromZ, to[i + k]));
+	}
+#elif defined(GEOMATH_SSE2)
+	const __m128d fx = _mm_set1_pd(fromX);
+	const __m128d fy = _mm_set1_pd(fromY);
+	const __m128d fz = _mm_set1_pd(fromZ);
+	const __m128d radius = _mm_set1_pd(EARTH_RADIUS_MILES);
+	const __m128d half = _mm_set1_pd(0.5);
+	const __m128d limit = _mm_set1_pd(ASIN_POLY_LIMIT);
+	const __m128d slack = _mm_set1_pd(LOWER_BOUND_SLACK_MILES);
+
+	for (; i + 2 <= count; i += 2)
+	{
+		int a = to[i];
+		int b = to[i + 1];
+		__m128d dx = _mm_sub_pd(_mm_set_pd(c.x[b], c.x[a]), fx);
+		__m128d dy = _mm_sub_pd(_mm_set_pd(c.y[b], c.y[a]), fy);
+		__m128d dz = _mm_sub_pd(_mm_set_pd(c.z[b], c.z[a]), fz);
+		__m128d sum = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+		__m128d chord = _mm_sqrt_pd(sum);
+
+		if (!EXACT)
+		{
+			__m128d bound = _mm_sub_pd(_mm_mul_pd(chord, radius), slack);
+			_mm_storeu_pd(out + i, _mm_max_pd(bound, _mm_setzero_pd()));
+			continue;
+		}
+
+		__m128d s = _mm_mul_pd(chord, half);
+		__m128d arc = _mm_mul_pd(asinSmall(s), _mm_add_pd(radius, radius));
+		_mm_storeu_pd(out + i, arc);
+
+		int farLanes = _mm_movemask_pd(_mm_cmpgt_pd(s, limit));
+		if (farLanes & 1)
+			out[i] = arcFromChord(chordMiles(c, fromX, fromY, fromZ, a));
+		if (farLanes & 2)
+			out[i + 1] = arcFromChord(chordMiles(c, fromX, fromY, fromZ, b));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		double chord = chordMiles(c, fromX, fromY, fromZ, to[i]);
+		if (EXACT)
+			out[i] = arcFromChord(chord);
+		else
+			out[i] = chord > LOWER_BOUND_SLACK_MILES ? chord - LOWER_BOUND_SLACK_MILES : 0;
+	}
+}
+
+void distanceBatchMiles(const CoordArrays& c, int from, const int* to, int count, double* out)
+{
+	batchKernel<true>(c, c.x[from], c.y[from], c.z[from], to, count, out);
+}
+
+void distanceBatchMiles(const CoordArrays& c, const GeoCoord& from, const int* to, int count, double* out)
+{
+	double lat = deg2rad(from.latitude);
+	double lon = deg2rad(from.longitude);
+	batchKernel<true>(c, cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat), to, count, out);
+}
+
+void distanceLowerBoundBatchMiles(const CoordArrays& c, int from, const int* to, int count, double* out)
+{
+	batchKernel<false>(c, c.x[from], c.y[from], c.z[from], to, count, out);
+}
+
+void distanceMatrixMiles(const CoordArrays& c, vector<double>& out)
+{
+	int n = c.size();
+	vector<int> all(n);
+	for (int i = 0; i < n; i++)
+		all[i] = i;
+
+	out.resize((size_t)n * n);
+	for (int i = 0; i < n; i++)
+		distanceBatchMiles(c, i, all.data(), n, &out[(size_t)i * n]);
+}
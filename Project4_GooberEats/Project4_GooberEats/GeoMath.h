@@ -0,0 +1,81 @@
+// GeoMath.h
+// Batched great-circle distance kernels.  Points are stored as a structure of
+// arrays with their trigonometry worked out once, when the point is added, so
+// a distance only costs a few multiplies, a square root and (for the exact
+// distance) a short polynomial instead of the six libm calls made by
+// distanceEarthMiles.
+
+#ifndef GeoMath_h
+#define GeoMath_h
+
+#include "provided.h"
+#include <vector>
+
+const double EARTH_RADIUS_MILES = 6371.0 / 1.609344;
+
+struct CoordArrays
+{
+	int add(double latitudeDeg, double longitudeDeg);	// returns the new point's index
+	int add(const GeoCoord& g) { return add(g.latitude, g.longitude); }
+	void reserve(int n);
+	void clear();
+	int size() const { return (int)latRad.size(); }
+
+	// Makes point i what point order[i] was
+	void reorder(const std::vector<int>& order);
+
+	// as given, the same values as GeoCoord::latitude and longitude
+	std::vector<double> latDeg;
+	std::vector<double> lonDeg;
+
+	std::vector<double> latRad;
+	std::vector<double> lonRad;
+	std::vector<double> cosLat;
+
+	// position on the unit sphere; the chord between two of these is what
+	// every kernel below is built on
+	std::vector<double> x;
+	std::vector<double> y;
+	std::vector<double> z;
+};
+
+// Exact great-circle distance in miles.  Agrees with distanceEarthMiles to
+// within rounding.
+double distanceMiles(const CoordArrays& c, int a, int b);
+
+// distanceEarthMiles and angleOfLine (degrees counterclockwise from east) for
+// the segment from point a to point b, giving the same results to the bit
+// without a GeoCoord or StreetSegment to pass them
+double haversineMiles(const CoordArrays& c, int a, int b);
+double bearingDegrees(const CoordArrays& c, int a, int b);
+
+// Rounding in the unit-sphere positions can put a short chord a few 1e-13
+// miles over distanceEarthMiles; the lower bounds take this off to stay under.
+const double LOWER_BOUND_SLACK_MILES = 1e-11;
+
+// Straight-line (chord) distance through the Earth in miles, less the slack.
+// It never exceeds the great-circle distance, so it is an admissible A*
+// heuristic, and it needs nothing but a square root.
+inline double distanceLowerBoundMiles(const CoordArrays& c, int a, int b)
+{
+	double dx = c.x[a] - c.x[b];
+	double dy = c.y[a] - c.y[b];
+	double dz = c.z[a] - c.z[b];
+	double chord = EARTH_RADIUS_MILES * std::sqrt(dx * dx + dy * dy + dz * dz);
+	return chord > LOWER_BOUND_SLACK_MILES ? chord - LOWER_BOUND_SLACK_MILES : 0;
+}
+
+// out[i] = distance from point 'from' to point to[i], for i in [0, count).
+// 'from' may also be a coordinate that is not one of c's points.
+// These use AVX2 or SSE2 when the compiler targets them and plain C++
+// otherwise, or with GEOMATH_SCALAR defined.  goober_geomath_check (see
+// tools/geomath_check.cpp) checks each path against distanceEarthMiles.
+void distanceBatchMiles(const CoordArrays& c, int from, const int* to, int count, double* out);
+void distanceBatchMiles(const CoordArrays& c, const GeoCoord& from, const int* to, int count, double* out);
+void distanceLowerBoundBatchMiles(const CoordArrays& c, int from, const int* to, int count, double* out);
+
+// Fills out (size() * size(), row major) with the exact distance between every
+// pair of points.
+void distanceMatrixMiles(const CoordArrays& c, std::vector<double>& out);
+
+#endif
@@ -0,0 +1,153 @@
+#include "provided.h"
+#include "MemoryReport.h"
+#include "RoadGraph.h"
+#include "RouteSearch.h"
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstdio>
+using namespace std;
+
+//******************** MemoryReport *******************************************
+
+void MemoryReport::add(const string& part, size_t bytes)
+{
+	for (auto& p : m_parts)
+	{
+		if (p.first == part)
+		{
+			p.second += bytes;
+			return;
+		}
+	}
+	m_parts.push_back(make_pair(part, bytes));
+}
+
+size_t MemoryReport::total() const
+{
+	size_t sum = 0;
+	for (const auto& p : m_parts)
+		sum += p.second;
+	return sum;
+}
+
+// "map" for "map/edges"
+static string subsystemOf(const string& part)
+{
+	return part.substr(0, part.find('/'));
+}
+
+size_t MemoryReport::total(const string& subsystem) const
+{
+	size_t sum = 0;
+	for (const auto& p : m_parts)
+	{
+		if (subsystemOf(p.first) == subsystem)
+			sum += p.second;
+	}
+	return sum;
+}
+
+void MemoryReport::print(ostream& out) const
+{
+	char line[128];
+	vector<string> done;
+	for (int i = 0; i < m_parts.size(); i++)
+	{
+		string subsystem = subsystemOf(m_parts[i].first);
+		bool seen = false;
+		for (const string& s : done)
+			seen = seen || s == subsystem;
+		if (seen)
+			continue;
+		done.push_back(subsystem);
+
+		// each subsystem's parts together, even if added in between others'
+		for (int j = i; j < m_parts.size(); j++)
+		{
+			if (subsystemOf(m_parts[j].first) != subsystem)
+				continue;
+			snprintf(line, sizeof(line), "  %-30s %12.1f KB\n", m_parts[j].first.c_str(), m_parts[j].second / 1024.0);
+			out << line;
+		}
+		snprintf(line, sizeof(line), "  %-30s %12.1f KB\n", (subsystem + " total").c_str(), total(subsystem) / 1024.0);
+		out << line;
+	}
+	snprintf(line, sizeof(line), "  %-30s %12.1f KB\n", "total", total() / 1024.0);
+	out << line;
+}
+
+//******************** Size walkers *******************************************
+
+size_t stringBytes(const string& s)
+{
+	// a short string's characters live inside the string object
+	const char* self = reinterpret_cast<const char*>(&s);
+	if (s.data() >= self && s.data() < self + sizeof(s))
+		return 0;
+	return s.capacity() + 1;
+}
+
+static size_t coordBytes(const GeoCoord& g)
+{
+	return stringBytes(g.latitudeText) + stringBytes(g.longitudeText);
+}
+
+void reportMemory(const RoadGraph& g, MemoryReport& report)
+{
+	const CoordArrays& c = g.coords;
+	report.add("map/coordinates", vectorBytes(c.latDeg) + vectorBytes(c.lonDeg) + vectorBytes(c.latRad) +
+		vectorBytes(c.lonRad) + vectorBytes(c.cosLat) + vectorBytes(c.x) + vectorBytes(c.y) + vectorBytes(c.z));
+
+	const NodeIndex& index = *g.nodeIndex;
+	report.add("map/coordinate text", stringBytes(index.text) + vectorBytes(index.textEnd));
+	report.add("map/node index", vectorBytes(index.slots) + vectorBytes(index.keyHash));
+
+	report.add("map/edges", vectorBytes(g.firstEdge) + vectorBytes(g.edgeFrom) + vectorBytes(g.edgeTo) +
+		vectorBytes(g.edgeLength) + vectorBytes(g.edgeBearing) + vectorBytes(g.edgeStreet));
+	report.add("map/chains", vectorBytes(g.nodeChain) + vectorBytes(g.nodeChainPos) + vectorBytes(g.firstChain) +
+		vectorBytes(g.chainFrom) + vectorBytes(g.chainTo) + vectorBytes(g.chainReverse) + vectorBytes(g.chainLength) +
+		vectorBytes(g.chainEdgeBegin) + vectorBytes(g.chainEdges));
+	report.add("map/components", vectorBytes(g.nodeComponent) + vectorBytes(g.nodeIsland));
+
+	size_t names = vectorBytes(g.streetNames);
+	for (const string& s : g.streetNames)
+		names += stringBytes(s);
+	report.add("map/street names", names);
+
+	report.add("map/closed edges", vectorBytes(g.closedEdges));
+	if (g.tileUse != nullptr)
+		report.add("map/tile fields", vectorBytes(g.nodeTile) + vectorBytes(g.nodeFrontier));
+}
+
+void reportSearchMemory(MemoryReport& report)
+{
+	report.add("search/scratch", SearchScratch::allThreadsBytes());
+}
+
+size_t DeliveryCommand::heapBytes() const
+{
+	return stringBytes(m_streetName) + stringBytes(m_direction) + stringBytes(m_item);
+}
+
+void reportMemory(const vector<DeliveryCommand>& commands, MemoryReport& report)
+{
+	size_t bytes = vectorBytes(commands);
+	for (const DeliveryCommand& dc : commands)
+		bytes += dc.heapBytes();
+	report.add("plan/commands", bytes);
+}
+
+void reportMemory(const DeliveryPlan& plan, MemoryReport& report)
+{
+	size_t legs = vectorBytes(plan.legs) + coordBytes(plan.depot);
+	size_t routes = 0;
+	for (const DeliveryLeg& leg : plan.legs)
+	{
+		legs += coordBytes(leg.from) + coordBytes(leg.to) + stringBytes(leg.item);
+		routes += vectorBytes(leg.route.edges());
+		reportMemory(leg.commands, report);
+	}
+	report.add("plan/legs", legs);
+	report.add("plan/routes", routes);
+}
@@ -0,0 +1,67 @@
+// MemoryReport.h
+// How much memory the map, the searches and a plan hold, part by part, so a
+// change to one of the data structures can be checked for what it saved.
+//
+// The sizes are walked from the containers rather than measured at the
+// allocator: a vector counts its capacity, a string its heap buffer if it
+// has outgrown the one inside it, a hash map its buckets and nodes.  Memory
+// reserved but not yet used is included; the heap's own per-block overhead
+// is not.  Parts are named "subsystem/part", e.g. "map/edges".
+
+#ifndef MemoryReport_h
+#define MemoryReport_h
+
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <ostream>
+#include <cstddef>
+
+struct RoadGraph;
+
+class MemoryReport
+{
+public:
+	// Adds bytes to a part, which is listed in the order first added
+	void add(const std::string& part, std::size_t bytes);
+
+	std::size_t total() const;
+	// the parts of one subsystem, e.g. total("map")
+	std::size_t total(const std::string& subsystem) const;
+
+	const std::vector<std::pair<std::string, std::size_t>>& parts() const { return m_parts; }
+
+	// One line per part, a subtotal per subsystem and the total, in KB
+	void print(std::ostream& out) const;
+
+	void clear() { m_parts.clear(); }
+
+private:
+	std::vector<std::pair<std::string, std::size_t>> m_parts;
+};
+
+// Size walkers for the containers everything is built from
+template<typename T, typename A>
+std::size_t vectorBytes(const std::vector<T, A>& v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+// what s holds on the heap: nothing while it fits in the string itself
+std::size_t stringBytes(const std::string& s);
+
+// One version of the map, under "map/": coordinates, their text and the
+// index from coordinate to node, edges, chains, components, street names,
+// closed edges and the tiled map's per-node fields.  The NodeIndex is shared
+// by versions that add no nodes, but is counted with each.
+void reportMemory(const RoadGraph& g, MemoryReport& report);
+
+// Every live thread's SearchScratch, under "search/"
+void reportSearchMemory(MemoryReport& report);
+
+// A plan's legs, their routes and their commands, under "plan/"
+void reportMemory(const DeliveryPlan& plan, MemoryReport& report);
+void reportMemory(const std::vector<DeliveryCommand>& commands, MemoryReport& report);
+
+#endif
@@ -1,8 +1,17 @@
 #include "provided.h"
 #include <utility> 
 #include <list>
-#include <queue> 
-#include "ExpandableHashMap.h"
+#include <algorithm>
+#include <cmath>
+#include "RoadGraph.h"
+#include "EdgeWeightProfile.h"
+#include "Trace.h"
+#include "RouteMetrics.h"
+#include "TiledMap.h"
+#include "RouteSearch.h"
+#include "RouteExecutor.h"
+#include <chrono>
+#include <memory>
 using namespace std;
 
 class PointToPointRouterImpl
@@ -14,44 +23,35 @@ public:
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
-        double& totalDistanceTravelled) const;
+        double& totalDistanceTravelled,
+        const RouteOptions& options,
+        RouteStats* stats) const;
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        Route& route,
+        const RouteOptions& options,
+        RouteStats* stats) const;
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        vector<int>& edges,
+        double& totalDistanceTravelled,
+        const RouteOptions& options,
+        RouteStats* stats) const;
+    future<RouteResult> routeAsync(
+        RouteExecutor& executor,
+        const GeoCoord& start,
+        const GeoCoord& end,
+        const RouteOptions& options) const;
 
 private:
 	const StreetMap* m_map;
 
-	struct ginfo
-	{
-		ginfo(GeoCoord geo)
-		{
-			g = geo;
-			f = 0.0;
-			distFromStart = 0.0;
-			h = 0.0;
-			popped = false;
-		}
-
-		GeoCoord g;
-		GeoCoord prev;
-
-		double f;
-		double distFromStart;
-		double h;
-
-		string name;
-		bool popped;
-
-		ginfo() {}
-		~ginfo() {}
-	};
-
-	struct compareF
-	{
-		bool operator()(ginfo const& g1, ginfo const& g2)
-		{
-			return g1.f > g2.f;
-		}
-	};
-
+	DeliveryResult runSearch(const GeoCoord& start, const GeoCoord& end, vector<int>& edges, double& totalDistanceTravelled, const RouteOptions& options, RouteStats* stats, shared_ptr<const RoadGraph>& used) const;
+	DeliveryResult findRoute(const RoadGraph& graph, const GeoCoord& start, const GeoCoord& end, vector<int>& edges, double& totalDistanceTravelled, const RouteOptions& options, RouteStats& stats, bool wantGap, vector<GeoCoord>& frontier, vector<int>& tiles) const;
+	template<typename EdgeCost>
+	static DeliveryResult searchWith(const RoadGraph& graph, int source, int goal, double hScale, const EdgeCost& cost, const RouteOptions& options, vector<int>& edges, double& totalDistanceTravelled, RouteStats& stats, bool wantGap, vector<GeoCoord>& frontier, vector<int>& tiles);
 };
 
 PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm)
@@ -64,87 +64,230 @@ PointToPointRouterImpl::~PointToPointRouterImpl()
 	m_map = nullptr;
 }
 
-DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(const GeoCoord& start, const GeoCoord& end, list<StreetSegment>& route, double& totalDistanceTravelled) const
+DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(const GeoCoord& start, const GeoCoord& end, list<StreetSegment>& route, double& totalDistanceTravelled, const RouteOptions& options, RouteStats* stats) const
+{
+	Route found;
+	DeliveryResult result = generatePointToPointRoute(start, end, found, options, stats);
+	if (result != DELIVERY_SUCCESS)
+		return result;
+
+	TraceSpan span("route/segments");
+	totalDistanceTravelled = found.miles();
+	found.appendTo(route);
+	return DELIVERY_SUCCESS;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(const GeoCoord& start, const GeoCoord& end, Route& route, const RouteOptions& options, RouteStats* stats) const
 {
-	vector<StreetSegment> segs;
-	if (!m_map->getSegmentsThatStartWith(end, segs))
+	// the route holds the version its edges came from, including one the
+	// caller named if StreetMap published it; any other is the caller's to
+	// keep alive
+	route.clear();
+	DeliveryResult result = runSearch(start, end, route.m_edges, route.m_miles, options, stats, route.m_graph);
+	if (options.graph != nullptr)
+	{
+		route.m_graph = options.graph->weak_from_this().lock();
+		if (route.m_graph == nullptr)
+			route.m_graph = shared_ptr<const RoadGraph>(shared_ptr<const RoadGraph>(), options.graph);
+	}
+	return result;
+}
+
+// A* over the road graph with f = g + (1 + epsilon) * h, h being the chord
+// distance (see RouteSearch.h), scaled by the profile's least factor when
+// there is one.  The heuristic is consistent, so with epsilon == 0 the first
+// time the goal is settled its distance is the shortest.
+//
+// Queries the component labels rule out (see RoadGraph::mayReach) fail
+// without a search.  On a tiled map, frontier gets every settled node with
+// edges into tiles this version lacks; those edges might have led somewhere
+// shorter.  tiles gets the tiles of both ends and of every settled node.
+DeliveryResult PointToPointRouterImpl::findRoute(const RoadGraph& graph, const GeoCoord& start, const GeoCoord& end, vector<int>& edges, double& totalDistanceTravelled, const RouteOptions& options, RouteStats& stats, bool wantGap, vector<GeoCoord>& frontier, vector<int>& tiles) const
+{
+	edges.clear();
+	frontier.clear();
+	tiles.clear();
+
+	// costs for another version's edge IDs would price the wrong edges; the
+	// search keeps these even if the profile is customized meanwhile
+	shared_ptr<const EdgeCosts> costs;
+	if (options.weights != nullptr)
+	{
+		costs = options.weights->costsFor(graph);
+		if (costs == nullptr)
+			return STALE_WEIGHTS;
+	}
+
+	int goal = graph.findNode(end);
+	if (goal == -1)
 		return BAD_COORD;
 
-	if(!m_map->getSegmentsThatStartWith(start, segs))
+	int source = graph.findNode(start);
+	if (source == -1)
 		return BAD_COORD;
 
-	priority_queue<ginfo, vector<ginfo>, compareF> openList;
-	ExpandableHashMap<GeoCoord, ginfo> visited;
-	ExpandableHashMap<GeoCoord, ginfo> inList;
-	ginfo first(start);
-	first.prev = start;
-	openList.push(first);
-	inList.associate(start, first);
-	visited.associate(start, first);
+	if (graph.tileUse != nullptr)
+	{
+		graph.tileUse->touch(graph.nodeTile[source]);
+		graph.tileUse->touch(graph.nodeTile[goal]);
+		tiles.push_back(graph.nodeTile[source]);
+		tiles.push_back(graph.nodeTile[goal]);
+	}
+
+	if (source == goal)
+	{
+		totalDistanceTravelled = 0;
+		return DELIVERY_SUCCESS;
+	}
+
+	// between pieces of the map no road joins there is nothing to search for
+	if (!graph.mayReach(source, goal))
+		return NO_ROUTE;
 
-	while (!openList.empty())
+	if (costs != nullptr)
+		return searchWith(graph, source, goal, costs->minFactor, ProfileCost(graph, costs->costs.data()),
+			options, edges, totalDistanceTravelled, stats, wantGap, frontier, tiles);
+	return searchWith(graph, source, goal, 1.0, LengthCost(graph), options, edges, totalDistanceTravelled, stats, wantGap, frontier, tiles);
+}
+
+// A* with the given edge costs, stopping early only if options could ask it to
+template<typename EdgeCost>
+DeliveryResult PointToPointRouterImpl::searchWith(const RoadGraph& graph, int source, int goal, double hScale, const EdgeCost& cost, const RouteOptions& options, vector<int>& edges, double& totalDistanceTravelled, RouteStats& stats, bool wantGap, vector<GeoCoord>& frontier, vector<int>& tiles)
+{
+	SearchScratch& mem = SearchScratch::forThread(graph.numNodes());
+	double weight = 1.0 + (options.epsilon > 0 ? options.epsilon : 0.0);
+	ChordHeuristic h(graph, goal, hScale);
+	if (options.cancel == nullptr && options.deadline == chrono::steady_clock::time_point::max())
 	{
-		ginfo q = openList.top();
-		m_map->getSegmentsThatStartWith(q.g, segs);
-		openList.pop();
-		q.popped = true;
+		RouteSearch<ChordHeuristic, EdgeCost> search(graph, mem, h, cost, weight);
+		return search.run(source, goal, edges, totalDistanceTravelled, stats, wantGap, frontier, tiles);
+	}
+	RouteSearch<ChordHeuristic, EdgeCost, BinaryHeapQueue, StampedTable, StopAtGoalOrDeadline> search(graph, mem, h, cost, weight, StopAtGoalOrDeadline(options));
+	return search.run(source, goal, edges, totalDistanceTravelled, stats, wantGap, frontier, tiles);
+}
 
-		if (q.g == end)
+DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(const GeoCoord& start, const GeoCoord& end, vector<int>& edges, double& totalDistanceTravelled, const RouteOptions& options, RouteStats* stats) const
+{
+	shared_ptr<const RoadGraph> used;
+	return runSearch(start, end, edges, totalDistanceTravelled, options, stats, used);
+}
+
+// Times the search and records it in the process-wide metrics.
+//
+// Unless the caller named a version, the search holds a snapshot of the map
+// from start to finish, left in used, so an edit published meanwhile can't
+// change or free the graph under it.  On a tiled map, a search that ends
+// without an end point's tile or having settled frontier nodes has the tiles
+// it lacked brought in, and runs again on the version that has them; those
+// tiles and the ones each round crossed are held meanwhile (see TilePins),
+// in options.tiles if given so they stay held after this query.  A
+// search that settled frontier nodes never answers, as a shorter route may
+// run through the tiles it lacked: with no newer version to run on, or after
+// MAX_TILE_ROUNDS, the query fails with INCOMPLETE_MAP.  With a version named
+// by the caller the tiles are still brought in, for the caller to retry on,
+// but this query keeps to its version.
+DeliveryResult PointToPointRouterImpl::runSearch(const GeoCoord& start, const GeoCoord& end, vector<int>& edges, double& totalDistanceTravelled, const RouteOptions& options, RouteStats* stats, shared_ptr<const RoadGraph>& used) const
+{
+	TraceSpan span("PointToPointRouter::route");
+	auto started = chrono::steady_clock::now();
+
+	// a budget too small for one route's tiles could otherwise go on forever
+	const int MAX_TILE_ROUNDS = 100;
+
+	RouteStats local;
+	DeliveryResult result;
+	vector<GeoCoord> frontier;
+	vector<int> tiles;
+	TilePins queryTiles;
+	TilePins& held = options.tiles != nullptr ? *options.tiles : queryTiles;
+	for (int round = 0; ; round++)
+	{
+		if (options.graph == nullptr)
+			used = m_map->snapshot();
+		const RoadGraph& graph = options.graph != nullptr ? *options.graph : *used;
+
+		local = RouteStats();
+		result = interruption(options);
+		if (result != DELIVERY_SUCCESS)
 		{
-			totalDistanceTravelled = q.distFromStart;
-			StreetSegment endpoint(q.prev, q.g, q.name);
-			route.push_front(endpoint);
-			//return path
-			while (q.prev != q.g)
-			{
-				q = *visited.find(q.prev);
-				if (q.prev != q.g)
-				{
-					StreetSegment toAdd(q.prev, q.g, q.name);
-					route.push_front(toAdd);
-				}
-			}
-			return DELIVERY_SUCCESS;
+			edges.clear();	// abandoned before it started, or between tile rounds
+			break;
 		}
+		result = findRoute(graph, start, end, edges, totalDistanceTravelled, options, local, stats != nullptr, frontier, tiles);
+		if (graph.tileUse == nullptr || result == TIMED_OUT || result == CANCELLED)
+			break;
+		held.hold(graph, tiles);
 
-		for (int i = 0; i < segs.size(); i++)
+		if (result == BAD_COORD)
 		{
-			GeoCoord gSegEnd(segs[i].end);
-			if (visited.find(gSegEnd) == nullptr)
-			{
-				ginfo r(gSegEnd);
-
-				//double g = sqrt(((gSegEnd.latitude - q.g.latitude) * (gSegEnd.latitude - q.g.latitude)) + ((gSegEnd.longitude - q.g.longitude) * (gSegEnd.longitude - q.g.longitude)));
-				//double h = sqrt(((end.latitude - gSegEnd.latitude) * (end.latitude - gSegEnd.latitude)) + ((end.longitude - gSegEnd.longitude) * (end.longitude - gSegEnd.longitude)));
-
-				double g = distanceEarthMiles(q.g, gSegEnd);
-				double h = distanceEarthMiles(gSegEnd, end);
-
-				r.h = h;
-				r.distFromStart = q.distFromStart + g;
-				r.f = r.distFromStart + r.h;
-				r.prev = q.g;
-				r.name = segs[i].name;
-
-				visited.associate(gSegEnd, r);
-
-				if (inList.find(r.g) == nullptr)
-					openList.push(r);
-				else
-				{
-					if (inList.find(r.g)->f > r.f)
-					{
-						openList.push(r);
-						inList.associate(r.g, r);
-					}
-				}
-				
-			}
-			
-		}//end for
-	}//end while
-
-	return NO_ROUTE;
+			vector<GeoCoord> ends;
+			ends.push_back(start);
+			ends.push_back(end);
+			m_map->loadTilesFor(ends, false, &held);
+		}
+		else if (!frontier.empty())
+		{
+			m_map->loadTilesFor(frontier, true, &held);
+			result = INCOMPLETE_MAP;	// unless a newer version answers
+			edges.clear();
+		}
+		else
+			break;
+
+		// a newer version may be another query's, but holds this one's tiles
+		bool newer = m_map->snapshot()->version != graph.version;
+		if (!newer || options.graph != nullptr || round == MAX_TILE_ROUNDS)
+			break;
+	}
+	m_map->releaseTiles(queryTiles);	// a caller's own pins are its to release
+	local.pathEdges = edges.size();
+	local.elapsedSeconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+	routeMetricsRecord(result, local);
+	if (stats != nullptr)
+		*stats = local;
+	return result;
+}
+
+future<RouteResult> PointToPointRouterImpl::routeAsync(RouteExecutor& executor, const GeoCoord& start, const GeoCoord& end, const RouteOptions& options) const
+{
+	shared_ptr<packaged_task<RouteResult()>> task = make_shared<packaged_task<RouteResult()>>([this, start, end, options]() {
+		RouteResult r;
+		r.result = generatePointToPointRoute(start, end, r.route, options, &r.stats);
+		return r;
+	});
+	future<RouteResult> answer = task->get_future();
+	executor.submit([task]() { (*task)(); });
+	return answer;
+}
+
+//******************** Route functions ****************************************
+
+StreetSegment Route::segment(size_t i) const
+{
+	return m_graph->segment(m_edges[i]);
+}
+
+void Route::appendTo(list<StreetSegment>& segs) const
+{
+	for (size_t i = 0; i < m_edges.size(); i++)
+		segs.push_back(m_graph->segment(m_edges[i]));
+}
+
+void Route::eraseFront(size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		m_miles -= m_graph->edgeLength[m_edges[i]];
+	m_edges.erase(m_edges.begin(), m_edges.begin() + n);
+	if (m_edges.empty())
+		m_miles = 0;
+}
+
+void Route::clear()
+{
+	m_graph.reset();
+	m_edges.clear();
+	m_miles = 0;
 }
 
 //******************** PointToPointRouter functions ***************************
@@ -166,9 +309,41 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
         const GeoCoord& start,
         const GeoCoord& end,
         list<StreetSegment>& route,
-        double& totalDistanceTravelled) const
+        double& totalDistanceTravelled,
+        const RouteOptions& options,
+        RouteStats* stats) const
+{
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled, options, stats);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        Route& route,
+        const RouteOptions& options,
+        RouteStats* stats) const
+{
+    return m_impl->generatePointToPointRoute(start, end, route, options, stats);
+}
+
+DeliveryResult PointToPointRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        vector<int>& edges,
+        double& totalDistanceTravelled,
+        const RouteOptions& options,
+        RouteStats* stats) const
+{
+    return m_impl->generatePointToPointRoute(start, end, edges, totalDistanceTravelled, options, stats);
+}
+
+future<RouteResult> PointToPointRouter::routeAsync(
+        RouteExecutor& executor,
+        const GeoCoord& start,
+        const GeoCoord& end,
+        const RouteOptions& options) const
 {
-    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+    return m_impl->routeAsync(executor, start, end, options);
 }
 
 
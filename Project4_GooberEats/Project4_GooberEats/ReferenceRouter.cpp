@@ -0,0 +1,143 @@
+#include "provided.h"
+#include "ReferenceRouter.h"
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <utility>
+#include <algorithm>
+using namespace std;
+
+class ReferenceRouterImpl
+{
+public:
+    ReferenceRouterImpl(const StreetMap* sm);
+    ~ReferenceRouterImpl();
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const;
+    DeliveryResult distancesFrom(const GeoCoord& start, map<GeoCoord, double>& dist) const;
+
+private:
+	const StreetMap* m_map;
+
+	// Textbook Dijkstra from start, stopping once goal is settled (or never,
+	// if goal is null).  prev holds the segment each reached coordinate was
+	// first reached by on its shortest path.
+	void search(const GeoCoord& start, const GeoCoord* goal, map<GeoCoord, double>& dist, map<GeoCoord, StreetSegment>& prev) const;
+};
+
+ReferenceRouterImpl::ReferenceRouterImpl(const StreetMap* sm)
+{
+	m_map = sm;
+}
+
+ReferenceRouterImpl::~ReferenceRouterImpl()
+{
+	m_map = nullptr;
+}
+
+void ReferenceRouterImpl::search(const GeoCoord& start, const GeoCoord* goal, map<GeoCoord, double>& dist, map<GeoCoord, StreetSegment>& prev) const
+{
+	dist.clear();
+	prev.clear();
+
+	// the open set ordered by distance; an entry is replaced, not duplicated,
+	// when a shorter way to it is found
+	set<pair<double, GeoCoord>> open;
+	dist[start] = 0;
+	open.insert(make_pair(0.0, start));
+
+	vector<StreetSegment> segs;
+	while (!open.empty())
+	{
+		GeoCoord here = open.begin()->second;
+		double d = open.begin()->first;
+		open.erase(open.begin());
+
+		if (goal != nullptr && here == *goal)
+			return;
+
+		m_map->getSegmentsThatStartWith(here, segs);
+		for (const StreetSegment& s : segs)
+		{
+			double nd = d + distanceEarthMiles(s.start, s.end);
+			auto it = dist.find(s.end);
+			if (it != dist.end() && it->second <= nd)
+				continue;
+
+			if (it != dist.end())
+				open.erase(make_pair(it->second, s.end));
+			dist[s.end] = nd;
+			prev[s.end] = s;
+			open.insert(make_pair(nd, s.end));
+		}
+	}
+}
+
+DeliveryResult ReferenceRouterImpl::generatePointToPointRoute(
+    const GeoCoord& start,
+    const GeoCoord& end,
+    list<StreetSegment>& route,
+    double& totalDistanceTravelled) const
+{
+	vector<StreetSegment> segs;
+	if (!m_map->getSegmentsThatStartWith(start, segs) || !m_map->getSegmentsThatStartWith(end, segs))
+		return BAD_COORD;
+
+	map<GeoCoord, double> dist;
+	map<GeoCoord, StreetSegment> prev;
+	search(start, &end, dist, prev);
+	if (dist.find(end) == dist.end())
+		return NO_ROUTE;
+
+	route.clear();
+	for (GeoCoord at = end; at != start; at = prev[at].start)
+		route.push_front(prev[at]);
+	totalDistanceTravelled = dist[end];
+	return DELIVERY_SUCCESS;
+}
+
+DeliveryResult ReferenceRouterImpl::distancesFrom(const GeoCoord& start, map<GeoCoord, double>& dist) const
+{
+	vector<StreetSegment> segs;
+	if (!m_map->getSegmentsThatStartWith(start, segs))
+	{
+		dist.clear();
+		return BAD_COORD;
+	}
+
+	map<GeoCoord, StreetSegment> prev;
+	search(start, nullptr, dist, prev);
+	return DELIVERY_SUCCESS;
+}
+
+//******************** ReferenceRouter functions ******************************
+
+// These functions simply delegate to ReferenceRouterImpl's functions.
+
+ReferenceRouter::ReferenceRouter(const StreetMap* sm)
+{
+    m_impl = new ReferenceRouterImpl(sm);
+}
+
+ReferenceRouter::~ReferenceRouter()
+{
+    delete m_impl;
+}
+
+DeliveryResult ReferenceRouter::generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        list<StreetSegment>& route,
+        double& totalDistanceTravelled) const
+{
+    return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
+}
+
+DeliveryResult ReferenceRouter::distancesFrom(const GeoCoord& start, map<GeoCoord, double>& dist) const
+{
+    return m_impl->distancesFrom(start, dist);
+}
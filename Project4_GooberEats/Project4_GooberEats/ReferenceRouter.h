@@ -0,0 +1,38 @@
+// ReferenceRouter.h
+// A deliberately plain Dijkstra router to check PointToPointRouter against.
+// It sees the map only through StreetMap::getSegmentsThatStartWith and keeps
+// its state in std::maps keyed by coordinate, so it shares no code or data
+// layout with the production router.  It is many times slower; use it for
+// testing, never for serving routes.
+
+#ifndef ReferenceRouter_h
+#define ReferenceRouter_h
+
+#include "provided.h"
+#include <list>
+#include <map>
+
+class ReferenceRouterImpl;
+
+class ReferenceRouter
+{
+public:
+    ReferenceRouter(const StreetMap* sm);
+    ~ReferenceRouter();
+      // Same contract as PointToPointRouter::generatePointToPointRoute
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        std::list<StreetSegment>& route,
+        double& totalDistanceTravelled) const;
+      // Shortest road distance from start to every coordinate reachable from
+      // it, start included.  Returns BAD_COORD if start is not on the map.
+    DeliveryResult distancesFrom(const GeoCoord& start, std::map<GeoCoord, double>& dist) const;
+      // We prevent a ReferenceRouter object from being copied or assigned.
+    ReferenceRouter(const ReferenceRouter&) = delete;
+    ReferenceRouter& operator=(const ReferenceRouter&) = delete;
+private:
+    ReferenceRouterImpl* m_impl;
+};
+
+#endif
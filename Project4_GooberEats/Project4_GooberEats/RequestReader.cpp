@@ -0,0 +1,264 @@
+#include "provided.h"
+#include "RequestReader.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <charconv>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+#if defined(_WIN32)
+#define REQUESTS_READ
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//******************** RequestReader::Source **********************************
+
+// The file as a run of lines, each without its '\n' (a '\r' before it is
+// kept, as getline keeps it).  A line stays valid until the next is asked for.
+class RequestReader::Source
+{
+public:
+	Source()
+	{
+		m_data = nullptr;
+		m_size = 0;
+		m_pos = 0;
+		m_released = 0;
+		m_end = 0;
+		m_eof = false;
+	}
+
+	~Source()
+	{
+#ifndef REQUESTS_READ
+		if (m_data != nullptr)
+			munmap(const_cast<char*>(m_data), m_size);
+#endif
+	}
+
+	bool open(const string& file, bool useMap)
+	{
+#ifndef REQUESTS_READ
+		if (useMap)
+		{
+			int fd = ::open(file.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat st;
+			void* p = MAP_FAILED;
+			if (fstat(fd, &st) == 0 && st.st_size > 0)	// an empty file can't be mapped
+				p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);		// the mapping keeps the file open
+			if (p != MAP_FAILED)
+			{
+				madvise(p, st.st_size, MADV_SEQUENTIAL);
+				m_data = static_cast<const char*>(p);
+				m_size = st.st_size;
+				return true;
+			}
+		}
+#endif
+		m_in.open(file, ios::binary);
+		if (!m_in)
+			return false;
+		m_buffer.resize(BUFFER_BYTES);
+		return true;
+	}
+
+	bool mapped() const { return m_data != nullptr; }
+
+	bool nextLine(const char*& begin, const char*& end)
+	{
+		if (mapped())
+			return nextMappedLine(begin, end);
+		return nextBufferedLine(begin, end);
+	}
+
+private:
+	// read this much at a time, and give back mapped pages in steps of this
+	// much (a multiple of any page size)
+	static const size_t BUFFER_BYTES = 1 << 20;
+	static const long long RELEASE_BYTES = 4 << 20;
+
+	const char* m_data;
+	long long m_size;
+	long long m_pos;
+	long long m_released;	// pages before this have been given back
+
+	ifstream m_in;
+	vector<char> m_buffer;
+	size_t m_end;		// bytes of m_buffer filled
+	bool m_eof;
+
+	bool nextMappedLine(const char*& begin, const char*& end)
+	{
+		if (m_pos >= m_size)
+			return false;
+
+		// the lines before this one have been copied out or skipped, so their
+		// pages, clean copies of the file, can go
+		if (m_pos - m_released >= RELEASE_BYTES)
+		{
+			long long upTo = m_pos / RELEASE_BYTES * RELEASE_BYTES;
+#ifndef REQUESTS_READ
+			madvise(const_cast<char*>(m_data) + m_released, upTo - m_released, MADV_DONTNEED);
+#endif
+			m_released = upTo;
+		}
+
+		begin = m_data + m_pos;
+		const char* newline = static_cast<const char*>(memchr(begin, '\n', m_size - m_pos));
+		end = newline != nullptr ? newline : m_data + m_size;
+		m_pos = end - m_data + 1;
+		return true;
+	}
+
+	bool nextBufferedLine(const char*& begin, const char*& end)
+	{
+		for (;;)
+		{
+			char* data = m_buffer.data();
+			char* newline = static_cast<char*>(memchr(data + m_pos, '\n', m_end - m_pos));
+			if (newline != nullptr || (m_eof && m_pos < (long long)m_end))
+			{
+				begin = data + m_pos;
+				end = newline != nullptr ? newline : data + m_end;
+				m_pos = newline != nullptr ? end - data + 1 : m_end;
+				return true;
+			}
+			if (m_eof)
+				return false;
+
+			// keep the partial line, and make room for it to finish if it
+			// already fills the buffer
+			m_end -= m_pos;
+			memmove(data, data + m_pos, m_end);
+			m_pos = 0;
+			if (m_end == m_buffer.size())
+				m_buffer.resize(2 * m_buffer.size());
+			m_in.read(m_buffer.data() + m_end, m_buffer.size() - m_end);
+			m_end += m_in.gcount();
+			if (!m_in)
+				m_eof = true;
+		}
+	}
+};
+
+//******************** RequestReader ******************************************
+
+static bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+// The next word of [p, end), as >> would read it; false if there is none.
+static bool nextWord(const char*& p, const char* end, const char*& wordBegin, const char*& wordEnd)
+{
+	while (p != end && isSpace(*p))
+		p++;
+	wordBegin = p;
+	while (p != end && !isSpace(*p))
+		p++;
+	wordEnd = p;
+	return wordBegin != wordEnd;
+}
+
+// All of [begin, end) as a number
+static bool toDouble(const char* begin, const char* end, double& value)
+{
+	if (begin != end && *begin == '+')	// stod takes a + sign, from_chars doesn't
+	{
+		begin++;
+		if (begin != end && *begin == '-')
+			return false;
+	}
+	from_chars_result r = from_chars(begin, end, value);
+	return r.ec == errc() && r.ptr == end;
+}
+
+// the first two words of [begin, end) as a coordinate
+static bool parseCoord(const char* begin, const char* end, GeoCoord& out)
+{
+	const char *lat, *latEnd, *lon, *lonEnd;
+	double latitude, longitude;
+	if (!nextWord(begin, end, lat, latEnd) || !nextWord(begin, end, lon, lonEnd) ||
+		!toDouble(lat, latEnd, latitude) || !toDouble(lon, lonEnd, longitude))
+		return false;
+	out = GeoCoord(string(lat, latEnd), string(lon, lonEnd), latitude, longitude);
+	return true;
+}
+
+RequestReader::RequestReader()
+{
+	m_source = nullptr;
+	m_lines = 0;
+	m_badLines = 0;
+}
+
+RequestReader::~RequestReader()
+{
+	delete m_source;
+}
+
+bool RequestReader::open(const string& file, bool useMap)
+{
+	delete m_source;
+	m_source = new Source;
+	m_lines = 0;
+	m_badLines = 0;
+
+	const char* begin;
+	const char* end;
+	if (!m_source->open(file, useMap) || !m_source->nextLine(begin, end) || !parseCoord(begin, end, m_depot))
+	{
+		delete m_source;
+		m_source = nullptr;
+		return false;
+	}
+	m_lines = 1;
+	return true;
+}
+
+bool RequestReader::mapped() const
+{
+	return m_source != nullptr && m_source->mapped();
+}
+
+bool RequestReader::next(vector<DeliveryRequest>& batch, size_t maxRequests)
+{
+	batch.clear();
+	const char* begin;
+	const char* end;
+	while (m_source != nullptr && batch.size() < maxRequests && m_source->nextLine(begin, end))
+	{
+		m_lines++;
+		const char* problem = parse(begin, end, batch);
+		if (problem != nullptr)
+		{
+			m_badLines++;
+			if (m_report)
+				m_report(string(begin, end), problem);
+		}
+	}
+	return !batch.empty();
+}
+
+const char* RequestReader::parse(const char* begin, const char* end, vector<DeliveryRequest>& batch) const
+{
+	const char* colon = static_cast<const char*>(memchr(begin, ':', end - begin));
+	if (colon == nullptr)
+		return "Missing colon";
+	GeoCoord where;
+	if (!parseCoord(begin, colon, where))
+		return "Bad format";
+	if (colon + 1 == end)
+		return "Missing item";
+	batch.push_back(DeliveryRequest(string(colon + 1, end), where));
+	return nullptr;
+}
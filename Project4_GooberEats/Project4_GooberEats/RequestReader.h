@@ -0,0 +1,64 @@
+// RequestReader.h
+// Reads a deliveries file a batch at a time, so an order log of millions of
+// lines can be fed to the optimizer and planner in bounded memory.
+//
+// The format is the one main reads: a depot line "lat lon", then one request
+// per line, "lat lon:item".  Coordinates are parsed with from_chars straight
+// out of the file, with no stream or substring per line.  The file is
+// memory-mapped where possible, and pages already read are handed back to the
+// OS as the reader moves on; otherwise it is read through a fixed buffer.
+// Either way memory use depends on the batch size, not the file's.
+
+#ifndef RequestReader_h
+#define RequestReader_h
+
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+class RequestReader
+{
+public:
+	RequestReader();
+	~RequestReader();
+
+	// Opens a deliveries file and reads its depot line.  With useMap false,
+	// or where mmap is unavailable, the file is read through a buffer.
+	// Returns false if the file can't be opened or the depot line is bad.
+	bool open(const std::string& file, bool useMap = true);
+
+	const GeoCoord& depot() const { return m_depot; }
+
+	// Replaces batch with the next maxRequests requests, or as many as are
+	// left, skipping bad lines.  Returns false, with batch empty, once the
+	// file is used up.
+	bool next(std::vector<DeliveryRequest>& batch, std::size_t maxRequests);
+
+	// Called with each line skipped and what is wrong with it: "Missing
+	// colon", "Bad format" or "Missing item".  Bad lines are only counted
+	// otherwise.
+	void onBadLine(std::function<void(const std::string& line, const char* problem)> report) { m_report = report; }
+
+	long long linesRead() const { return m_lines; }		// including the depot line
+	long long badLines() const { return m_badLines; }
+	bool mapped() const;
+
+	RequestReader(const RequestReader&) = delete;
+	RequestReader& operator=(const RequestReader&) = delete;
+
+private:
+	class Source;
+
+	Source* m_source;
+	GeoCoord m_depot;
+	std::function<void(const std::string&, const char*)> m_report;
+	long long m_lines;
+	long long m_badLines;
+
+	// null if the line is fine, else what is wrong with it
+	const char* parse(const char* begin, const char* end, std::vector<DeliveryRequest>& batch) const;
+};
+
+#endif
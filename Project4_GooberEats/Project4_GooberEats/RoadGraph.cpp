@@ -0,0 +1,633 @@
+#include "provided.h"
+#include "RoadGraph.h"
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+// the bits of both numbers, mixed by splitmix64's finalizer
+static unsigned coordHash(double latitude, double longitude)
+{
+	uint64_t lat, lon;
+	memcpy(&lat, &latitude, sizeof(lat));
+	memcpy(&lon, &longitude, sizeof(lon));
+	uint64_t h = lat * 0x9E3779B97F4A7C15ULL ^ lon;
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBULL;
+	h ^= h >> 31;
+	return (unsigned)h;
+}
+
+void NodeIndex::reserve(int nodes)
+{
+	textEnd.reserve(2 * nodes);
+	keyHash.reserve(nodes);
+	if (2 * nodes > slots.size())
+	{
+		size_t size = 16;
+		while (size < 2 * (size_t)nodes)
+			size *= 2;
+		slots.assign(size, -1);
+		for (int n = 0; n < keyHash.size(); n++)
+			place(n);
+	}
+}
+
+void NodeIndex::add(const GeoCoord& g, int id)
+{
+	text.append(g.latitudeText);
+	textEnd.push_back((int)text.size());
+	text.append(g.longitudeText);
+	textEnd.push_back((int)text.size());
+	keyHash.push_back(coordHash(g.latitude, g.longitude));
+	if (2 * keyHash.size() > slots.size())
+		reserve(2 * keyHash.size());	// places every node, this one too
+	else
+		place(id);
+}
+
+void NodeIndex::place(int n)
+{
+	size_t mask = slots.size() - 1;
+	size_t i = keyHash[n] & mask;
+	while (slots[i] != -1)
+		i = (i + 1) & mask;
+	slots[i] = n;
+}
+
+bool NodeIndex::textIs(int n, const GeoCoord& g) const
+{
+	int latBegin = n == 0 ? 0 : textEnd[2 * n - 1];
+	int lonBegin = textEnd[2 * n];
+	int end = textEnd[2 * n + 1];
+	return text.compare(latBegin, lonBegin - latBegin, g.latitudeText) == 0 &&
+		text.compare(lonBegin, end - lonBegin, g.longitudeText) == 0;
+}
+
+int NodeIndex::find(const GeoCoord& g) const
+{
+	if (slots.empty())
+		return -1;
+	unsigned h = coordHash(g.latitude, g.longitude);
+	size_t mask = slots.size() - 1;
+	for (size_t i = h & mask; slots[i] != -1; i = (i + 1) & mask)
+	{
+		int n = slots[i];
+		if (keyHash[n] == h && textIs(n, g))
+			return n;
+	}
+	return -1;
+}
+
+// Position of (x, y) along a Hilbert curve filling a 2^16 x 2^16 grid.
+static unsigned long long hilbertIndex(unsigned int x, unsigned int y)
+{
+	const unsigned int N = 1 << 16;
+	unsigned long long d = 0;
+	for (unsigned int s = N / 2; s > 0; s /= 2)
+	{
+		unsigned int rx = (x & s) > 0;
+		unsigned int ry = (y & s) > 0;
+		d += (unsigned long long)s * s * ((3 * rx) ^ ry);
+
+		// rotate the quadrant so the curve stays continuous
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = N - 1 - x;
+				y = N - 1 - y;
+			}
+			swap(x, y);
+		}
+	}
+	return d;
+}
+
+void hilbertOrder(const RoadGraph& g, vector<int>& order)
+{
+	int n = g.numNodes();
+	order.resize(n);
+	if (n == 0)
+		return;
+
+	const vector<double>& lat = g.coords.latDeg;
+	const vector<double>& lon = g.coords.lonDeg;
+	double minLat = lat[0], maxLat = minLat;
+	double minLon = lon[0], maxLon = minLon;
+	for (int i = 1; i < n; i++)
+	{
+		minLat = min(minLat, lat[i]);
+		maxLat = max(maxLat, lat[i]);
+		minLon = min(minLon, lon[i]);
+		maxLon = max(maxLon, lon[i]);
+	}
+	double latScale = maxLat > minLat ? 65535 / (maxLat - minLat) : 0;
+	double lonScale = maxLon > minLon ? 65535 / (maxLon - minLon) : 0;
+
+	vector<pair<unsigned long long, int>> keyed(n);
+	for (int i = 0; i < n; i++)
+	{
+		unsigned int x = (unsigned int)((lon[i] - minLon) * lonScale);
+		unsigned int y = (unsigned int)((lat[i] - minLat) * latScale);
+		keyed[i] = make_pair(hilbertIndex(x, y), i);
+	}
+	sort(keyed.begin(), keyed.end());
+
+	for (int i = 0; i < n; i++)
+		order[i] = keyed[i].second;
+}
+
+void RoadGraph::renumberNodes(const vector<int>& order)
+{
+	int n = numNodes();
+	int m = numEdges();
+
+	vector<int> newId(n);
+	for (int i = 0; i < n; i++)
+		newId[order[i]] = i;
+
+	coords.reorder(order);
+
+	// the index is built again in the new order
+	shared_ptr<NodeIndex> oldIndex = nodeIndex;
+	nodeIndex = make_shared<NodeIndex>();
+	nodeIndex->text.reserve(oldIndex->text.size());
+	nodeIndex->reserve(n);
+	for (int i = 0; i < n; i++)
+	{
+		int old = order[i];
+		GeoCoord g(oldIndex->latitudeText(old), oldIndex->longitudeText(old), coords.latDeg[i], coords.lonDeg[i]);
+		nodeIndex->add(g, i);
+	}
+
+	// each node's edges move as a block and keep their order
+	vector<int> oldFirst;
+	oldFirst.swap(firstEdge);
+	vector<int> oldTo, oldStreet;
+	vector<double> oldLength, oldBearing;
+	oldTo.swap(edgeTo);
+	oldStreet.swap(edgeStreet);
+	oldLength.swap(edgeLength);
+	oldBearing.swap(edgeBearing);
+
+	firstEdge.resize(n + 1);
+	edgeFrom.resize(m);
+	edgeTo.resize(m);
+	edgeStreet.resize(m);
+	edgeLength.resize(m);
+	edgeBearing.resize(m);
+
+	int e = 0;
+	for (int i = 0; i < n; i++)
+	{
+		firstEdge[i] = e;
+		int old = order[i];
+		for (int k = oldFirst[old]; k < oldFirst[old + 1]; k++, e++)
+		{
+			edgeFrom[e] = i;
+			edgeTo[e] = newId[oldTo[k]];
+			edgeStreet[e] = oldStreet[k];
+			edgeLength[e] = oldLength[k];
+			edgeBearing[e] = oldBearing[k];
+		}
+	}
+	firstEdge[n] = e;
+}
+
+// matches an edit's street name; an empty name matches every street
+static bool onStreet(const RoadGraph& g, const RoadGraph::StoredEdge& e, const string& name)
+{
+	return name.empty() || g.streetNames[e.street] == name;
+}
+
+bool RoadGraph::applyEdits(const RoadGraph& base, const vector<MapEdit>& edits)
+{
+	coords = base.coords;
+	streetNames = base.streetNames;
+	nodeIndex = base.nodeIndex;
+	closedEdges = base.closedEdges;
+	version = base.version + 1;
+	int baseNodes = base.numNodes();
+
+	// nodes added by these edits; they only go into a node index at the end
+	ExpandableHashMap<GeoCoord, int> added;
+	vector<GeoCoord> addedCoords;
+	auto lookup = [&](const GeoCoord& g) {
+		int id = findNode(g);
+		if (id == -1 && added.find(g) != nullptr)
+			id = *added.find(g);
+		return id;
+	};
+
+	// Each node an edit touches gets a patch: a copy of its edges for the
+	// edits to change.  Every other node's edges are copied over unchanged.
+	vector<int> patchOf(baseNodes, -1);
+	vector<vector<StoredEdge>> patches;
+	auto patch = [&](int u) -> vector<StoredEdge>& {
+		if (u >= patchOf.size())
+			patchOf.resize(u + 1, -1);
+		if (patchOf[u] == -1)
+		{
+			patchOf[u] = patches.size();
+			patches.push_back(vector<StoredEdge>());
+			if (u < baseNodes)
+			{
+				for (int e = base.edgesBegin(u); e != base.edgesEnd(u); e++)
+				{
+					StoredEdge s = { u, base.edgeTo[e], base.edgeStreet[e], base.edgeLength[e], base.edgeBearing[e] };
+					patches.back().push_back(s);
+				}
+			}
+		}
+		return patches[patchOf[u]];
+	};
+
+	for (int i = 0; i < edits.size(); i++)
+	{
+		const MapEdit& edit = edits[i];
+		int a = lookup(edit.segment.start);
+		int b = lookup(edit.segment.end);
+
+		if (edit.kind == MapEdit::ADD)
+		{
+			const GeoCoord* ends[2] = { &edit.segment.start, &edit.segment.end };
+			int* ids[2] = { &a, &b };
+			for (int k = 0; k < 2; k++)
+			{
+				if (*ids[k] != -1)
+					continue;
+				*ids[k] = numNodes();
+				addedCoords.push_back(*ends[k]);
+				coords.add(*ends[k]);
+				added.associate(*ends[k], *ids[k]);
+			}
+
+			int street = find(streetNames.begin(), streetNames.end(), edit.segment.name) - streetNames.begin();
+			if (street == streetNames.size())
+				streetNames.push_back(edit.segment.name);
+
+			double length = haversineMiles(coords, a, b);
+			StoredEdge there = { a, b, street, length, bearingDegrees(coords, a, b) };
+			patch(a).push_back(there);
+			if (!edit.oneWay)
+			{
+				StoredEdge back = { b, a, street, length, bearingDegrees(coords, b, a) };
+				patch(b).push_back(back);
+			}
+			continue;
+		}
+
+		if (a == -1 || b == -1)
+			return false;
+
+		for (int dir = 0; dir < (edit.oneWay ? 1 : 2); dir++)
+		{
+			int from = dir == 0 ? a : b;
+			int to = dir == 0 ? b : a;
+			bool matched = false;
+
+			// open edges out: dropped, or moved to the closed list
+			if (edit.kind != MapEdit::REOPEN)
+			{
+				vector<StoredEdge>& edges = patch(from);
+				for (int k = 0; k < edges.size(); )
+				{
+					if (edges[k].to == to && onStreet(*this, edges[k], edit.segment.name))
+					{
+						if (edit.kind == MapEdit::CLOSE)
+							closedEdges.push_back(edges[k]);
+						edges.erase(edges.begin() + k);
+						matched = true;
+					}
+					else
+						k++;
+				}
+			}
+
+			// closed edges: dropped, or moved back in
+			if (edit.kind != MapEdit::CLOSE)
+			{
+				for (int k = 0; k < closedEdges.size(); )
+				{
+					const StoredEdge& c = closedEdges[k];
+					if (c.from == from && c.to == to && onStreet(*this, c, edit.segment.name))
+					{
+						if (edit.kind == MapEdit::REOPEN)
+							patch(from).push_back(c);
+						closedEdges.erase(closedEdges.begin() + k);
+						matched = true;
+					}
+					else
+						k++;
+				}
+			}
+
+			if (!matched)
+				return false;
+		}
+	}
+
+	if (numNodes() != baseNodes)
+	{
+		nodeIndex = make_shared<NodeIndex>();
+		nodeIndex->reserve(numNodes());
+		for (int i = 0; i < baseNodes; i++)
+			nodeIndex->add(base.coord(i), i);
+		for (int i = baseNodes; i < numNodes(); i++)
+			nodeIndex->add(addedCoords[i - baseNodes], i);
+	}
+
+	// lay the edges out again, copying each run of untouched nodes in one go
+	int n = numNodes();
+	patchOf.resize(n, -1);
+	int m = base.numEdges();
+	for (int p = 0; p < patches.size(); p++)
+		m += patches[p].size();
+	firstEdge.resize(n + 1);
+	edgeFrom.clear();
+	edgeTo.clear();
+	edgeLength.clear();
+	edgeBearing.clear();
+	edgeStreet.clear();
+	edgeFrom.reserve(m);
+	edgeTo.reserve(m);
+	edgeLength.reserve(m);
+	edgeBearing.reserve(m);
+	edgeStreet.reserve(m);
+
+	int runStart = 0;
+	for (int u = 0; u <= n; u++)
+	{
+		if (u < n && patchOf[u] == -1)
+			continue;
+
+		// untouched nodes [runStart, u), all from base
+		int runEnd = min(u, baseNodes);
+		if (runStart < runEnd)
+		{
+			int b = base.firstEdge[runStart];
+			int e = base.firstEdge[runEnd];
+			int shift = edgeTo.size() - b;
+			for (int x = runStart; x < runEnd; x++)
+				firstEdge[x] = base.firstEdge[x] + shift;
+			edgeFrom.insert(edgeFrom.end(), base.edgeFrom.begin() + b, base.edgeFrom.begin() + e);
+			edgeTo.insert(edgeTo.end(), base.edgeTo.begin() + b, base.edgeTo.begin() + e);
+			edgeLength.insert(edgeLength.end(), base.edgeLength.begin() + b, base.edgeLength.begin() + e);
+			edgeBearing.insert(edgeBearing.end(), base.edgeBearing.begin() + b, base.edgeBearing.begin() + e);
+			edgeStreet.insert(edgeStreet.end(), base.edgeStreet.begin() + b, base.edgeStreet.begin() + e);
+		}
+		for (int x = max(runStart, runEnd); x < u; x++)
+			firstEdge[x] = edgeTo.size();	// new nodes no edit gave an edge
+		if (u == n)
+			break;
+
+		firstEdge[u] = edgeTo.size();
+		const vector<StoredEdge>& edges = patches[patchOf[u]];
+		for (int k = 0; k < edges.size(); k++)
+		{
+			edgeFrom.push_back(u);
+			edgeTo.push_back(edges[k].to);
+			edgeLength.push_back(edges[k].length);
+			edgeBearing.push_back(edges[k].bearing);
+			edgeStreet.push_back(edges[k].street);
+		}
+		runStart = u + 1;
+	}
+	firstEdge[n] = edgeTo.size();
+
+	buildChains();
+	buildComponents();
+	return true;
+}
+
+// the edge running the other way along the same segment
+static int reverseEdge(const RoadGraph& g, int e)
+{
+	int from = g.edgeFrom[e];
+	int to = g.edgeTo[e];
+	for (int r = g.edgesBegin(to); r != g.edgesEnd(to); r++)
+		if (g.edgeTo[r] == from && g.edgeStreet[r] == g.edgeStreet[e] && g.edgeLength[r] == g.edgeLength[e])
+			return r;
+	return -1;
+}
+
+void RoadGraph::buildChains()
+{
+	int n = numNodes();
+
+	// interior nodes: two edges, to two different other nodes, same street,
+	// no edges in but those two reversed (a one-way street ending there
+	// would enter the chain where no chain starts), and no edges missing
+	// from this version of a tiled map
+	vector<int> inDegree(n, 0);
+	for (int e = 0; e < numEdges(); e++)
+		inDegree[edgeTo[e]]++;
+	vector<bool> core(n, true);
+	for (int x = 0; x < n; x++)
+	{
+		int b = edgesBegin(x);
+		if (edgesEnd(x) - b != 2 || inDegree[x] != 2 || (!nodeFrontier.empty() && nodeFrontier[x]))
+			continue;
+		int a1 = edgeTo[b];
+		int a2 = edgeTo[b + 1];
+		if (a1 != a2 && a1 != x && a2 != x && edgeStreet[b] == edgeStreet[b + 1] &&
+			reverseEdge(*this, b) != -1 && reverseEdge(*this, b + 1) != -1)
+			core[x] = false;
+	}
+
+	nodeChain.assign(n, -1);
+	nodeChainPos.assign(n, -1);
+	chainFrom.clear();
+	chainTo.clear();
+	chainLength.clear();
+	chainEdgeBegin.clear();
+	chainEdges.clear();
+
+	// A loop made only of interior nodes has no core node to start a chain
+	// from.  Mark everything reachable along chains from core nodes, then
+	// promote one node of each loop that was missed.
+	vector<bool> covered(n, false);
+	for (int u = 0; u < n; u++)
+	{
+		if (!core[u])
+			continue;
+
+		covered[u] = true;
+		for (int e = edgesBegin(u); e != edgesEnd(u); e++)
+		{
+			int prev = u;
+			int x = edgeTo[e];
+			while (!core[x] && !covered[x])
+			{
+				covered[x] = true;
+				int b = edgesBegin(x);
+				int next = edgeTo[b] == prev ? edgeTo[b + 1] : edgeTo[b];
+				prev = x;
+				x = next;
+			}
+		}
+	}
+	for (int x = 0; x < n; x++)
+	{
+		if (covered[x])
+			continue;
+
+		core[x] = true;
+		covered[x] = true;
+		int prev = x;
+		int y = edgeTo[edgesBegin(x)];
+		while (y != x)
+		{
+			covered[y] = true;
+			int b = edgesBegin(y);
+			int next = edgeTo[b] == prev ? edgeTo[b + 1] : edgeTo[b];
+			prev = y;
+			y = next;
+		}
+	}
+
+	// walk out of every core node along each of its edges, in node order so
+	// the chains come out grouped by their start
+	vector<int> chainFirstEdge;
+	for (int u = 0; u < n; u++)
+	{
+		if (!core[u])
+			continue;
+
+		for (int e = edgesBegin(u); e != edgesEnd(u); e++)
+		{
+			int c = chainFrom.size();
+			chainFrom.push_back(u);
+			chainEdgeBegin.push_back(chainEdges.size());
+			chainFirstEdge.push_back(e);
+
+			double length = 0;
+			int prev = u;
+			int edge = e;
+			for (;;)
+			{
+				chainEdges.push_back(edge);
+				length += edgeLength[edge];
+				int x = edgeTo[edge];
+				if (core[x])
+				{
+					chainTo.push_back(x);
+					break;
+				}
+
+				if (nodeChain[x] == -1)
+				{
+					nodeChain[x] = c;
+					nodeChainPos[x] = chainEdges.size() - 1 - chainEdgeBegin[c];
+				}
+
+				int b = edgesBegin(x);
+				edge = edgeTo[b] == prev ? b + 1 : b;
+				prev = x;
+			}
+			chainLength.push_back(length);
+		}
+	}
+
+	int numChains = chainFrom.size();
+	chainEdgeBegin.push_back(chainEdges.size());
+
+	firstChain.assign(n + 1, 0);
+	for (int c = 0; c < numChains; c++)
+		firstChain[chainFrom[c] + 1]++;
+	for (int x = 0; x < n; x++)
+		firstChain[x + 1] += firstChain[x];
+
+	// pair each chain with the one starting with its last edge reversed
+	chainReverse.assign(numChains, -1);
+	vector<int> chainStartingWith(numEdges(), -1);
+	for (int c = 0; c < numChains; c++)
+		chainStartingWith[chainFirstEdge[c]] = c;
+	for (int c = 0; c < numChains; c++)
+	{
+		int back = reverseEdge(*this, chainEdges[chainEdgeBegin[c + 1] - 1]);
+		if (back != -1)
+			chainReverse[c] = chainStartingWith[back];
+	}
+}
+
+// Tarjan's algorithm, with an explicit stack so a long road doesn't overflow
+// the call stack.  A component is numbered when its root finishes, after
+// every component it has an edge into, so edges never lead to a higher
+// number.  The islands come from union-find over the same edges.
+void RoadGraph::buildComponents()
+{
+	int n = numNodes();
+	nodeComponent.assign(n, -1);
+	numComponents = 0;
+
+	vector<int> index(n, -1), low(n), nextEdge(n);
+	vector<int> open, path;		// nodes not yet in a component; the DFS path
+	int counter = 0;
+	for (int root = 0; root < n; root++)
+	{
+		if (index[root] != -1)
+			continue;
+
+		index[root] = low[root] = counter++;
+		nextEdge[root] = edgesBegin(root);
+		open.push_back(root);
+		path.push_back(root);
+		while (!path.empty())
+		{
+			int u = path.back();
+			if (nextEdge[u] != edgesEnd(u))
+			{
+				int v = edgeTo[nextEdge[u]++];
+				if (index[v] == -1)
+				{
+					index[v] = low[v] = counter++;
+					nextEdge[v] = edgesBegin(v);
+					open.push_back(v);
+					path.push_back(v);
+				}
+				else if (nodeComponent[v] == -1)
+					low[u] = min(low[u], index[v]);
+				continue;
+			}
+
+			path.pop_back();
+			if (!path.empty())
+				low[path.back()] = min(low[path.back()], low[u]);
+			if (low[u] == index[u])
+			{
+				int x;
+				do
+				{
+					x = open.back();
+					open.pop_back();
+					nodeComponent[x] = numComponents;
+				} while (x != u);
+				numComponents++;
+			}
+		}
+	}
+
+	// union-find with path halving; each island is named by its lowest node
+	nodeIsland.resize(n);
+	for (int x = 0; x < n; x++)
+		nodeIsland[x] = x;
+	auto find = [this](int x) {
+		while (nodeIsland[x] != x)
+			x = nodeIsland[x] = nodeIsland[nodeIsland[x]];
+		return x;
+	};
+	for (int e = 0; e < numEdges(); e++)
+	{
+		int a = find(edgeFrom[e]);
+		int b = find(edgeTo[e]);
+		if (a != b)
+			nodeIsland[max(a, b)] = min(a, b);
+	}
+	for (int x = 0; x < n; x++)
+		nodeIsland[x] = find(x);
+}
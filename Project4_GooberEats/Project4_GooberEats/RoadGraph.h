@@ -0,0 +1,208 @@
+// RoadGraph.h
+// The street map as an indexed graph.  StreetMap::load numbers every distinct
+// coordinate (in Hilbert curve order, see hilbertOrder) and stores the directed
+// segments leaving each node contiguously (compressed sparse row), together
+// with everything the router and planner would otherwise recompute per
+// segment: its length and its bearing.
+//
+// A RoadGraph is one version of the map and is never changed once StreetMap
+// has published it.  StreetMap::applyEdits builds the next version from the
+// previous one: node IDs carry over (new nodes are numbered after the old
+// ones), but edge and chain IDs are only meaningful within one version.  A
+// tiled map rebuilds every version from its tiles, so there node IDs change
+// from version to version too (see TiledMap.h).
+
+#ifndef RoadGraph_h
+#define RoadGraph_h
+
+#include "provided.h"
+#include "GeoMath.h"
+#include "ExpandableHashMap.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+struct TileUse;
+
+// Coordinate to node ID and node ID to the text of its coordinate, which is
+// what the public API knows a node by (see GeoCoord's operator==).  The
+// searches only use the numbers in RoadGraph::coords.  Versions of the map
+// that add no nodes share one.
+//
+// The text is held once, in text.  The table is keyed by the parsed latitude
+// and longitude, which equal text has equal, and holds only node IDs; text
+// that parses to the same numbers ("34.05" and "34.050") is a different node,
+// so a hit is confirmed against the node's text.  A GeoCoord's numbers must
+// be its text's value, as every one GeoCoord's constructors or the request
+// reader make is.
+struct NodeIndex
+{
+	void reserve(int nodes);
+	// Adds the next node; its ID must be the number of nodes added so far
+	void add(const GeoCoord& g, int id);
+	// g's node ID, or -1 if it is not a node
+	int find(const GeoCoord& g) const;
+
+	std::string latitudeText(int n) const { return piece(2 * n); }
+	std::string longitudeText(int n) const { return piece(2 * n + 1); }
+
+	// every node's latitude and longitude text end to end, in ID order;
+	// piece k ends at textEnd[k]
+	std::string text;
+	std::vector<int> textEnd;
+
+	// open addressing with linear probing, at most half full: node IDs, -1
+	// for an empty slot; keyHash[n] is node n's key hashed, for growing the
+	// table and for passing over other nodes without reading their text
+	std::vector<int> slots;
+	std::vector<unsigned> keyHash;
+
+private:
+	std::string piece(int k) const
+	{
+		int begin = k == 0 ? 0 : textEnd[k - 1];
+		return text.substr(begin, textEnd[k] - begin);
+	}
+
+	void place(int n);
+	bool textIs(int n, const GeoCoord& g) const;
+};
+
+// Published versions are owned by shared_ptrs, so a Route can hold on to
+// the one it was routed on (see RouteOptions::graph).
+struct RoadGraph : std::enable_shared_from_this<RoadGraph>
+{
+	// a directed edge outside the CSR arrays, as a closed one is
+	struct StoredEdge
+	{
+		int from;
+		int to;
+		int street;
+		double length;
+		double bearing;
+	};
+
+	int numNodes() const { return coords.size(); }
+	int numEdges() const { return (int)edgeTo.size(); }
+
+	// the edges leaving node n are [firstEdge[n], firstEdge[n + 1])
+	int edgesBegin(int n) const { return firstEdge[n]; }
+	int edgesEnd(int n) const { return firstEdge[n + 1]; }
+
+	// returns -1 if g is not the endpoint of any segment
+	int findNode(const GeoCoord& g) const
+	{
+		return nodeIndex->find(g);
+	}
+
+	// Node n's coordinate as the public API has it, built from the index's
+	// text and coords' numbers.  For handing out; nothing inside the map,
+	// router or planner needs one.
+	GeoCoord coord(int n) const
+	{
+		return GeoCoord(nodeIndex->latitudeText(n), nodeIndex->longitudeText(n), coords.latDeg[n], coords.lonDeg[n]);
+	}
+
+	const std::string& streetName(int e) const { return streetNames[edgeStreet[e]]; }
+
+	StreetSegment segment(int e) const
+	{
+		return StreetSegment(coord(edgeFrom[e]), coord(edgeTo[e]), streetName(e));
+	}
+
+	// Gives node order[i] the ID i, and lays out every per-node and per-edge
+	// array to match.  Edge IDs change too; each node's edges keep their order.
+	void renumberNodes(const std::vector<int>& order);
+
+	// Makes this graph the next version after base, with the edits applied in
+	// order.  Only the edge lists of nodes the edits touch are rebuilt; the
+	// rest are copied across in bulk, and the chains redone in one pass.
+	// Returns false, leaving this graph unusable, if an edit cannot be
+	// applied (see StreetMap::applyEdits).
+	bool applyEdits(const RoadGraph& base, const std::vector<MapEdit>& edits);
+
+	// Collapses runs of degree-2 nodes into chains; see the chain arrays below.
+	// Must be rerun whenever the edges change.
+	void buildChains();
+
+	// Labels the strongly connected components and the islands; see the
+	// component arrays below.  Must be rerun whenever the edges change.
+	void buildComponents();
+
+	// False if no route can lead from node a to node b: they are on different
+	// islands, or b's component comes before a's.  True says nothing; a
+	// search still has to find the route.  O(1), so the router and planner
+	// ask before searching.
+	bool mayReach(int a, int b) const
+	{
+		if (nodeComponent.empty())
+			return true;
+		return nodeIsland[a] == nodeIsland[b] && nodeComponent[a] >= nodeComponent[b];
+	}
+
+	// the chains leaving core node n are [firstChain[n], firstChain[n + 1])
+	int chainsBegin(int n) const { return firstChain[n]; }
+	int chainsEnd(int n) const { return firstChain[n + 1]; }
+	// the original edges of chain c, in travel order, are
+	// chainEdges[chainEdgeBegin[c]] .. chainEdges[chainEdgeBegin[c + 1] - 1]
+	int chainEdgeCount(int c) const { return chainEdgeBegin[c + 1] - chainEdgeBegin[c]; }
+
+	// per node: the numbers of each coordinate, as a structure of arrays (the
+	// text is in nodeIndex)
+	CoordArrays coords;
+	std::vector<int> firstEdge;		// numNodes() + 1 entries
+
+	// per directed edge
+	std::vector<int> edgeFrom;
+	std::vector<int> edgeTo;
+	std::vector<double> edgeLength;		// miles
+	std::vector<double> edgeBearing;	// degrees counterclockwise from east, as angleOfLine
+	std::vector<int> edgeStreet;		// index into streetNames
+
+	std::vector<std::string> streetNames;
+	std::shared_ptr<NodeIndex> nodeIndex = std::make_shared<NodeIndex>();
+
+	// counts up by one for every load or edit batch of a StreetMap
+	unsigned long long version = 0;
+	// edges taken out by MapEdit::CLOSE, which may yet be reopened
+	std::vector<StoredEdge> closedEdges;
+
+	// Tiled maps only (see TiledMap.h), empty otherwise: the pack tile each
+	// node came from, whether it has edges into tiles not in this version
+	// (such nodes are always core nodes), and the tiles' use stamps
+	std::vector<int> nodeTile;
+	std::vector<char> nodeFrontier;
+	std::shared_ptr<TileUse> tileUse;
+
+	// A node with exactly two neighbours, joined to both by two-way segments
+	// of one street and entered by no other edge, is interior to a chain;
+	// every other node is a core node.  A chain runs from a core node through
+	// interior nodes to the next core node, so a search only needs to visit
+	// core nodes.  Each chain is stored once in each direction.
+	std::vector<int> nodeChain;		// per node: -1 for core nodes, else a chain through it
+	std::vector<int> nodeChainPos;		// the node is the end of that chain's edge at this index
+	std::vector<int> firstChain;		// numNodes() + 1 entries
+	std::vector<int> chainFrom;
+	std::vector<int> chainTo;
+	std::vector<int> chainReverse;		// the same chain walked the other way
+	std::vector<double> chainLength;	// miles
+	std::vector<int> chainEdgeBegin;	// numChains + 1 entries
+	std::vector<int> chainEdges;
+
+	// Strongly connected components, numbered so that no edge leads from a
+	// component to a higher-numbered one, and islands: the pieces of the map
+	// connected if every segment could be driven both ways, each labelled by
+	// the ID its lowest node has in the whole map.  A tiled map takes both
+	// from the pack, so they describe the whole map rather than the tiles
+	// that are resident; empty for a pack written without them.
+	std::vector<int> nodeComponent;
+	std::vector<int> nodeIsland;
+	int numComponents = 0;		// not counted for a tiled map
+};
+
+// A node order following a Hilbert curve over the map's bounding box, so that
+// nodes near each other on the ground get nearby IDs and their data shares
+// cache lines.  For use with RoadGraph::renumberNodes.
+void hilbertOrder(const RoadGraph& g, std::vector<int>& order);
+
+#endif
@@ -0,0 +1,56 @@
+#include "RouteExecutor.h"
+#include <utility>
+#include <algorithm>
+using namespace std;
+
+RouteExecutor::RouteExecutor(int threads)
+{
+	if (threads <= 0)
+		threads = max(1u, thread::hardware_concurrency());
+	m_stopping = false;
+	for (int i = 0; i < threads; i++)
+		m_workers.push_back(thread(&RouteExecutor::work, this));
+}
+
+RouteExecutor::~RouteExecutor()
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_stopping = true;
+	}
+	m_wake.notify_all();
+	for (thread& t : m_workers)
+		t.join();
+}
+
+void RouteExecutor::submit(function<void()> task)
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_queue.push_back(move(task));
+	}
+	m_wake.notify_one();
+}
+
+int RouteExecutor::queued() const
+{
+	lock_guard<mutex> lock(m_lock);
+	return (int)m_queue.size();
+}
+
+void RouteExecutor::work()
+{
+	for (;;)
+	{
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(m_lock);
+			m_wake.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+			if (m_queue.empty())
+				return;	// stopping, and nothing left to run
+			task = move(m_queue.front());
+			m_queue.pop_front();
+		}
+		task();
+	}
+}
@@ -0,0 +1,45 @@
+// RouteExecutor.h
+// A fixed pool of worker threads that runs queued tasks in order, for
+// PointToPointRouter::routeAsync and DeliveryPlanner::planAsync.  Routers and
+// planners are safe to share between threads, so any number of queries can
+// be in flight on one executor.
+//
+// A query that was abandoned while queued still gets a worker, but its search
+// sees the deadline or cancel token at once and returns without doing any.
+
+#ifndef RouteExecutor_h
+#define RouteExecutor_h
+
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class RouteExecutor
+{
+public:
+	// threads <= 0: one per hardware thread
+	explicit RouteExecutor(int threads = 0);
+	// Runs whatever is still queued, then joins the workers
+	~RouteExecutor();
+
+	void submit(std::function<void()> task);
+	int threads() const { return (int)m_workers.size(); }
+	int queued() const;
+
+	RouteExecutor(const RouteExecutor&) = delete;
+	RouteExecutor& operator=(const RouteExecutor&) = delete;
+
+private:
+	mutable std::mutex m_lock;
+	std::condition_variable m_wake;
+	std::deque<std::function<void()>> m_queue;
+	bool m_stopping;
+	std::vector<std::thread> m_workers;
+
+	void work();
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "provided.h"
+#include "RouteMetrics.h"
+#include <string>
+#include <sstream>
+#include <atomic>
+using namespace std;
+
+namespace
+{
+	const double LATENCY_BOUNDS[] = { 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1 };
+	const double WORK_BOUNDS[] = { 1, 3, 10, 30, 100, 300, 1000, 3000, 10000, 30000, 100000, 300000 };
+
+	// Counts per bucket (not cumulative; the last bucket is +Inf) and a sum
+	// kept in integer units of `unit`, since atomic<double> can't be added to.
+	template<int N>
+	struct Histogram
+	{
+		Histogram(const double (&b)[N], double u)
+		 : bounds(b), unit(u)
+		{
+			reset();
+		}
+
+		void add(double value)
+		{
+			int i = 0;
+			while (i < N && value > bounds[i])
+				i++;
+			counts[i].fetch_add(1, memory_order_relaxed);
+			sum.fetch_add((long long)(value / unit + 0.5), memory_order_relaxed);
+		}
+
+		void reset()
+		{
+			for (int i = 0; i <= N; i++)
+				counts[i].store(0, memory_order_relaxed);
+			sum.store(0, memory_order_relaxed);
+		}
+
+		const double (&bounds)[N];
+		double unit;
+		atomic<long long> counts[N + 1];
+		atomic<long long> sum;
+	};
+
+	struct Counter
+	{
+		const char* name;
+		const char* help;
+		atomic<long long> value;
+	};
+
+	const char* const RESULT_NAMES[] = { "success", "no_route", "bad_coord", "timed_out", "cancelled", "incomplete_map", "stale_weights" };	// as DeliveryResult
+	const int NUM_RESULTS = sizeof(RESULT_NAMES) / sizeof(RESULT_NAMES[0]);
+	atomic<long long> queries[NUM_RESULTS];
+
+	Histogram<16> latency(LATENCY_BOUNDS, 1e-9);
+	Histogram<12> nodesSettled(WORK_BOUNDS, 1);
+	Histogram<12> edgesRelaxed(WORK_BOUNDS, 1);
+
+	enum { HEAP_PUSHES, STALE_POPS, HASH_LOOKUPS, PATH_EDGES, NUM_COUNTERS };
+	Counter counters[NUM_COUNTERS] = {
+		{ "heap_pushes_total", "Entries added to the open list.", {0} },
+		{ "stale_pops_total", "Open list entries skipped as already improved on.", {0} },
+		{ "hash_lookups_total", "Reads and writes of the search per-node table.", {0} },
+		{ "path_edges_total", "Segments in the routes returned.", {0} },
+	};
+
+	template<int N>
+	void prometheusHistogram(ostream& out, const char* name, const char* help, const Histogram<N>& h)
+	{
+		out << "# HELP goober_route_" << name << " " << help << "\n";
+		out << "# TYPE goober_route_" << name << " histogram\n";
+		long long cumulative = 0;
+		for (int i = 0; i <= N; i++)
+		{
+			cumulative += h.counts[i].load(memory_order_relaxed);
+			out << "goober_route_" << name << "_bucket{le=\"";
+			if (i < N)
+				out << h.bounds[i];
+			else
+				out << "+Inf";
+			out << "\"} " << cumulative << "\n";
+		}
+		out << "goober_route_" << name << "_sum " << h.sum.load(memory_order_relaxed) * h.unit << "\n";
+		out << "goober_route_" << name << "_count " << cumulative << "\n";
+	}
+
+	template<int N>
+	void jsonHistogram(ostream& out, const char* name, const Histogram<N>& h)
+	{
+		out << "    \"" << name << "\": {\"bounds\": [";
+		for (int i = 0; i < N; i++)
+			out << (i == 0 ? "" : ", ") << h.bounds[i];
+		out << "], \"counts\": [";
+		long long count = 0;
+		for (int i = 0; i <= N; i++)
+		{
+			long long c = h.counts[i].load(memory_order_relaxed);
+			out << (i == 0 ? "" : ", ") << c;
+			count += c;
+		}
+		out << "], \"sum\": " << h.sum.load(memory_order_relaxed) * h.unit << ", \"count\": " << count << "}";
+	}
+}
+
+void routeMetricsRecord(DeliveryResult result, const RouteStats& stats)
+{
+	queries[result].fetch_add(1, memory_order_relaxed);
+	latency.add(stats.elapsedSeconds);
+	nodesSettled.add(stats.nodesSettled);
+	edgesRelaxed.add(stats.edgesRelaxed);
+	counters[HEAP_PUSHES].value.fetch_add(stats.heapPushes, memory_order_relaxed);
+	counters[STALE_POPS].value.fetch_add(stats.stalePops, memory_order_relaxed);
+	counters[HASH_LOOKUPS].value.fetch_add(stats.hashLookups, memory_order_relaxed);
+	counters[PATH_EDGES].value.fetch_add(stats.pathEdges, memory_order_relaxed);
+}
+
+string routeMetricsPrometheus()
+{
+	ostringstream out;
+	out.precision(9);
+
+	out << "# HELP goober_route_queries_total Route queries by result.\n";
+	out << "# TYPE goober_route_queries_total counter\n";
+	for (int i = 0; i < NUM_RESULTS; i++)
+		out << "goober_route_queries_total{result=\"" << RESULT_NAMES[i] << "\"} " << queries[i].load(memory_order_relaxed) << "\n";
+
+	prometheusHistogram(out, "latency_seconds", "Time taken by each route query.", latency);
+	prometheusHistogram(out, "nodes_settled", "Nodes settled per route query.", nodesSettled);
+	prometheusHistogram(out, "edges_relaxed", "Edges or chains relaxed per route query.", edgesRelaxed);
+
+	for (int i = 0; i < NUM_COUNTERS; i++)
+	{
+		out << "# HELP goober_route_" << counters[i].name << " " << counters[i].help << "\n";
+		out << "# TYPE goober_route_" << counters[i].name << " counter\n";
+		out << "goober_route_" << counters[i].name << " " << counters[i].value.load(memory_order_relaxed) << "\n";
+	}
+	return out.str();
+}
+
+string routeMetricsJson()
+{
+	ostringstream out;
+	out.precision(9);
+
+	out << "{\n  \"queries\": {";
+	for (int i = 0; i < NUM_RESULTS; i++)
+		out << (i == 0 ? "" : ", ") << "\"" << RESULT_NAMES[i] << "\": " << queries[i].load(memory_order_relaxed);
+	out << "},\n  \"histograms\": {\n";
+	jsonHistogram(out, "latency_seconds", latency);
+	out << ",\n";
+	jsonHistogram(out, "nodes_settled", nodesSettled);
+	out << ",\n";
+	jsonHistogram(out, "edges_relaxed", edgesRelaxed);
+	out << "\n  },\n  \"counters\": {";
+	for (int i = 0; i < NUM_COUNTERS; i++)
+		out << (i == 0 ? "" : ", ") << "\"" << counters[i].name << "\": " << counters[i].value.load(memory_order_relaxed);
+	out << "}\n}\n";
+	return out.str();
+}
+
+void routeMetricsReset()
+{
+	for (int i = 0; i < NUM_RESULTS; i++)
+		queries[i].store(0, memory_order_relaxed);
+	latency.reset();
+	nodesSettled.reset();
+	edgesRelaxed.reset();
+	for (int i = 0; i < NUM_COUNTERS; i++)
+		counters[i].value.store(0, memory_order_relaxed);
+}
@@ -0,0 +1,25 @@
+// RouteMetrics.h
+// Process-wide totals over every PointToPointRouter query: how many queries
+// gave each result, histograms of their latency and of the work they did, and
+// running sums of the other RouteStats counters.  The router records each
+// query itself; recording is lock-free, so routers on several threads can
+// share the totals.
+//
+// Dump the totals in Prometheus text exposition format (for a /metrics
+// endpoint or a textfile collector) or as JSON (for diffing between runs).
+
+#ifndef RouteMetrics_h
+#define RouteMetrics_h
+
+#include "provided.h"
+#include <string>
+
+void routeMetricsRecord(DeliveryResult result, const RouteStats& stats);
+
+std::string routeMetricsPrometheus();
+std::string routeMetricsJson();
+
+// Zeroes every total.  Queries running at the time may be partly counted.
+void routeMetricsReset();
+
+#endif
@@ -0,0 +1,52 @@
+#include "RouteSearch.h"
+#include <algorithm>
+#include <atomic>
+using namespace std;
+
+static atomic<size_t> scratchBytes(0);
+
+// Every thread gets its own scratch, so one router (and the map under it)
+// can serve any number of threads at once without locks.
+SearchScratch& SearchScratch::forThread(int numNodes)
+{
+	thread_local SearchScratch mem;
+
+	// sized for a different map; start afresh
+	if (mem.info.size() != numNodes)
+	{
+		mem.info.assign(numNodes, SearchEntry(-1));
+		mem.stamp.assign(numNodes, 0);
+		mem.generation = 0;
+	}
+
+	mem.generation++;
+	if (mem.generation == 0)	// wrapped around; old stamps could now match
+	{
+		fill(mem.stamp.begin(), mem.stamp.end(), 0);
+		mem.generation = 1;
+	}
+
+	size_t now = mem.bytes();
+	if (now != mem.m_counted)
+	{
+		scratchBytes += now - mem.m_counted;	// wraps round for a shrink, as intended
+		mem.m_counted = now;
+	}
+	return mem;
+}
+
+SearchScratch::~SearchScratch()
+{
+	scratchBytes -= m_counted;
+}
+
+size_t SearchScratch::bytes() const
+{
+	return info.capacity() * sizeof(SearchEntry) + stamp.capacity() * sizeof(unsigned int)
+		+ openList.capacity() * sizeof(SearchEntry);
+}
+
+size_t SearchScratch::allThreadsBytes()
+{
+	return scratchBytes.load();
+}
@@ -0,0 +1,554 @@
+// RouteSearch.h
+// The router's search, as a class template over policies so that variants
+// (Dijkstra, A*, other heuristics or cost functions) are separate
+// instantiations with every policy call inlined, rather than one search
+// calling through virtual functions in its inner loop.
+//
+//   Heuristic    h(node): a lower bound on the cost from node to the goal,
+//                already scaled to the edge costs.  ChordHeuristic (A*) or
+//                ZeroHeuristic (Dijkstra).
+//   EdgeCost     edge(e) and chain(c): the cost of an edge, and of a whole
+//                chain (see RoadGraph.h).  LengthCost (miles) or ProfileCost
+//                (an EdgeWeightProfile's per-edge costs).
+//   Queue        the open list: push, pop the least f, and scan by index for
+//                the gap bound.  BinaryHeapQueue.
+//   Visited      the best entry per node: find and associate.  StampedTable,
+//                which clears in O(1) between searches.
+//   Termination  stop(settled, goal): whether settling this entry ends the
+//                search, and interrupted(): the result when it ends short
+//                of the goal.  StopAtGoal, or StopAtGoalOrDeadline for
+//                RouteOptions::deadline and cancel.
+//
+// PointToPointRouter picks the instantiation for each query (see
+// PointToPointRouter.cpp); other code can instantiate its own.  A search
+// runs on one thread's SearchScratch, which the Queue and Visited policies
+// are built on.
+
+#ifndef RouteSearch_h
+#define RouteSearch_h
+
+#include "provided.h"
+#include "RoadGraph.h"
+#include "GeoMath.h"
+#include "Trace.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+// One node's best known route from the start
+struct SearchEntry
+{
+	SearchEntry() {}
+	explicit SearchEntry(int n)
+	{
+		node = n;
+		prev = n;
+		linkBegin = -1;
+		linkEnd = -1;
+		f = 0.0;
+		distFromStart = 0.0;
+		miles = 0.0;
+		h = 0.0;
+		popped = false;
+	}
+
+	int node;
+	int prev;
+	// RoadGraph::chainEdges[linkBegin, linkEnd) lead from prev to node;
+	// -1 at the start
+	int linkBegin;
+	int linkEnd;
+
+	double f;
+	double distFromStart;	// cost, which is miles unless a profile is given
+	double miles;
+	double h;
+
+	bool popped;	// settled; its distFromStart is final
+};
+
+// Working memory for one thread's searches, kept between queries so a
+// warmed-up search allocates nothing.  A node's entry in info is only
+// meaningful when its stamp matches generation, so clearing the table for
+// the next search is just incrementing generation.
+struct SearchScratch
+{
+	std::vector<SearchEntry> info;
+	std::vector<unsigned int> stamp;
+	unsigned int generation = 0;
+	std::vector<SearchEntry> openList;
+
+	// The calling thread's scratch, sized for numNodes and cleared for a
+	// new search.
+	static SearchScratch& forThread(int numNodes);
+
+	// What this scratch holds, by capacity
+	std::size_t bytes() const;
+	// Every live thread's scratch, as of each one's latest forThread (an
+	// open list grown by a search is counted from the thread's next one)
+	static std::size_t allThreadsBytes();
+
+	SearchScratch() = default;
+	~SearchScratch();
+	SearchScratch(const SearchScratch&) = delete;
+	SearchScratch& operator=(const SearchScratch&) = delete;
+
+private:
+	std::size_t m_counted = 0;	// this scratch's share of allThreadsBytes
+};
+
+//******************** Heuristics *********************************************
+
+// Chord distance to the goal, which never exceeds the road distance
+struct ChordHeuristic
+{
+	ChordHeuristic(const RoadGraph& g, int goal, double scale)
+	 : m_coords(&g.coords), m_goal(goal), m_scale(scale)
+	{}
+	double operator()(int node) const
+	{
+		return m_scale * distanceLowerBoundMiles(*m_coords, node, m_goal);
+	}
+
+private:
+	const CoordArrays* m_coords;
+	int m_goal;
+	double m_scale;
+};
+
+struct ZeroHeuristic
+{
+	double operator()(int) const { return 0; }
+};
+
+//******************** Edge costs *********************************************
+
+struct LengthCost
+{
+	explicit LengthCost(const RoadGraph& g)
+	 : m_length(g.edgeLength.data()), m_chainLength(g.chainLength.data())
+	{}
+	double edge(int e) const { return m_length[e]; }
+	double chain(int c) const { return m_chainLength[c]; }
+
+private:
+	const double* m_length;
+	const double* m_chainLength;
+};
+
+// A per-edge cost array, such as EdgeCosts::costs; chains are
+// summed edge by edge
+struct ProfileCost
+{
+	ProfileCost(const RoadGraph& g, const double* cost)
+	 : m_graph(&g), m_cost(cost)
+	{}
+	double edge(int e) const { return m_cost[e]; }
+	double chain(int c) const
+	{
+		double sum = 0;
+		for (int i = m_graph->chainEdgeBegin[c]; i < m_graph->chainEdgeBegin[c + 1]; i++)
+			sum += m_cost[m_graph->chainEdges[i]];
+		return sum;
+	}
+
+private:
+	const RoadGraph* m_graph;
+	const double* m_cost;
+};
+
+//******************** Open lists and visited sets ****************************
+
+// A binary heap in a vector, so it can be scanned for the gap bound; entries
+// that have since been improved or settled are left in and skipped.
+class BinaryHeapQueue
+{
+public:
+	explicit BinaryHeapQueue(SearchScratch& mem)
+	 : m_heap(mem.openList)
+	{
+		m_heap.clear();
+	}
+	bool empty() const { return m_heap.empty(); }
+	int size() const { return (int)m_heap.size(); }
+	const SearchEntry& operator[](int i) const { return m_heap[i]; }
+	void push(const SearchEntry& g)
+	{
+		m_heap.push_back(g);
+		std::push_heap(m_heap.begin(), m_heap.end(), compareF());
+	}
+	SearchEntry pop()
+	{
+		std::pop_heap(m_heap.begin(), m_heap.end(), compareF());
+		SearchEntry g = m_heap.back();
+		m_heap.pop_back();
+		return g;
+	}
+
+private:
+	struct compareF
+	{
+		bool operator()(const SearchEntry& g1, const SearchEntry& g2) const
+		{
+			return g1.f > g2.f;
+		}
+	};
+
+	std::vector<SearchEntry>& m_heap;
+};
+
+// An entry per map node, valid while its stamp is the current generation
+class StampedTable
+{
+public:
+	explicit StampedTable(SearchScratch& mem)
+	 : m_info(mem.info.data()), m_stamp(mem.stamp.data()), m_generation(mem.generation)
+	{}
+	SearchEntry* find(int node)
+	{
+		return m_stamp[node] == m_generation ? &m_info[node] : nullptr;
+	}
+	void associate(int node, const SearchEntry& g)
+	{
+		m_info[node] = g;
+		m_stamp[node] = m_generation;
+	}
+
+private:
+	SearchEntry* m_info;
+	unsigned int* m_stamp;
+	unsigned int m_generation;
+};
+
+struct StopAtGoal
+{
+	bool operator()(const SearchEntry& settled, int goal) const { return settled.node == goal; }
+	DeliveryResult interrupted() const { return NO_ROUTE; }
+};
+
+// TIMED_OUT or CANCELLED if options say the query should stop now, else
+// DELIVERY_SUCCESS
+inline DeliveryResult interruption(const RouteOptions& options)
+{
+	if (options.cancel != nullptr && options.cancel->cancelled())
+		return CANCELLED;
+	if (options.deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= options.deadline)
+		return TIMED_OUT;
+	return DELIVERY_SUCCESS;
+}
+
+// Also stops once the deadline passes or the token is cancelled.  Looks only
+// every CHECK_EVERY settled nodes, so the clock is read rarely; a settle
+// takes well under a microsecond.
+class StopAtGoalOrDeadline
+{
+public:
+	explicit StopAtGoalOrDeadline(const RouteOptions& options)
+	 : m_options(&options), m_settled(0), m_result(NO_ROUTE)
+	{}
+	bool operator()(const SearchEntry& settled, int goal)
+	{
+		if (settled.node == goal)
+			return true;
+		if (++m_settled % CHECK_EVERY != 0)
+			return false;
+		DeliveryResult why = interruption(*m_options);
+		if (why == DELIVERY_SUCCESS)
+			return false;
+		m_result = why;
+		return true;
+	}
+	DeliveryResult interrupted() const { return m_result; }
+
+private:
+	static const int CHECK_EVERY = 256;
+	const RouteOptions* m_options;
+	int m_settled;
+	DeliveryResult m_result;
+};
+
+//******************** RouteSearch ********************************************
+
+template<typename Heuristic, typename EdgeCost, typename Queue = BinaryHeapQueue,
+	typename Visited = StampedTable, typename Termination = StopAtGoal>
+class RouteSearch
+{
+public:
+	// weight multiplies the heuristic, as in RouteOptions::epsilon
+	RouteSearch(const RoadGraph& graph, SearchScratch& mem, const Heuristic& h, const EdgeCost& cost,
+		double weight = 1.0, const Termination& stop = Termination())
+	 : m_graph(graph), m_h(h), m_cost(cost), m_open(mem), m_visited(mem), m_stop(stop), m_weight(weight)
+	{}
+
+	// Searches from source to goal, which must differ, filling edges and
+	// miles if a route is found.  RouteStats get the counts of work done and,
+	// with wantGap, the gap bound.  On a tiled map, frontier gets the
+	// coordinates of settled frontier nodes and tiles the tiles of every
+	// settled node (a tile may be listed more than once).
+	DeliveryResult run(int source, int goal, std::vector<int>& edges, double& miles, RouteStats& stats,
+		bool wantGap, std::vector<GeoCoord>& frontier, std::vector<int>& tiles);
+
+	RouteSearch(const RouteSearch&) = delete;
+	RouteSearch& operator=(const RouteSearch&) = delete;
+
+private:
+	const RoadGraph& m_graph;
+	Heuristic m_h;
+	EdgeCost m_cost;
+	Queue m_open;
+	Visited m_visited;
+	Termination m_stop;
+	double m_weight;
+	double m_skippedBound;	// min g + h over improvements to settled nodes
+
+	// work done, for RouteStats
+	int m_edgesRelaxed;
+	int m_heapPushes;
+	int m_stalePops;
+	int m_hashLookups;
+
+	void relax(int node, int prev, int linkBegin, int linkEnd, double g, double miles);
+	double linkCost(int linkBegin, int linkEnd) const;
+	double linkMiles(int linkBegin, int linkEnd) const;
+};
+
+template<typename H, typename C, typename Q, typename V, typename T>
+double RouteSearch<H, C, Q, V, T>::linkCost(int linkBegin, int linkEnd) const
+{
+	double sum = 0;
+	for (int i = linkBegin; i < linkEnd; i++)
+		sum += m_cost.edge(m_graph.chainEdges[i]);
+	return sum;
+}
+
+template<typename H, typename C, typename Q, typename V, typename T>
+double RouteSearch<H, C, Q, V, T>::linkMiles(int linkBegin, int linkEnd) const
+{
+	double sum = 0;
+	for (int i = linkBegin; i < linkEnd; i++)
+		sum += m_graph.edgeLength[m_graph.chainEdges[i]];
+	return sum;
+}
+
+// Offers a route to node costing g, arriving from prev along the given link.
+template<typename H, typename C, typename Q, typename V, typename T>
+void RouteSearch<H, C, Q, V, T>::relax(int node, int prev, int linkBegin, int linkEnd, double g, double miles)
+{
+	m_edgesRelaxed++;
+	if (g == HUGE_VAL)
+		return;	// crosses a closed edge
+
+	m_hashLookups++;
+	SearchEntry* r = m_visited.find(node);
+	if (r == nullptr)
+	{
+		SearchEntry n(node);
+		n.h = m_h(node);
+		n.distFromStart = g;
+		n.miles = miles;
+		n.f = g + m_weight * n.h;
+		n.prev = prev;
+		n.linkBegin = linkBegin;
+		n.linkEnd = linkEnd;
+
+		m_hashLookups++;
+		m_visited.associate(node, n);
+		m_heapPushes++;
+		m_open.push(n);
+	}
+	else if (g < r->distFromStart)
+	{
+		if (r->popped)
+		{
+			m_skippedBound = std::min(m_skippedBound, g + r->h);
+			return;
+		}
+
+		r->distFromStart = g;
+		r->miles = miles;
+		r->f = g + m_weight * r->h;
+		r->prev = prev;
+		r->linkBegin = linkBegin;
+		r->linkEnd = linkEnd;
+
+		m_heapPushes++;
+		m_open.push(*r);
+	}
+}
+
+// Best-first search by f = g + weight * h.  With a consistent heuristic and
+// weight 1 the first time the goal is settled its distance is the shortest.
+// With weight > 1 settled nodes are never reopened, which keeps the result
+// within a factor of weight; the improvements skipped that way are
+// remembered so the actual gap can be reported, as in ARA*.
+//
+// The search moves between core nodes along whole chains (see RoadGraph.h).
+// A start or end in the middle of a chain is joined to the chain's two ends.
+template<typename H, typename C, typename Q, typename V, typename T>
+DeliveryResult RouteSearch<H, C, Q, V, T>::run(int source, int goal, std::vector<int>& edges, double& miles,
+	RouteStats& stats, bool wantGap, std::vector<GeoCoord>& frontier, std::vector<int>& tiles)
+{
+	const RoadGraph& graph = m_graph;
+	m_skippedBound = HUGE_VAL;
+	m_edgesRelaxed = 0;
+	m_heapPushes = 0;
+	m_stalePops = 0;
+	m_hashLookups = 0;
+
+	int settled = 0;
+	SearchEntry first(source);
+	first.h = m_h(source);
+	first.f = m_weight * first.h;
+	m_visited.associate(source, first);
+	m_hashLookups++;
+
+	int sourceChain = graph.nodeChain[source];
+	if (sourceChain == -1)
+	{
+		m_open.push(first);
+		m_heapPushes++;
+	}
+	else
+	{
+		// leave by either end of the chain
+		m_visited.find(source)->popped = true;
+		m_hashLookups++;
+		settled++;
+
+		int c = sourceChain;
+		int k = graph.nodeChainPos[source];
+		int b = graph.chainEdgeBegin[c] + k + 1;
+		int e = graph.chainEdgeBegin[c + 1];
+		relax(graph.chainTo[c], source, b, e, linkCost(b, e), linkMiles(b, e));
+
+		int rc = graph.chainReverse[c];
+		b = graph.chainEdgeBegin[rc] + graph.chainEdgeCount(c) - 2 - k + 1;
+		e = graph.chainEdgeBegin[rc + 1];
+		relax(graph.chainTo[rc], source, b, e, linkCost(b, e), linkMiles(b, e));
+	}
+
+	// a goal inside a chain is entered from either end of it
+	int goalEntry[2] = { -1, -1 };
+	int goalLinkBegin[2];
+	int goalLinkEnd[2];
+	int goalChain = graph.nodeChain[goal];
+	if (goalChain != -1)
+	{
+		int c = goalChain;
+		int rc = graph.chainReverse[c];
+		int k = graph.nodeChainPos[goal];
+		int rk = graph.chainEdgeCount(c) - 2 - k;
+
+		goalEntry[0] = graph.chainFrom[c];
+		goalLinkBegin[0] = graph.chainEdgeBegin[c];
+		goalLinkEnd[0] = graph.chainEdgeBegin[c] + k + 1;
+		goalEntry[1] = graph.chainFrom[rc];
+		goalLinkBegin[1] = graph.chainEdgeBegin[rc];
+		goalLinkEnd[1] = graph.chainEdgeBegin[rc] + rk + 1;
+
+		// both on the same chain: straight along it
+		if (sourceChain == goalChain)
+		{
+			int ks = graph.nodeChainPos[source];
+			int b, e;
+			if (k > ks)
+			{
+				b = graph.chainEdgeBegin[c] + ks + 1;
+				e = graph.chainEdgeBegin[c] + k + 1;
+			}
+			else
+			{
+				b = graph.chainEdgeBegin[rc] + graph.chainEdgeCount(c) - 2 - ks + 1;
+				e = graph.chainEdgeBegin[rc] + rk + 1;
+			}
+			relax(goal, source, b, e, linkCost(b, e), linkMiles(b, e));
+		}
+	}
+
+	DeliveryResult result = NO_ROUTE;
+	TraceSpan searching("route/search");
+	while (!m_open.empty())
+	{
+		SearchEntry q = m_open.pop();
+
+		m_hashLookups++;
+		SearchEntry* best = m_visited.find(q.node);
+		if (best->popped || q.distFromStart > best->distFromStart)
+		{
+			m_stalePops++;
+			continue;
+		}
+		best->popped = true;
+		settled++;
+		if (!graph.nodeFrontier.empty())
+		{
+			int t = graph.nodeTile[q.node];
+			if (tiles.empty() || tiles.back() != t)
+				tiles.push_back(t);
+			if (graph.nodeFrontier[q.node])
+				frontier.push_back(graph.coord(q.node));
+		}
+
+		if (m_stop(q, goal))
+		{
+			if (q.node != goal)
+			{
+				result = m_stop.interrupted();
+				break;
+			}
+
+			searching.end();
+			TraceSpan reconstruct("route/reconstruct");
+			miles = q.miles;
+			//return path
+			for (const SearchEntry* p = best; p->linkBegin != -1; p = m_visited.find(p->prev))
+			{
+				for (int i = p->linkEnd - 1; i >= p->linkBegin; i--)
+					edges.push_back(graph.chainEdges[i]);
+				m_hashLookups++;
+			}
+			std::reverse(edges.begin(), edges.end());
+
+			stats.cost = q.distFromStart;
+			if (wantGap && m_weight > 1.0 && q.distFromStart > 0)
+			{
+				double lowerBound = m_skippedBound;
+				for (int i = 0; i < m_open.size(); i++)
+				{
+					const SearchEntry& o = m_open[i];
+					const SearchEntry* oBest = m_visited.find(o.node);
+					if (!oBest->popped && o.distFromStart <= oBest->distFromStart)
+						lowerBound = std::min(lowerBound, o.distFromStart + o.h);
+				}
+				m_hashLookups += m_open.size();
+				double gap = lowerBound < q.distFromStart ? q.distFromStart / lowerBound - 1 : 0.0;
+				stats.gapBound = std::min(gap, m_weight - 1.0);
+			}
+			result = DELIVERY_SUCCESS;
+			break;
+		}
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (q.node != goalEntry[i])
+				continue;
+			int b = goalLinkBegin[i];
+			int e = goalLinkEnd[i];
+			relax(goal, q.node, b, e, q.distFromStart + linkCost(b, e), q.miles + linkMiles(b, e));
+		}
+
+		for (int c = graph.chainsBegin(q.node); c != graph.chainsEnd(q.node); c++)
+			relax(graph.chainTo[c], q.node, graph.chainEdgeBegin[c], graph.chainEdgeBegin[c + 1],
+				q.distFromStart + m_cost.chain(c), q.miles + graph.chainLength[c]);
+	}//end while
+
+	stats.nodesSettled = settled;
+	stats.edgesRelaxed = m_edgesRelaxed;
+	stats.heapPushes = m_heapPushes;
+	stats.stalePops = m_stalePops;
+	stats.hashLookups = m_hashLookups;
+	return result;
+}
+
+#endif
@@ -0,0 +1,252 @@
+#include "provided.h"
+#include "ServiceArea.h"
+#include "RoadGraph.h"
+#include "GeoMath.h"
+#include "TiledMap.h"
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <memory>
+using namespace std;
+
+class ServiceAreaImpl
+{
+public:
+    ServiceAreaImpl(const StreetMap* sm);
+    ~ServiceAreaImpl();
+    DeliveryResult compute(const GeoCoord& depot, double maxMiles);
+    const RoadGraph& graph() const { return *m_graph; }
+    const vector<int>& nodes() const;
+    double distanceTo(int node) const;
+    bool contains(const GeoCoord& g, double* roadMiles) const;
+
+private:
+	const StreetMap* m_map;
+	shared_ptr<const RoadGraph> m_graph;	// the version the area was computed on
+	double m_maxMiles;
+
+	// Search state is kept between calls.  A node's entry in m_dist is only
+	// meaningful when its m_stamp matches m_search, so starting a new search
+	// is just incrementing m_search.
+	vector<double> m_dist;
+	vector<unsigned int> m_stamp;
+	unsigned int m_search;
+	vector<pair<double, int>> m_heap;
+
+	vector<int> m_reached;		// settled nodes in settle order
+	mutable vector<double> m_crow;	// scratch for contains()
+
+	bool seen(int node) const { return m_stamp[node] == m_search; }
+	void forget();
+	DeliveryResult search(const GeoCoord& depot, vector<GeoCoord>& frontier, vector<int>& tiles);
+};
+
+ServiceAreaImpl::ServiceAreaImpl(const StreetMap* sm)
+{
+	m_map = sm;
+	m_graph = sm->snapshot();
+	m_maxMiles = 0;
+	m_search = 0;
+}
+
+ServiceAreaImpl::~ServiceAreaImpl()
+{
+	m_map = nullptr;
+}
+
+// On a tiled map, a search that settled frontier nodes may have missed
+// nodes, or shorter ways to them, through the tiles it lacked.  Those are
+// brought in, holding the tiles already crossed, and the search runs again
+// on the version that has them, as PointToPointRouter does.
+DeliveryResult ServiceAreaImpl::compute(const GeoCoord& depot, double maxMiles)
+{
+	const int MAX_TILE_ROUNDS = 100;
+	m_maxMiles = maxMiles;
+
+	TilePins held;
+	vector<GeoCoord> frontier;
+	vector<int> tiles;
+	DeliveryResult result;
+	for (int round = 0; ; round++)
+	{
+		m_graph = m_map->snapshot();
+		result = search(depot, frontier, tiles);
+		if (m_graph->tileUse == nullptr || (result == DELIVERY_SUCCESS && frontier.empty()))
+			break;
+
+		if (result == BAD_COORD)
+			m_map->loadTilesFor(vector<GeoCoord>(1, depot), false, &held);
+		else
+		{
+			held.hold(*m_graph, tiles);
+			m_map->loadTilesFor(frontier, true, &held);
+			forget();	// unless a newer version completes it
+			result = INCOMPLETE_MAP;
+		}
+		if (m_map->snapshot()->version == m_graph->version || round == MAX_TILE_ROUNDS)
+			break;
+	}
+	m_map->releaseTiles(held);
+	return result;
+}
+
+// Empties the area; every stamp is now stale
+void ServiceAreaImpl::forget()
+{
+	m_reached.clear();
+	m_search++;
+	if (m_search == 0)	// wrapped around; old stamps could now match
+	{
+		fill(m_stamp.begin(), m_stamp.end(), 0);
+		m_search = 1;
+	}
+}
+
+// One bounded Dijkstra search on m_graph.  On a tiled map, frontier gets the
+// settled frontier nodes and tiles the tiles of every settled node.
+DeliveryResult ServiceAreaImpl::search(const GeoCoord& depot, vector<GeoCoord>& frontier, vector<int>& tiles)
+{
+	const RoadGraph& graph = *m_graph;
+	frontier.clear();
+	tiles.clear();
+
+	// the map may have been reloaded since the last search
+	if (m_dist.size() != graph.numNodes())
+	{
+		m_dist.assign(graph.numNodes(), 0.0);
+		m_stamp.assign(graph.numNodes(), 0);
+		m_search = 0;
+	}
+
+	forget();
+
+	int source = graph.findNode(depot);
+	if (source == -1)
+		return BAD_COORD;
+	if (m_maxMiles < 0)
+		return DELIVERY_SUCCESS;
+
+	m_heap.clear();
+	m_heap.push_back(make_pair(0.0, source));
+	m_dist[source] = 0;
+	m_stamp[source] = m_search;
+
+	typedef greater<pair<double, int>> minFirst;
+	while (!m_heap.empty())
+	{
+		pop_heap(m_heap.begin(), m_heap.end(), minFirst());
+		double d = m_heap.back().first;
+		int node = m_heap.back().second;
+		m_heap.pop_back();
+
+		if (d > m_dist[node])
+			continue;	// stale; a shorter entry was already settled
+		m_reached.push_back(node);
+		if (!graph.nodeFrontier.empty())
+		{
+			if (tiles.empty() || tiles.back() != graph.nodeTile[node])
+				tiles.push_back(graph.nodeTile[node]);
+			if (graph.nodeFrontier[node])
+				frontier.push_back(graph.coord(node));
+		}
+
+		for (int e = graph.edgesBegin(node); e != graph.edgesEnd(node); e++)
+		{
+			int next = graph.edgeTo[e];
+			double nd = d + graph.edgeLength[e];
+			if (nd > m_maxMiles)
+				continue;
+			if (seen(next) && m_dist[next] <= nd)
+				continue;
+
+			m_dist[next] = nd;
+			m_stamp[next] = m_search;
+			m_heap.push_back(make_pair(nd, next));
+			push_heap(m_heap.begin(), m_heap.end(), minFirst());
+		}
+	}
+
+	return DELIVERY_SUCCESS;
+}
+
+const vector<int>& ServiceAreaImpl::nodes() const
+{
+	return m_reached;
+}
+
+double ServiceAreaImpl::distanceTo(int node) const
+{
+	if (node < 0 || node >= m_stamp.size() || !seen(node))
+		return -1;
+	return m_dist[node];
+}
+
+bool ServiceAreaImpl::contains(const GeoCoord& g, double* roadMiles) const
+{
+	if (m_reached.empty())
+		return false;
+
+	int node = m_graph->findNode(g);
+	if (node != -1 && node < m_stamp.size())
+	{
+		if (roadMiles != nullptr)
+			*roadMiles = distanceTo(node);
+		return seen(node);
+	}
+
+	// not a map node: drive to the best node in the area, then go straight
+	m_crow.resize(m_reached.size());
+	distanceBatchMiles(m_graph->coords, g, m_reached.data(), m_reached.size(), m_crow.data());
+
+	double best = -1;
+	for (int i = 0; i < m_reached.size(); i++)
+	{
+		double total = m_dist[m_reached[i]] + m_crow[i];
+		if (best < 0 || total < best)
+			best = total;
+	}
+
+	if (roadMiles != nullptr)
+		*roadMiles = best;
+	return best <= m_maxMiles;
+}
+
+//******************** ServiceArea functions **********************************
+
+// These functions simply delegate to ServiceAreaImpl's functions.
+
+ServiceArea::ServiceArea(const StreetMap* sm)
+{
+    m_impl = new ServiceAreaImpl(sm);
+}
+
+ServiceArea::~ServiceArea()
+{
+    delete m_impl;
+}
+
+DeliveryResult ServiceArea::compute(const GeoCoord& depot, double maxMiles)
+{
+    return m_impl->compute(depot, maxMiles);
+}
+
+const RoadGraph& ServiceArea::graph() const
+{
+    return m_impl->graph();
+}
+
+const vector<int>& ServiceArea::nodes() const
+{
+    return m_impl->nodes();
+}
+
+double ServiceArea::distanceTo(int node) const
+{
+    return m_impl->distanceTo(node);
+}
+
+bool ServiceArea::contains(const GeoCoord& g, double* roadMiles) const
+{
+    return m_impl->contains(g, roadMiles);
+}
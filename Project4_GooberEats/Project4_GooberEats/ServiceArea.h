@@ -0,0 +1,46 @@
+// ServiceArea.h
+// Everything reachable by road within a given distance of a depot, found with
+// one bounded Dijkstra search instead of a route per candidate.  A ServiceArea
+// holds its last search, and the version of the map it ran on, so each thread
+// needs its own.
+//
+// On a tiled map (see TiledMap.h) the search brings in tiles as it reaches
+// frontier nodes and runs again on the version that has them, as the router
+// does, so the area is never cut short by a tile that wasn't resident.
+
+#ifndef ServiceArea_h
+#define ServiceArea_h
+
+#include "provided.h"
+#include <vector>
+
+class ServiceAreaImpl;
+
+class ServiceArea
+{
+public:
+    ServiceArea(const StreetMap* sm);
+    ~ServiceArea();
+      // Replaces the current area with every map node within maxMiles of depot
+      // by road.  Returns BAD_COORD if depot is not on the map, and on a tiled
+      // map INCOMPLETE_MAP, with the area empty, if the tiles it reaches
+      // can't all be brought in.
+    DeliveryResult compute(const GeoCoord& depot, double maxMiles);
+      // The version of the map the area was computed on
+    const RoadGraph& graph() const;
+      // Node IDs (see RoadGraph.h) in the area, nearest first, on graph()
+    const std::vector<int>& nodes() const;
+      // Road distance from the depot, or -1 if node is not in the area
+    double distanceTo(int node) const;
+      // True if g can be reached within the limit: by road to some node in the
+      // area and then in a straight line from there.  roadMiles, if given, is
+      // set to the shortest such distance.
+    bool contains(const GeoCoord& g, double* roadMiles = nullptr) const;
+      // We prevent a ServiceArea object from being copied or assigned.
+    ServiceArea(const ServiceArea&) = delete;
+    ServiceArea& operator=(const ServiceArea&) = delete;
+private:
+    ServiceAreaImpl* m_impl;
+};
+
+#endif
@@ -3,7 +3,16 @@
 #include <vector>
 #include <functional>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
 #include "ExpandableHashMap.h"
+#include "RoadGraph.h"
+#include "Allocators.h"
+#include "TiledMap.h"
+#include "MemoryReport.h"
+#include "Trace.h"
 using namespace std;
 
 unsigned int hasher(const GeoCoord& g)
@@ -11,6 +20,16 @@ unsigned int hasher(const GeoCoord& g)
     return std::hash<string>()(g.latitudeText + g.longitudeText);
 }
 
+unsigned int hasher(const string& s)
+{
+    return std::hash<string>()(s);
+}
+
+unsigned int hasher(const int& i)
+{
+    return std::hash<int>()(i);
+}
+
 class StreetMapImpl
 {
 public:
@@ -18,32 +37,158 @@ public:
     ~StreetMapImpl();
     bool load(string mapFile);
     bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const;
+    const RoadGraph& graph() const { return *snapshot(); }
+    shared_ptr<const RoadGraph> snapshot() const;
+    bool applyEdits(const vector<MapEdit>& edits);
+    bool loadTiles(string packFile, size_t budgetBytes);
+    bool loadTilesFor(const vector<GeoCoord>& coords, bool beyond, TilePins* hold) const;
+    void releaseTiles(TilePins& pins) const;
+    void reportMemory(MemoryReport& report) const;
 
 private:
-	ExpandableHashMap<GeoCoord, vector<StreetSegment>>* m_data;
+	// The current version: m_graph owns it and is only touched with
+	// m_writeLock held; readers find it through m_current, with no lock (see
+	// snapshot()), and a reader's copy keeps its version alive however many
+	// edits follow.
+	mutable shared_ptr<const RoadGraph> m_graph;
+	mutable atomic<const RoadGraph*> m_current;
+	mutable mutex m_writeLock;	// one load, edit batch or tile change at a time; queries never take it
+	unique_ptr<TileCache> m_tiles;	// null unless the map came from a tile pack
+
+	static int addNode(RoadGraph& graph, const GeoCoord& g);
+	void publish(shared_ptr<RoadGraph> next) const;
 };
 
 StreetMapImpl::StreetMapImpl()
 {
-	m_data = new ExpandableHashMap<GeoCoord, vector<StreetSegment>>();
+	m_graph = make_shared<RoadGraph>();
+	m_current.store(m_graph.get());
 }
 
 StreetMapImpl::~StreetMapImpl() 
 {
-	delete m_data;
+}
+
+int StreetMapImpl::addNode(RoadGraph& graph, const GeoCoord& g)
+{
+	int id = graph.findNode(g);
+	if (id != -1)
+		return id;
+
+	id = graph.numNodes();
+	graph.coords.add(g);
+	graph.nodeIndex->add(g, id);
+	return id;
+}
+
+// A hazard pointer per thread: the version a snapshot() on that thread is in
+// the middle of taking a reference to.  Records are shared by every map,
+// never freed, and reused by later threads once theirs exits.
+struct SnapshotHazard
+{
+	atomic<const RoadGraph*> graph{ nullptr };
+	atomic<bool> inUse{ false };
+	SnapshotHazard* next = nullptr;
+};
+
+static atomic<SnapshotHazard*> s_hazards{ nullptr };
+
+static SnapshotHazard& threadHazard()
+{
+	struct Owner
+	{
+		SnapshotHazard* h;
+		Owner()
+		{
+			for (h = s_hazards.load(); h != nullptr; h = h->next)
+			{
+				bool free = false;
+				if (h->inUse.compare_exchange_strong(free, true))
+					return;
+			}
+			h = new SnapshotHazard;
+			h->inUse.store(true);
+			h->next = s_hazards.load();
+			while (!s_hazards.compare_exchange_weak(h->next, h))
+				;
+		}
+		~Owner() { h->inUse.store(false); }
+	};
+	thread_local Owner owner;
+	return *owner.h;
+}
+
+// Lock-free: announce the version, check it is still current, and take a
+// reference through shared_from_this.  publish() does not let go of a version
+// a reader has announced, so it can't be freed in between.  What is shared
+// between readers is the version's reference count, one atomic increment and
+// one decrement per snapshot.
+shared_ptr<const RoadGraph> StreetMapImpl::snapshot() const
+{
+	SnapshotHazard& hazard = threadHazard();
+	const RoadGraph* g = m_current.load();
+	for (;;)
+	{
+		hazard.graph.store(g);
+		const RoadGraph* again = m_current.load();
+		if (again == g)
+			break;
+		g = again;
+	}
+	shared_ptr<const RoadGraph> held = g->shared_from_this();
+	hazard.graph.store(nullptr, memory_order_release);
+	return held;
+}
+
+// Must be called with m_writeLock held.  Tile loads publish from const
+// functions: which tiles are resident is not part of the map's value.
+// Waits, before dropping the map's reference to the old version, for any
+// reader still taking its own; that is a few instructions, and only the
+// writer waits.
+void StreetMapImpl::publish(shared_ptr<RoadGraph> next) const
+{
+	next->version = m_graph->version + 1;
+	shared_ptr<const RoadGraph> old = move(m_graph);
+	m_graph = move(next);
+	m_current.store(m_graph.get());
+	for (SnapshotHazard* h = s_hazards.load(); h != nullptr; h = h->next)
+		while (h->graph.load() == old.get())
+			this_thread::yield();
 }
 
 bool StreetMapImpl::load(string mapFile)
 {
+	TraceSpan span("StreetMap::load");
 	ifstream infile(mapFile);
 	if (!infile)
 		return false;
 
+	lock_guard<mutex> lock(m_writeLock);
+	m_tiles.reset();
+	shared_ptr<RoadGraph> built = make_shared<RoadGraph>();
+	RoadGraph& g = *built;
+
+	// every segment in the file becomes two directed edges, collected here in
+	// file order and then grouped by their start node
+	vector<int> from, to, street;
+	Arena scratch;		// the street index is freed in one go when load returns
+	ExpandableHashMap<string, int, ArenaAllocator<char>> streetIndex(0.5, ArenaAllocator<char>(&scratch));
+	TraceSpan parse("load/parse");
+
 	string str, name;
 	while (getline(infile, str))
 	{
 		name = str;
-		StreetSegment segment;
+
+		int streetId;
+		if (streetIndex.find(name) == nullptr)
+		{
+			streetId = g.streetNames.size();
+			g.streetNames.push_back(name);
+			streetIndex.associate(name, streetId);
+		}
+		else
+			streetId = *streetIndex.find(name);
 
 		int numSegments = 1;
 		infile >> numSegments;
@@ -66,54 +211,170 @@ bool StreetMapImpl::load(string mapFile)
 			GeoCoord g1(g1Lat, g1Long);
 			GeoCoord g2(g2Lat, g2Long);
 
-			StreetSegment tempSegment(g1, g2, name);
-			segment = tempSegment;
-			segment.name = name;
-			if (m_data->find(g1) == nullptr)
-			{
-				vector<StreetSegment> streetVec;
-				streetVec.push_back(segment);
-				m_data->associate(g1, streetVec);
-			}
-			else 
-			{
-				vector<StreetSegment> vec;
-				vec = *(m_data->find(g1));
-				vec.push_back(segment);
-				m_data->associate(g1, vec);
-			}
+			int a = addNode(g, g1);
+			int b = addNode(g, g2);
 
-			StreetSegment revTempSegment(g2, g1, name);
-			segment = revTempSegment;
-			segment.name = name;
-			if (m_data->find(g2) == nullptr)
-			{
-				vector<StreetSegment> streetVec;
-				streetVec.push_back(segment);
-				m_data->associate(g2, streetVec);
-			}
-			else
-			{
-				vector<StreetSegment> vec;
-				vec = *(m_data->find(g2));
-				vec.push_back(segment);
-				m_data->associate(g2, vec);
-			}
+			from.push_back(a);
+			to.push_back(b);
+			street.push_back(streetId);
 
+			from.push_back(b);
+			to.push_back(a);
+			street.push_back(streetId);
 		}
 
 	}
 
+	parse.end();
+
+	// counting sort by start node; stable, so each node's segments keep the
+	// order they appeared in the file
+	TraceSpan index("load/index");
+	int numNodes = g.numNodes();
+	int numEdges = from.size();
+
+	g.firstEdge.assign(numNodes + 1, 0);
+	for (int e = 0; e < numEdges; e++)
+		g.firstEdge[from[e] + 1]++;
+	for (int n = 0; n < numNodes; n++)
+		g.firstEdge[n + 1] += g.firstEdge[n];
+
+	g.edgeFrom.resize(numEdges);
+	g.edgeTo.resize(numEdges);
+	g.edgeLength.resize(numEdges);
+	g.edgeBearing.resize(numEdges);
+	g.edgeStreet.resize(numEdges);
+
+	vector<int> next(g.firstEdge.begin(), g.firstEdge.end() - 1);
+	for (int e = 0; e < numEdges; e++)
+	{
+		int slot = next[from[e]]++;
+		g.edgeFrom[slot] = from[e];
+		g.edgeTo[slot] = to[e];
+		g.edgeLength[slot] = haversineMiles(g.coords, from[e], to[e]);
+		g.edgeBearing[slot] = bearingDegrees(g.coords, from[e], to[e]);
+		g.edgeStreet[slot] = street[e];
+	}
+
+	index.end();
+
+	// file order scatters neighbouring nodes across memory; renumber them so
+	// a search's working set stays compact
+	TraceSpan renumber("load/renumber");
+	vector<int> order;
+	hilbertOrder(g, order);
+	g.renumberNodes(order);
+	renumber.end();
+
+	TraceSpan chains("load/chains");
+	g.buildChains();
+	chains.end();
+
+	TraceSpan components("load/components");
+	g.buildComponents();
+	components.end();
+
+	publish(built);
+	return true;
+}
+
+// Builds the next version off to the side while queries carry on with the
+// current one, then swaps it in.
+bool StreetMapImpl::applyEdits(const vector<MapEdit>& edits)
+{
+	TraceSpan span("StreetMap::applyEdits");
+	lock_guard<mutex> lock(m_writeLock);
+	if (m_tiles != nullptr)
+		return false;	// the next tile change would rebuild from the pack and lose them
+
+	shared_ptr<RoadGraph> next = make_shared<RoadGraph>();
+	if (!next->applyEdits(*m_graph, edits))
+		return false;
+
+	publish(next);
+	return true;
+}
+
+// Starts with no tiles resident; the first queries bring in what they need.
+bool StreetMapImpl::loadTiles(string packFile, size_t budgetBytes)
+{
+	TraceSpan span("StreetMap::loadTiles");
+	unique_ptr<TileCache> tiles(new TileCache);
+	if (!tiles->open(packFile, budgetBytes))
+		return false;
+
+	lock_guard<mutex> lock(m_writeLock);
+	m_tiles = move(tiles);
+	shared_ptr<RoadGraph> empty = make_shared<RoadGraph>();
+	m_tiles->assemble(*empty);
+	publish(empty);
 	return true;
 }
 
+bool StreetMapImpl::loadTilesFor(const vector<GeoCoord>& coords, bool beyond, TilePins* hold) const
+{
+	shared_ptr<const RoadGraph> current = snapshot();
+	if (current->tileUse == nullptr)
+		return false;
+
+	TraceSpan span("StreetMap::loadTilesFor");
+	lock_guard<mutex> lock(m_writeLock);
+	if (m_tiles == nullptr)
+		return false;
+	shared_ptr<RoadGraph> next;
+	if (m_tiles->require(coords, beyond, *current, next, hold))
+	{
+		publish(next);
+		return true;
+	}
+	// another thread may have brought the tiles in since current was taken
+	return m_graph->version != current->version;
+}
+
+// The write lock is only taken while held tiles have kept the cache over its
+// budget.
+void StreetMapImpl::releaseTiles(TilePins& pins) const
+{
+	pins.release();
+	shared_ptr<const RoadGraph> current = snapshot();
+	if (current->tileUse == nullptr || !current->tileUse->overBudget.load(memory_order_relaxed))
+		return;
+
+	lock_guard<mutex> lock(m_writeLock);
+	shared_ptr<RoadGraph> next;
+	if (m_tiles != nullptr && m_tiles->trim(next))
+		publish(next);
+}
+
+void StreetMapImpl::reportMemory(MemoryReport& report) const
+{
+	::reportMemory(*snapshot(), report);
+	lock_guard<mutex> lock(m_writeLock);	// the tile cache changes under it
+	if (m_tiles != nullptr)
+		m_tiles->reportMemory(report);
+}
+
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-	if (m_data->find(gc) == nullptr)
+	shared_ptr<const RoadGraph> graph = snapshot();
+	int n = graph->findNode(gc);
+
+	// a tiled map may not have this node's tile, or every tile its edges reach
+	if (graph->tileUse != nullptr && (n == -1 || graph->nodeFrontier[n]))
+	{
+		vector<GeoCoord> here(1, gc);
+		if (n == -1)
+			loadTilesFor(here, false, nullptr);
+		loadTilesFor(here, true, nullptr);
+		graph = snapshot();
+		n = graph->findNode(gc);
+	}
+	if (n == -1)
 		return false;
 
 	segs.clear();
-	segs = *(m_data->find(gc));
+	for (int e = graph->edgesBegin(n); e != graph->edgesEnd(n); e++)
+		segs.push_back(graph->segment(e));
 	return true;
 }
 
@@ -141,3 +402,38 @@ bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegmen
 {
    return m_impl->getSegmentsThatStartWith(gc, segs);
 }
+
+const RoadGraph& StreetMap::graph() const
+{
+    return m_impl->graph();
+}
+
+shared_ptr<const RoadGraph> StreetMap::snapshot() const
+{
+    return m_impl->snapshot();
+}
+
+bool StreetMap::applyEdits(const vector<MapEdit>& edits)
+{
+    return m_impl->applyEdits(edits);
+}
+
+bool StreetMap::loadTiles(string packFile, size_t budgetBytes)
+{
+    return m_impl->loadTiles(packFile, budgetBytes);
+}
+
+bool StreetMap::loadTilesFor(const vector<GeoCoord>& coords, bool beyond, TilePins* hold) const
+{
+    return m_impl->loadTilesFor(coords, beyond, hold);
+}
+
+void StreetMap::releaseTiles(TilePins& pins) const
+{
+    m_impl->releaseTiles(pins);
+}
+
+void StreetMap::reportMemory(MemoryReport& report) const
+{
+    m_impl->reportMemory(report);
+}
@@ -0,0 +1,814 @@
+#include "provided.h"
+#include "TiledMap.h"
+#include "RoadGraph.h"
+#include "MemoryReport.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+using namespace std;
+
+#if defined(_WIN32)
+#define TILES_READ
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Pack layout, all little-endian as written by this machine:
+//   magic, header size (long long)
+//   nodesPerTile, numTiles, numStreets (int); each street name
+//   per tile: firstNode, numNodes (int), minLat, maxLat, minLon, maxLon
+//             (double), offset, bytes (long long)
+//   numKeys (int); per node, sorted: latitude, longitude (double), tile (int)
+// then each tile at its offset:
+//   per node: latitude text, longitude text
+//   firstEdge (numNodes + 1 ints, local to the tile)
+//   per edge: to (global node ID), street (int), length, bearing (double)
+//   numBoundary (int); per entry: local node, tile (int)
+//   per node: component, island (int; see RoadGraph::nodeComponent)
+// Strings are an int length and that many bytes.  Packs from before the key
+// table was added have the second magic and end their header at the
+// directory; packs from before the components were added have the first
+// magic and also end each tile at its boundary table.
+static const char TILES_MAGIC[8] = { 'G', 'E', 'T', 'I', 'L', 'E', 'S', '3' };
+static const char TILES_MAGIC_2[8] = { 'G', 'E', 'T', 'I', 'L', 'E', 'S', '2' };
+static const char TILES_MAGIC_1[8] = { 'G', 'E', 'T', 'I', 'L', 'E', 'S', '1' };
+static const int KEY_BYTES = 2 * sizeof(double) + sizeof(int);
+
+// A node's parsed coordinate and its tile: an entry of the key table
+struct TileKey
+{
+	double lat;
+	double lon;
+	int tile;
+
+	bool operator<(const TileKey& other) const
+	{
+		if (lat != other.lat)
+			return lat < other.lat;
+		if (lon != other.lon)
+			return lon < other.lon;
+		return tile < other.tile;
+	}
+};
+
+template<typename T>
+static void put(string& out, T value)
+{
+	out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void putString(string& out, const string& s)
+{
+	put<int>(out, s.size());
+	out.append(s);
+}
+
+// Bounds-checked reads from a block of the pack; ok turns false, for good,
+// at the first read past the end.
+struct PackReader
+{
+	PackReader(const char* begin, const char* end)
+	 : p(begin), end(end), ok(begin != nullptr)
+	{}
+
+	template<typename T>
+	T get()
+	{
+		T value = T();
+		if (!ok || end - p < (long long)sizeof(T))
+		{
+			ok = false;
+			return value;
+		}
+		memcpy(&value, p, sizeof(T));
+		p += sizeof(T);
+		return value;
+	}
+
+	string getString()
+	{
+		int len = get<int>();
+		if (!ok || len < 0 || end - p < len)
+		{
+			ok = false;
+			return "";
+		}
+		string s(p, len);
+		p += len;
+		return s;
+	}
+
+	const char* p;
+	const char* end;
+	bool ok;
+};
+
+bool writeTilePack(const RoadGraph& g, const string& file, int nodesPerTile)
+{
+	if (nodesPerTile <= 0)
+		return false;
+
+	int n = g.numNodes();
+	int numTiles = (n + nodesPerTile - 1) / nodesPerTile;
+	vector<string> blobs(numTiles);
+	string dir;
+
+	for (int t = 0; t < numTiles; t++)
+	{
+		int first = t * nodesPerTile;
+		int count = min(nodesPerTile, n - first);
+		string& blob = blobs[t];
+
+		const vector<double>& lat = g.coords.latDeg;
+		const vector<double>& lon = g.coords.lonDeg;
+		double minLat = lat[first], maxLat = minLat;
+		double minLon = lon[first], maxLon = minLon;
+		for (int x = first; x < first + count; x++)
+		{
+			minLat = min(minLat, lat[x]);
+			maxLat = max(maxLat, lat[x]);
+			minLon = min(minLon, lon[x]);
+			maxLon = max(maxLon, lon[x]);
+			putString(blob, g.nodeIndex->latitudeText(x));
+			putString(blob, g.nodeIndex->longitudeText(x));
+		}
+
+		for (int x = first; x <= first + count; x++)
+			put<int>(blob, g.firstEdge[x] - g.firstEdge[first]);
+		vector<int> boundaryNode, boundaryTile;
+		for (int x = first; x < first + count; x++)
+		{
+			int nodeEntries = boundaryTile.size();
+			for (int e = g.edgesBegin(x); e != g.edgesEnd(x); e++)
+			{
+				put<int>(blob, g.edgeTo[e]);
+				put<int>(blob, g.edgeStreet[e]);
+				put<double>(blob, g.edgeLength[e]);
+				put<double>(blob, g.edgeBearing[e]);
+
+				// one entry per node and neighbouring tile
+				int other = g.edgeTo[e] / nodesPerTile;
+				if (other != t && find(boundaryTile.begin() + nodeEntries, boundaryTile.end(), other) == boundaryTile.end())
+				{
+					boundaryNode.push_back(x - first);
+					boundaryTile.push_back(other);
+				}
+			}
+		}
+		put<int>(blob, boundaryNode.size());
+		for (int i = 0; i < boundaryNode.size(); i++)
+		{
+			put<int>(blob, boundaryNode[i]);
+			put<int>(blob, boundaryTile[i]);
+		}
+		for (int x = first; x < first + count; x++)
+		{
+			put<int>(blob, g.nodeComponent[x]);
+			put<int>(blob, g.nodeIsland[x]);
+		}
+
+		put<int>(dir, first);
+		put<int>(dir, count);
+		put<double>(dir, minLat);
+		put<double>(dir, maxLat);
+		put<double>(dir, minLon);
+		put<double>(dir, maxLon);
+		put<long long>(dir, 0);		// offset and size, filled in below
+		put<long long>(dir, blob.size());
+	}
+
+	string header;
+	put<int>(header, nodesPerTile);
+	put<int>(header, numTiles);
+	put<int>(header, g.streetNames.size());
+	for (int s = 0; s < g.streetNames.size(); s++)
+		putString(header, g.streetNames[s]);
+
+	// every node's parsed coordinate, so the cache finds a point's tile by
+	// binary search instead of decoding tiles whose boxes hold it
+	vector<TileKey> sorted(n);
+	for (int x = 0; x < n; x++)
+		sorted[x] = TileKey{ g.coords.latDeg[x], g.coords.lonDeg[x], x / nodesPerTile };
+	sort(sorted.begin(), sorted.end());
+	string keys;
+	put<int>(keys, n);
+	for (const TileKey& k : sorted)
+	{
+		put<double>(keys, k.lat);
+		put<double>(keys, k.lon);
+		put<int>(keys, k.tile);
+	}
+
+	// each directory entry is 56 bytes, with the offset 16 bytes from its end
+	long long offset = sizeof(TILES_MAGIC) + sizeof(long long) + header.size() + dir.size() + keys.size();
+	for (int t = 0; t < numTiles; t++)
+	{
+		memcpy(&dir[56 * t + 40], &offset, sizeof(offset));
+		offset += blobs[t].size();
+	}
+	header += dir;
+	header += keys;
+
+	ofstream out(file, ios::binary);
+	if (!out)
+		return false;
+	long long headerBytes = sizeof(TILES_MAGIC) + sizeof(long long) + header.size();
+	out.write(TILES_MAGIC, sizeof(TILES_MAGIC));
+	out.write(reinterpret_cast<const char*>(&headerBytes), sizeof(headerBytes));
+	out.write(header.data(), header.size());
+	for (int t = 0; t < numTiles; t++)
+		out.write(blobs[t].data(), blobs[t].size());
+	return (bool)out;
+}
+
+//******************** TileUse ************************************************
+
+TileUse::TileUse(int numTiles)
+ : clock(1), last(new atomic<unsigned long long>[numTiles]), holds(new atomic<int>[numTiles]), overBudget(false)
+{
+	for (int t = 0; t < numTiles; t++)
+	{
+		last[t].store(0, memory_order_relaxed);
+		holds[t].store(0, memory_order_relaxed);
+	}
+}
+
+//******************** TilePins ***********************************************
+
+// The cache only reads the holds with its lock taken, which the holder's next
+// request also takes, so a tile evicted before it was held is back by then.
+void TilePins::hold(const shared_ptr<TileUse>& use, const vector<int>& tiles)
+{
+	if (use == nullptr)
+		return;
+	if (use != m_use)		// another pack
+	{
+		release();
+		m_use = use;
+	}
+
+	vector<int> wanted = tiles;
+	sort(wanted.begin(), wanted.end());
+	wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+	vector<int> added;
+	set_difference(wanted.begin(), wanted.end(), m_tiles.begin(), m_tiles.end(), back_inserter(added));
+	if (added.empty())
+		return;
+	for (int t : added)
+		m_use->holds[t].fetch_add(1, memory_order_relaxed);
+	size_t middle = m_tiles.size();
+	m_tiles.insert(m_tiles.end(), added.begin(), added.end());
+	inplace_merge(m_tiles.begin(), m_tiles.begin() + middle, m_tiles.end());
+}
+
+void TilePins::hold(const RoadGraph& g, const vector<int>& tiles)
+{
+	hold(g.tileUse, tiles);
+}
+
+void TilePins::release()
+{
+	for (int t : m_tiles)
+		m_use->holds[t].fetch_sub(1, memory_order_relaxed);
+	m_tiles.clear();
+	m_use.reset();
+}
+
+//******************** TileCache **********************************************
+
+// The pack file, mapped into memory where possible so a tile costs nothing
+// until it is decoded and the OS can drop its pages afterwards.
+class TileCache::PackFile
+{
+public:
+	PackFile()
+	{
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	~PackFile()
+	{
+#ifndef TILES_READ
+		if (m_data != nullptr)
+			munmap(const_cast<char*>(m_data), m_size);
+#endif
+	}
+
+	bool open(const string& file)
+	{
+#ifdef TILES_READ
+		m_in.open(file, ios::binary | ios::ate);
+		if (!m_in)
+			return false;
+		m_size = m_in.tellg();
+		return true;
+#else
+		int fd = ::open(file.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+		void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);		// the mapping keeps the file open
+		if (p == MAP_FAILED)
+			return false;
+		m_data = static_cast<const char*>(p);
+		m_size = st.st_size;
+		return true;
+#endif
+	}
+
+	long long size() const { return m_size; }
+
+	// The bytes [offset, offset + bytes) of the file: straight from the
+	// mapping, or read into buffer.  Null if out of range.
+	const char* view(long long offset, long long bytes, vector<char>& buffer)
+	{
+		if (offset < 0 || bytes < 0 || offset + bytes > m_size)
+			return nullptr;
+#ifdef TILES_READ
+		buffer.resize(bytes);
+		m_in.clear();
+		m_in.seekg(offset);
+		if (!m_in.read(buffer.data(), bytes))
+			return nullptr;
+		return buffer.data();
+#else
+		(void)buffer;	// only the read path fills it
+		return m_data + offset;
+#endif
+	}
+
+private:
+	const char* m_data;
+	long long m_size;
+#ifdef TILES_READ
+	ifstream m_in;
+#endif
+};
+
+TileCache::TileCache()
+{
+	m_file = nullptr;
+	m_nodesPerTile = 0;
+	m_components = false;
+	m_numKeys = 0;
+	m_keysOffset = 0;
+	m_budget = 0;
+	m_residentBytes = 0;
+}
+
+TileCache::~TileCache()
+{
+	delete m_file;
+}
+
+bool TileCache::open(const string& file, size_t budgetBytes)
+{
+	PackFile* pack = new PackFile;
+	vector<char> buffer;
+	long long headerBytes = 0;
+	const char* start = pack->open(file) ? pack->view(0, sizeof(TILES_MAGIC) + sizeof(long long), buffer) : nullptr;
+	bool keyed = start != nullptr && equal(start, start + sizeof(TILES_MAGIC), TILES_MAGIC);
+	bool components = keyed || (start != nullptr && equal(start, start + sizeof(TILES_MAGIC_2), TILES_MAGIC_2));
+	if (start == nullptr || (!components && !equal(start, start + sizeof(TILES_MAGIC_1), TILES_MAGIC_1)))
+	{
+		delete pack;
+		return false;
+	}
+	memcpy(&headerBytes, start + sizeof(TILES_MAGIC), sizeof(headerBytes));
+
+	const char* header = pack->view(0, headerBytes, buffer);
+	PackReader in(header, header + headerBytes);
+	in.p += sizeof(TILES_MAGIC) + sizeof(long long);
+	int nodesPerTile = in.get<int>();
+	int numTiles = in.get<int>();
+	int numStreets = in.get<int>();
+	vector<string> streets;
+	for (int s = 0; s < numStreets && in.ok; s++)
+		streets.push_back(in.getString());
+
+	vector<DirEntry> dir;
+	for (int t = 0; t < numTiles && in.ok; t++)
+	{
+		DirEntry d;
+		d.firstNode = in.get<int>();
+		d.numNodes = in.get<int>();
+		d.minLat = in.get<double>();
+		d.maxLat = in.get<double>();
+		d.minLon = in.get<double>();
+		d.maxLon = in.get<double>();
+		d.offset = in.get<long long>();
+		d.bytes = in.get<long long>();
+		if (d.firstNode != t * nodesPerTile || d.numNodes <= 0 || d.numNodes > nodesPerTile ||
+			d.offset < headerBytes || d.offset + d.bytes > pack->size())
+			in.ok = false;
+		dir.push_back(d);
+	}
+
+	// the key table stays in the file; tileOf searches it there
+	int numKeys = 0;
+	long long keysOffset = 0;
+	if (keyed)
+	{
+		numKeys = in.get<int>();
+		keysOffset = in.p - header;
+		int totalNodes = dir.empty() ? 0 : dir.back().firstNode + dir.back().numNodes;
+		if (numKeys != totalNodes || in.end - in.p < (long long)numKeys * KEY_BYTES)
+			in.ok = false;
+	}
+	if (!in.ok || nodesPerTile <= 0 || numTiles < 0 || numStreets < 0)
+	{
+		delete pack;
+		return false;
+	}
+
+	delete m_file;
+	m_file = pack;
+	m_nodesPerTile = nodesPerTile;
+	m_components = components;
+	m_numKeys = numKeys;
+	m_keysOffset = keysOffset;
+	m_streets.swap(streets);
+	m_dir.swap(dir);
+	m_tiles.clear();
+	m_tiles.resize(m_dir.size());
+	m_use = make_shared<TileUse>(m_dir.size());
+	m_budget = budgetBytes;
+	m_residentBytes = 0;
+	return true;
+}
+
+int TileCache::residentTiles() const
+{
+	int count = 0;
+	for (int t = 0; t < m_tiles.size(); t++)
+		if (m_tiles[t] != nullptr)
+			count++;
+	return count;
+}
+
+void TileCache::reportMemory(MemoryReport& report) const
+{
+	size_t directory = vectorBytes(m_dir) + vectorBytes(m_tiles) + vectorBytes(m_streets);
+	for (const string& s : m_streets)
+		directory += stringBytes(s);
+	report.add("tiles/directory", directory);
+	report.add("tiles/decoded", m_residentBytes);
+}
+
+bool TileCache::decode(int tile, Tile& out)
+{
+	const DirEntry& d = m_dir[tile];
+	vector<char> buffer;
+	const char* blob = m_file->view(d.offset, d.bytes, buffer);
+	PackReader in(blob, blob + d.bytes);
+	int totalNodes = m_dir.empty() ? 0 : m_dir.back().firstNode + m_dir.back().numNodes;
+
+	out.coord.clear();
+	out.coord.reserve(d.numNodes);
+	for (int i = 0; i < d.numNodes && in.ok; i++)
+	{
+		string lat = in.getString();
+		string lon = in.getString();
+		if (in.ok)
+			out.coord.push_back(GeoCoord(lat, lon));
+	}
+
+	out.firstEdge.resize(d.numNodes + 1);
+	for (int i = 0; i <= d.numNodes; i++)
+	{
+		out.firstEdge[i] = in.get<int>();
+		if (out.firstEdge[i] < (i == 0 ? 0 : out.firstEdge[i - 1]))
+			in.ok = false;
+	}
+	if (!in.ok || out.firstEdge[0] != 0)
+		return false;
+
+	int m = out.firstEdge[d.numNodes];
+	out.edgeTo.resize(m);
+	out.edgeStreet.resize(m);
+	out.edgeLength.resize(m);
+	out.edgeBearing.resize(m);
+	for (int e = 0; e < m && in.ok; e++)
+	{
+		out.edgeTo[e] = in.get<int>();
+		out.edgeStreet[e] = in.get<int>();
+		out.edgeLength[e] = in.get<double>();
+		out.edgeBearing[e] = in.get<double>();
+		if (out.edgeTo[e] < 0 || out.edgeTo[e] >= totalNodes || out.edgeStreet[e] < 0 || out.edgeStreet[e] >= m_streets.size())
+			in.ok = false;
+	}
+
+	int numBoundary = in.get<int>();
+	out.boundaryNode.clear();
+	out.boundaryTile.clear();
+	for (int i = 0; i < numBoundary && in.ok; i++)
+	{
+		int node = in.get<int>();
+		int other = in.get<int>();
+		if (node < 0 || node >= d.numNodes || other < 0 || other >= m_dir.size())
+			in.ok = false;
+		out.boundaryNode.push_back(node);
+		out.boundaryTile.push_back(other);
+	}
+
+	out.component.clear();
+	out.island.clear();
+	for (int i = 0; i < d.numNodes && m_components && in.ok; i++)
+	{
+		out.component.push_back(in.get<int>());
+		out.island.push_back(in.get<int>());
+	}
+	if (!in.ok)
+		return false;
+
+	out.bytes = sizeof(Tile) + out.coord.capacity() * sizeof(GeoCoord) +
+		(out.firstEdge.capacity() + out.edgeTo.capacity() + out.edgeStreet.capacity() +
+		 out.boundaryNode.capacity() + out.boundaryTile.capacity() + out.component.capacity() + out.island.capacity()) * sizeof(int) +
+		(out.edgeLength.capacity() + out.edgeBearing.capacity()) * sizeof(double);
+	return true;
+}
+
+bool TileCache::makeResident(int tile)
+{
+	if (m_tiles[tile] != nullptr)
+		return false;
+
+	unique_ptr<Tile> t(new Tile);
+	if (!decode(tile, *t))
+		return false;
+	m_residentBytes += t->bytes;
+	m_tiles[tile] = move(t);
+	return true;
+}
+
+// Entry i of the pack's key table; false if the pack can't be read there
+bool TileCache::key(int i, TileKey& k) const
+{
+	vector<char> buffer;
+	const char* p = m_file->view(m_keysOffset + (long long)i * KEY_BYTES, KEY_BYTES, buffer);
+	if (p == nullptr)
+		return false;
+	memcpy(&k.lat, p, sizeof(double));
+	memcpy(&k.lon, p + sizeof(double), sizeof(double));
+	memcpy(&k.tile, p + 2 * sizeof(double), sizeof(int));
+	return true;
+}
+
+// Whether tile t has g among its nodes, made resident to find out; a tile
+// loaded only to be looked in is dropped again if g is not there.
+bool TileCache::tileHas(int t, const GeoCoord& g, bool& loaded)
+{
+	bool wasResident = m_tiles[t] != nullptr;
+	if (!wasResident && !makeResident(t))
+		return false;
+	const vector<GeoCoord>& coord = m_tiles[t]->coord;
+	if (find(coord.begin(), coord.end(), g) != coord.end())
+	{
+		loaded = loaded || !wasResident;
+		return true;
+	}
+	if (!wasResident)
+	{
+		m_residentBytes -= m_tiles[t]->bytes;
+		m_tiles[t].reset();
+	}
+	return false;
+}
+
+// The tile whose nodes include g, made resident; -1 if there is none.  The
+// key table names the tiles with a node at g's numbers, usually one; text
+// that parses to the same numbers is a different node, so each is looked in.
+// Packs without the table are searched by bounding box, and tiles' boxes
+// overlap, so that may have to look in several.
+int TileCache::tileOf(const GeoCoord& g, bool& loaded)
+{
+	if (m_numKeys > 0)
+	{
+		int lo = 0;
+		int hi = m_numKeys;
+		while (lo < hi)
+		{
+			int mid = lo + (hi - lo) / 2;
+			TileKey k;
+			if (!key(mid, k))
+				return -1;
+			if (k.lat < g.latitude || (k.lat == g.latitude && k.lon < g.longitude))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (int i = lo; i < m_numKeys; i++)
+		{
+			TileKey k;
+			if (!key(i, k) || k.lat != g.latitude || k.lon != g.longitude)
+				break;
+			if (k.tile >= 0 && k.tile < m_dir.size() && tileHas(k.tile, g, loaded))
+				return k.tile;
+		}
+		return -1;
+	}
+
+	for (int t = 0; t < m_dir.size(); t++)
+	{
+		const DirEntry& d = m_dir[t];
+		if (g.latitude < d.minLat || g.latitude > d.maxLat || g.longitude < d.minLon || g.longitude > d.maxLon)
+			continue;
+		if (tileHas(t, g, loaded))
+			return t;
+	}
+	return -1;
+}
+
+// Drops the least recently used tiles, other than those in keep and those a
+// query holds, until the resident tiles fit the budget.  Returns true if it
+// dropped any.
+bool TileCache::evict(const vector<bool>& keep)
+{
+	bool evicted = false;
+	while (m_residentBytes > m_budget)
+	{
+		int victim = -1;
+		unsigned long long oldest = 0;
+		for (int t = 0; t < m_tiles.size(); t++)
+		{
+			if (m_tiles[t] == nullptr || keep[t] || m_use->holds[t].load(memory_order_relaxed) > 0)
+				continue;
+			unsigned long long used = m_use->last[t].load(memory_order_relaxed);
+			if (victim == -1 || used < oldest)
+			{
+				victim = t;
+				oldest = used;
+			}
+		}
+		if (victim == -1)
+			break;		// everything left is needed now
+		m_residentBytes -= m_tiles[victim]->bytes;
+		m_tiles[victim].reset();
+		evicted = true;
+	}
+	m_use->overBudget.store(m_residentBytes > m_budget, memory_order_relaxed);
+	return evicted;
+}
+
+bool TileCache::trim(shared_ptr<RoadGraph>& next)
+{
+	if (!evict(vector<bool>(m_dir.size(), false)))
+		return false;
+	next = make_shared<RoadGraph>();
+	assemble(*next);
+	return true;
+}
+
+bool TileCache::require(const vector<GeoCoord>& coords, bool beyond, const RoadGraph& current, shared_ptr<RoadGraph>& next, TilePins* hold)
+{
+	m_use->clock.fetch_add(1, memory_order_relaxed);
+	vector<bool> keep(m_dir.size(), false);
+	bool loaded = false;
+
+	// the caller's tiles evicted just before it came to hold them; other
+	// queries' come back with their own next request
+	if (hold != nullptr && hold->use() == m_use)
+		for (int t : hold->tiles())
+			loaded = makeResident(t) || loaded;
+
+	for (int i = 0; i < coords.size(); i++)
+	{
+		const GeoCoord& g = coords[i];
+		int t;
+		int node = current.findNode(g);
+		if (node != -1 && !current.nodeTile.empty())
+		{
+			// on a tile the caller has, though it may have been evicted since
+			t = current.nodeTile[node];
+			loaded = makeResident(t) || loaded;
+		}
+		else
+		{
+			t = tileOf(g, loaded);
+			if (t == -1)
+				continue;
+		}
+		keep[t] = true;
+		m_use->touch(t);
+
+		if (!beyond || m_tiles[t] == nullptr)
+			continue;
+		const Tile& tile = *m_tiles[t];
+		int local = find(tile.coord.begin(), tile.coord.end(), g) - tile.coord.begin();
+		for (int b = 0; b < tile.boundaryNode.size(); b++)
+		{
+			if (tile.boundaryNode[b] != local)
+				continue;
+			int other = tile.boundaryTile[b];
+			loaded = makeResident(other) || loaded;
+			keep[other] = true;
+			m_use->touch(other);
+		}
+	}
+
+	if (hold != nullptr)
+	{
+		vector<int> kept;
+		for (int t = 0; t < keep.size(); t++)
+			if (keep[t])
+				kept.push_back(t);
+		hold->hold(m_use, kept);
+	}
+
+	bool evicted = evict(keep);
+	if (!loaded && !evicted)
+		return false;
+
+	next = make_shared<RoadGraph>();
+	assemble(*next);
+	return true;
+}
+
+// A RoadGraph of the resident tiles, in tile order so nodes keep the pack's
+// Hilbert order.  Edges into tiles that are not resident are left out and
+// their start nodes marked as frontier.
+void TileCache::assemble(RoadGraph& g) const
+{
+	int numTiles = m_dir.size();
+	vector<int> base(numTiles, -1);
+	int n = 0, m = 0;
+	for (int t = 0; t < numTiles; t++)
+	{
+		if (m_tiles[t] == nullptr)
+			continue;
+		base[t] = n;
+		n += m_tiles[t]->coord.size();
+		m += m_tiles[t]->edgeTo.size();
+	}
+
+	g.streetNames = m_streets;
+	g.coords.reserve(n);
+	g.nodeIndex->reserve(n);
+	g.nodeTile.reserve(n);
+	g.nodeFrontier.assign(n, 0);
+	if (m_components)
+	{
+		g.nodeComponent.reserve(n);
+		g.nodeIsland.reserve(n);
+	}
+	g.firstEdge.reserve(n + 1);
+	g.edgeFrom.reserve(m);
+	g.edgeTo.reserve(m);
+	g.edgeLength.reserve(m);
+	g.edgeBearing.reserve(m);
+	g.edgeStreet.reserve(m);
+	g.tileUse = m_use;
+
+	for (int t = 0; t < numTiles; t++)
+	{
+		if (m_tiles[t] == nullptr)
+			continue;
+		const Tile& tile = *m_tiles[t];
+		for (int i = 0; i < tile.coord.size(); i++)
+		{
+			int node = base[t] + i;
+			g.coords.add(tile.coord[i]);
+			g.nodeIndex->add(tile.coord[i], node);
+			g.nodeTile.push_back(t);
+			if (m_components)
+			{
+				g.nodeComponent.push_back(tile.component[i]);
+				g.nodeIsland.push_back(tile.island[i]);
+			}
+			g.firstEdge.push_back(g.edgeTo.size());
+
+			for (int e = tile.firstEdge[i]; e < tile.firstEdge[i + 1]; e++)
+			{
+				int to = tile.edgeTo[e];
+				int other = to / m_nodesPerTile;
+				if (base[other] == -1)
+				{
+					g.nodeFrontier[node] = 1;
+					continue;
+				}
+				g.edgeFrom.push_back(node);
+				g.edgeTo.push_back(base[other] + to - m_dir[other].firstNode);
+				g.edgeLength.push_back(tile.edgeLength[e]);
+				g.edgeBearing.push_back(tile.edgeBearing[e]);
+				g.edgeStreet.push_back(tile.edgeStreet[e]);
+			}
+		}
+	}
+	g.firstEdge.push_back(g.edgeTo.size());
+
+	g.buildChains();
+}
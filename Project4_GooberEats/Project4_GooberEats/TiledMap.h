@@ -0,0 +1,178 @@
+// TiledMap.h
+// A map cut into geographic tiles and stored in one pack file, so a process
+// can open maps covering several regions and keep in memory only the tiles
+// its queries use.
+//
+// writeTilePack cuts a loaded map into tiles of consecutive node IDs; as load
+// numbers nodes along a Hilbert curve, each tile covers a compact patch of
+// ground.  Every tile carries a boundary table: its nodes with an edge into
+// another tile, and which tile that is.  It also carries its nodes' component
+// labels in the whole map, so a query with no route fails once its end points'
+// tiles are in, not after loading every tile it can reach.  The pack's header
+// ends with a key table, every node's coordinate and tile in sorted order,
+// which the cache searches in the file to find the tile a point is on.
+//
+// TileCache is what StreetMap::loadTiles opens.  The pack is memory-mapped
+// (read in pieces where mmap is unavailable) and a tile is decoded the first
+// time a query needs it.  Once decoded tiles take more than the memory budget,
+// the least recently used are dropped.  Every change to the resident set is
+// built into a RoadGraph of just those tiles and published as a new version
+// of the map, as edits are (see StreetMap::applyEdits).  Node IDs are then
+// only meaningful within one version.  A node with an edge into a tile that
+// is not resident is a frontier node; the router asks for the tiles beyond
+// any it settles and searches again.  A query holds the tiles it has
+// crossed (see TilePins), so they are not evicted before it finishes, even
+// if that takes the cache over budget; once it lets go, StreetMap::releaseTiles
+// brings the cache back within the budget.
+
+#ifndef TiledMap_h
+#define TiledMap_h
+
+#include "provided.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstddef>
+
+struct RoadGraph;
+struct TileKey;
+
+// Writes g as a pack of tiles of nodesPerTile nodes each.
+bool writeTilePack(const RoadGraph& g, const std::string& file, int nodesPerTile);
+
+// When each tile was last used, for choosing what to evict.  Shared by the
+// cache and every version it publishes, so queries can mark the tiles they
+// use without taking the cache's lock.
+struct TileUse
+{
+	explicit TileUse(int numTiles);
+
+	void touch(int tile)
+	{
+		unsigned long long now = clock.load(std::memory_order_relaxed);
+		if (last[tile].load(std::memory_order_relaxed) != now)	// keep hot tiles' lines shared
+			last[tile].store(now, std::memory_order_relaxed);
+	}
+
+	std::atomic<unsigned long long> clock;		// advanced by the cache on every request
+	std::unique_ptr<std::atomic<unsigned long long>[]> last;
+	// how many queries hold each tile; a held tile is never evicted, and is
+	// brought back by its holder's next request if it was evicted before
+	// being held
+	std::unique_ptr<std::atomic<int>[]> holds;
+	// set by the cache while held tiles keep it over its budget, so a query
+	// letting go of its tiles knows to trim it
+	std::atomic<bool> overBudget;
+};
+
+// Tiles a query depends on, held resident until it lets go, over the memory
+// budget if need be.  The router holds the tiles each of its searches
+// crossed while it brings in the tiles beyond, so a query's rounds only ever
+// add to what it has; a planner holds its legs' tiles for the whole plan
+// (see RouteOptions::tiles).
+class TilePins
+{
+public:
+	TilePins() {}
+	~TilePins() { release(); }
+
+	// Holds these tiles of g's pack, each once however often named;
+	// nothing for a map that isn't tiled
+	void hold(const RoadGraph& g, const std::vector<int>& tiles);
+	void hold(const std::shared_ptr<TileUse>& use, const std::vector<int>& tiles);
+	void release();
+
+	const std::shared_ptr<TileUse>& use() const { return m_use; }
+	const std::vector<int>& tiles() const { return m_tiles; }
+
+	TilePins(const TilePins&) = delete;
+	TilePins& operator=(const TilePins&) = delete;
+
+private:
+	std::shared_ptr<TileUse> m_use;
+	std::vector<int> m_tiles;	// held, in order
+};
+
+class TileCache
+{
+public:
+	TileCache();
+	~TileCache();
+
+	// Opens a pack and reads its directory; no tile is decoded yet.  Not
+	// thread-safe: StreetMap calls these with its write lock held.
+	bool open(const std::string& file, std::size_t budgetBytes);
+
+	// Makes resident the tiles holding coords and, with beyond set, the
+	// tiles the boundary edges of those (resident) nodes lead into.  current
+	// is the version the caller was using.  The tiles are added to hold,
+	// if given, and any hold already had that were evicted before it took
+	// them are brought back.  Returns true, with next set to a new version,
+	// if the resident set changed.
+	bool require(const std::vector<GeoCoord>& coords, bool beyond, const RoadGraph& current, std::shared_ptr<RoadGraph>& next,
+		TilePins* hold = nullptr);
+	// Evicts tiles no query holds until the resident ones fit the budget.
+	// Returns true, with next set to a new version, if any went.
+	bool trim(std::shared_ptr<RoadGraph>& next);
+
+	// Fills an empty graph with the resident tiles, as a new version
+	void assemble(RoadGraph& g) const;
+
+	int numTiles() const { return (int)m_dir.size(); }
+	int residentTiles() const;
+	std::size_t residentBytes() const { return m_residentBytes; }
+	// the directory and the decoded tiles, under "tiles/"
+	void reportMemory(MemoryReport& report) const;
+
+	TileCache(const TileCache&) = delete;
+	TileCache& operator=(const TileCache&) = delete;
+
+private:
+	struct Tile
+	{
+		std::vector<GeoCoord> coord;
+		std::vector<int> firstEdge;	// local, coord.size() + 1 entries
+		std::vector<int> edgeTo;	// global node IDs, as in the pack
+		std::vector<int> edgeStreet;
+		std::vector<double> edgeLength;
+		std::vector<double> edgeBearing;
+		std::vector<int> boundaryNode;	// local
+		std::vector<int> boundaryTile;
+		std::vector<int> component;	// empty for packs without components
+		std::vector<int> island;
+		std::size_t bytes;
+	};
+
+	struct DirEntry
+	{
+		int firstNode;
+		int numNodes;
+		double minLat, maxLat, minLon, maxLon;
+		long long offset;
+		long long bytes;
+	};
+
+	class PackFile;
+
+	PackFile* m_file;
+	int m_nodesPerTile;
+	bool m_components;		// the pack has component labels
+	int m_numKeys;			// 0 for packs without a key table
+	long long m_keysOffset;		// where in the file the key table starts
+	std::vector<std::string> m_streets;
+	std::vector<DirEntry> m_dir;
+	std::vector<std::unique_ptr<Tile>> m_tiles;	// null unless resident
+	std::shared_ptr<TileUse> m_use;
+	std::size_t m_budget;
+	std::size_t m_residentBytes;
+
+	bool decode(int tile, Tile& out);
+	bool makeResident(int tile);
+	bool key(int i, TileKey& k) const;
+	bool tileHas(int t, const GeoCoord& g, bool& loaded);
+	int tileOf(const GeoCoord& g, bool& loaded);
+	bool evict(const std::vector<bool>& keep);
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "Trace.h"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <mutex>
+#include <memory>
+using namespace std;
+
+#ifdef GOOBER_TRACE
+
+namespace
+{
+	struct TraceEvent
+	{
+		const char* name;
+		long long start;	// ns
+		long long duration;	// ns
+	};
+
+	// A thread's spans.  Buffers belong to the registry rather than to their
+	// thread, so spans from threads that have exited can still be written.
+	struct TraceBuffer
+	{
+		int tid;
+		vector<TraceEvent> events;
+		long long dropped;
+	};
+
+	// stop recording on a thread past this many spans rather than grow forever
+	const size_t MAX_EVENTS_PER_THREAD = 1 << 22;
+
+	mutex registryLock;
+	vector<unique_ptr<TraceBuffer>> registry;
+	const chrono::steady_clock::time_point traceStart = chrono::steady_clock::now();
+	thread_local TraceBuffer* threadBuffer = nullptr;
+
+	long long nowNs()
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - traceStart).count();
+	}
+
+	TraceBuffer* buffer()
+	{
+		if (threadBuffer == nullptr)
+		{
+			lock_guard<mutex> lock(registryLock);
+			registry.push_back(unique_ptr<TraceBuffer>(new TraceBuffer));
+			threadBuffer = registry.back().get();
+			threadBuffer->tid = registry.size();
+			threadBuffer->dropped = 0;
+			threadBuffer->events.reserve(4096);
+		}
+		return threadBuffer;
+	}
+}
+
+TraceSpan::TraceSpan(const char* name)
+{
+	m_name = name;
+	m_start = nowNs();
+}
+
+void TraceSpan::end()
+{
+	if (m_name == nullptr)
+		return;
+
+	TraceEvent e;
+	e.name = m_name;
+	e.start = m_start;
+	e.duration = nowNs() - m_start;
+	m_name = nullptr;
+
+	TraceBuffer* b = buffer();
+	if (b->events.size() < MAX_EVENTS_PER_THREAD)
+		b->events.push_back(e);
+	else
+		b->dropped++;
+}
+
+bool traceEnabled()
+{
+	return true;
+}
+
+bool traceWrite(string file)
+{
+	ofstream out(file);
+	if (!out)
+		return false;
+
+	lock_guard<mutex> lock(registryLock);
+	out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+	bool first = true;
+	char line[256];
+	for (const auto& b : registry)
+	{
+		// complete ("X") events, in microseconds; spans on one thread nest by time
+		for (const TraceEvent& e : b->events)
+		{
+			snprintf(line, sizeof(line), "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+				first ? "" : ",", e.name, b->tid, e.start / 1000.0, e.duration / 1000.0);
+			out << line;
+			first = false;
+		}
+		if (b->dropped > 0)
+		{
+			snprintf(line, sizeof(line), "%s\n{\"name\": \"dropped spans\", \"ph\": \"C\", \"pid\": 1, \"tid\": %d, \"ts\": 0, \"args\": {\"count\": %lld}}",
+				first ? "" : ",", b->tid, b->dropped);
+			out << line;
+			first = false;
+		}
+	}
+	out << "\n]}\n";
+	return (bool)out;
+}
+
+void traceClear()
+{
+	lock_guard<mutex> lock(registryLock);
+	for (const auto& b : registry)
+	{
+		b->events.clear();
+		b->dropped = 0;
+	}
+}
+
+#else
+
+bool traceEnabled()
+{
+	return false;
+}
+
+bool traceWrite(string)
+{
+	return false;
+}
+
+void traceClear()
+{
+}
+
+#endif
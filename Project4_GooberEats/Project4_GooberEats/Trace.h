@@ -0,0 +1,60 @@
+// Trace.h
+// Scoped timing spans written out in Chrome's trace-event format, for loading
+// into chrome://tracing or Perfetto.  Spans are only recorded when the program
+// is compiled with GOOBER_TRACE defined; otherwise TraceSpan is empty and
+// compiles away.
+//
+//	TraceSpan span("route");		// ends when span goes out of scope
+//	TraceSpan parse("load/parse");
+//	...
+//	parse.end();				// or ends early
+//
+// Span names must be string literals (only the pointer is kept).  Each thread
+// records into its own buffer, so tracing takes no locks after a thread's
+// first span.
+
+#ifndef Trace_h
+#define Trace_h
+
+#include <string>
+
+#ifdef GOOBER_TRACE
+
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char* name);
+	~TraceSpan() { end(); }
+	void end();
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* m_name;
+	long long m_start;	// ns since tracing started
+};
+
+#else
+
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char*) {}
+	void end() {}
+};
+
+#endif
+
+// Whether spans are being recorded: true only in a GOOBER_TRACE build
+bool traceEnabled();
+
+// Writes every thread's spans so far as a Chrome trace-event JSON file and
+// returns false if it can't be written.  Call it while no traced code is
+// running.
+bool traceWrite(std::string file);
+
+// Discards every recorded span; likewise only while no traced code is running
+void traceClear();
+
+#endif
@@ -1,13 +1,13 @@
 #include "provided.h"
+#include "Trace.h"
+#include "RequestReader.h"
+#include "MemoryReport.h"
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
 #include <vector>
 using namespace std;
 
 bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v);
-bool parseDelivery(string line, string& lat, string& lon, string& item);
 
 //int main()
 //{
@@ -26,9 +26,12 @@ bool parseDelivery(string line, string& lat, string& lon, string& item);
 
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    // --memory prints what the map, and then the searches and the plan,
+    // hold in memory to cerr
+    bool memory = argc == 4 && string(argv[3]) == "--memory";
+    if (argc != 3 && !memory)
     {
-        cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt" << endl;
+        cout << "Usage: " << argv[0] << " mapdata.txt deliveries.txt [--memory]" << endl;
         return 1;
     }
 
@@ -39,6 +42,13 @@ int main(int argc, char *argv[])
         cout << "Unable to load map data file " << argv[1] << endl;
         return 1;
     }
+    MemoryReport report;
+    if (memory)
+    {
+        sm.reportMemory(report);
+        cerr << "Memory after load:" << endl;
+        report.print(cerr);
+    }
 
     GeoCoord depot;
     vector<DeliveryRequest> deliveries;
@@ -54,6 +64,17 @@ int main(int argc, char *argv[])
     vector<DeliveryCommand> dcs;
     double totalMiles;
     DeliveryResult result = dp.generateDeliveryPlan(depot, deliveries, dcs, totalMiles);
+    if (memory)
+    {
+        report.clear();
+        sm.reportMemory(report);
+        reportSearchMemory(report);
+        reportMemory(dcs, report);
+        cerr << "Memory after planning:" << endl;
+        report.print(cerr);
+    }
+    if (traceEnabled() && traceWrite("trace.json"))
+        cerr << "Trace written to trace.json" << endl;
     if (result == BAD_COORD)
     {
         cout << "One or more depot or delivery coordinates are invalid." << endl;
@@ -75,43 +96,15 @@ int main(int argc, char *argv[])
 
 bool loadDeliveryRequests(string deliveriesFile, GeoCoord& depot, vector<DeliveryRequest>& v)
 {
-    ifstream inf(deliveriesFile);
-    if (!inf)
+    RequestReader reader;
+    if (!reader.open(deliveriesFile))
         return false;
-    string lat;
-    string lon;
-    inf >> lat >> lon;
-    inf.ignore(10000, '\n');
-    depot = GeoCoord(lat, lon);
-    string line;
-    while (getline(inf, line))
-    {
-        string item;
-        if (parseDelivery(line, lat, lon, item))
-            v.push_back(DeliveryRequest(item, GeoCoord(lat, lon)));
-    }
-    return true;
-}
-
-bool parseDelivery(string line, string& lat, string& lon, string& item)
-{
-    const size_t colon = line.find(':');
-    if (colon == string::npos)
-    {
-        cout << "Missing colon in deliveries file line: " << line << endl;
-        return false;
-    }
-    istringstream iss(line.substr(0, colon));
-    if (!(iss >> lat >> lon))
-    {
-        cout << "Bad format in deliveries file line: " << line << endl;
-        return false;
-    }
-    item = line.substr(colon + 1);
-    if (item.empty())
-    {
-        cout << "Missing item in deliveries file line: " << line << endl;
-        return false;
-    }
+    reader.onBadLine([](const string& line, const char* problem) {
+        cout << problem << " in deliveries file line: " << line << endl;
+    });
+    depot = reader.depot();
+    vector<DeliveryRequest> batch;
+    while (reader.next(batch, 1024))
+        v.insert(v.end(), batch.begin(), batch.end());
     return true;
 }
@@ -8,10 +8,22 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <memory>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <future>
 
 enum DeliveryResult
 {
-    DELIVERY_SUCCESS, NO_ROUTE, BAD_COORD
+    DELIVERY_SUCCESS, NO_ROUTE, BAD_COORD,
+    TIMED_OUT,      // RouteOptions::deadline passed before an answer was found
+    CANCELLED,      // RouteOptions::cancel was cancelled first
+    INCOMPLETE_MAP, // a tiled map couldn't bring in every tile the route may
+                    // cross, or they aren't in the version RouteOptions::graph
+                    // names; a later version may have them
+    STALE_WEIGHTS   // RouteOptions::weights was customized for another version
+                    // of the map; customize() it again
 };
 
 struct GeoCoord
@@ -20,6 +32,11 @@ struct GeoCoord
      : latitudeText(lat), longitudeText(lon), latitude(std::stod(lat)), longitude(std::stod(lon))
     {}
 
+      // for readers that have parsed the text already
+    GeoCoord(std::string lat, std::string lon, double latValue, double lonValue)
+     : latitudeText(std::move(lat)), longitudeText(std::move(lon)), latitude(latValue), longitude(lonValue)
+    {}
+
     GeoCoord()
      : latitudeText("0"), longitudeText("0"), latitude(0), longitude(0)
     {}
@@ -72,7 +89,47 @@ bool operator==(const StreetSegment& lhs, const StreetSegment& rhs)
 }
 
 class StreetMapImpl;
+struct RoadGraph;
+class MemoryReport;
+class TilePins;
+
+  // One change to a loaded map, for StreetMap::applyEdits.  A segment is two
+  // directed edges, as in mapdata.txt, unless oneWay restricts the edit to the
+  // start -> end direction.
+struct MapEdit
+{
+    enum Kind
+    {
+        ADD,        // a new segment on street segment.name; new endpoints become nodes
+        REMOVE,     // delete the segment for good, open or closed
+        CLOSE,      // take the segment out of routing but remember it
+        REOPEN      // put a closed segment back
+    };
+
+    MapEdit(Kind k, const StreetSegment& seg, bool oneWayOnly = false)
+     : kind(k), segment(seg), oneWay(oneWayOnly)
+    {}
 
+    Kind kind;
+      // REMOVE, CLOSE and REOPEN match the edges between these endpoints on
+      // the named street, or on any street if the name is empty
+    StreetSegment segment;
+    bool oneWay;
+};
+
+  // Threading: once load() has returned, a StreetMap and the routers, planners
+  // and optimizers built on it may be used from any number of threads at once
+  // through their const member functions, with no locking.  load() itself must
+  // not overlap any other use of the same map.
+  //
+  // applyEdits() may run alongside all of that.  Each edit batch produces a
+  // new version of the map, published in one atomic pointer swap; a query
+  // works on the version that was current when it started to the end, while
+  // queries starting later see the edit.  Old versions are freed when the
+  // last query using them finishes.  Taking the current version is lock-free
+  // (a hazard pointer, see StreetMap.cpp); it costs an atomic increment and
+  // decrement of a reference count every query of that version shares, and
+  // publishing waits for any query part way through taking the old one.
 class StreetMap
 {
 public:
@@ -80,6 +137,36 @@ public:
     ~StreetMap();
     bool load(std::string mapFile);
     bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+      // The loaded map as an indexed graph (see RoadGraph.h).  This is the
+      // current version, which stays valid only until the next applyEdits();
+      // code that may run alongside edits should hold a snapshot() instead.
+    const RoadGraph& graph() const;
+      // The current version, kept alive and unchanged for as long as the
+      // pointer is held
+    std::shared_ptr<const RoadGraph> snapshot() const;
+      // Applies the edits in order as a single new version.  Returns false,
+      // leaving the map as it was, if an edit names a coordinate that is not
+      // on the map (other than for ADD) or a segment it does not have.
+    bool applyEdits(const std::vector<MapEdit>& edits);
+      // Opens a tile pack written by goober_tile (see TiledMap.h) in place of
+      // a whole map.  Tiles are read as queries reach them, each change to
+      // the tiles in memory being a new version of the map, and the least
+      // recently used are dropped while they take more than budgetBytes.
+      // Edits are not supported on a tiled map.
+    bool loadTiles(std::string packFile, std::size_t budgetBytes);
+      // Tiled maps only: brings in the tiles holding these coordinates and,
+      // with beyond set, the tiles their edges lead into, adding them to hold
+      // if given so they stay resident while it is held (see TiledMap.h).
+      // Returns true if the current version has changed since the caller
+      // last looked.
+    bool loadTilesFor(const std::vector<GeoCoord>& coords, bool beyond, TilePins* hold = nullptr) const;
+      // Lets go of the tiles pins holds and, if holding them had kept more
+      // tiles resident than the budget allows, evicts down to it.  What
+      // routers and planners call when a query is done with its tiles.
+    void releaseTiles(TilePins& pins) const;
+      // Adds what the current version of the map holds to report, part by
+      // part, and for a tiled map the tiles held decoded (see MemoryReport.h)
+    void reportMemory(MemoryReport& report) const;
       // We prevent a StreetMap object from being copied or assigned.
     StreetMap(const StreetMap&) = delete;
     StreetMap& operator=(const StreetMap&) = delete;
@@ -87,6 +174,137 @@ private:
     StreetMapImpl* m_impl;
 };
 
+class EdgeWeightProfile;
+
+  // Shared between a query and whoever may abandon it (see RouteOptions::cancel)
+class CancelToken
+{
+public:
+    CancelToken()
+     : m_cancelled(false)
+    {}
+    void cancel() { m_cancelled.store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return m_cancelled.load(std::memory_order_relaxed); }
+private:
+    std::atomic<bool> m_cancelled;
+};
+
+  // Per-query search settings for PointToPointRouter
+struct RouteOptions
+{
+    RouteOptions()
+     : epsilon(0), weights(nullptr), graph(nullptr),
+       deadline(std::chrono::steady_clock::time_point::max()), cancel(nullptr), tiles(nullptr)
+    {}
+
+      // Weighted A*: the search expands by g + (1 + epsilon) * h and returns a
+      // route at most (1 + epsilon) times as costly as the cheapest one.
+    double epsilon;
+      // Edge costs to minimize instead of distance (see EdgeWeightProfile.h).
+      // The distance travelled is still reported in miles.  The profile must
+      // be customized for the version routed on, or the query fails with
+      // STALE_WEIGHTS rather than quietly routing by distance; a tiled map's
+      // versions are priced by street as the query needs them.
+    const EdgeWeightProfile* weights;
+      // The version of the map to route on, from StreetMap::snapshot() and
+      // kept alive by the caller; null for the current one.  Edge IDs in the
+      // result refer to this version.
+    const RoadGraph* graph;
+      // The search checks these every few hundred nodes and gives up with
+      // TIMED_OUT or CANCELLED, so an abandoned query stops using CPU and a
+      // hard one can't run on without bound.
+    std::chrono::steady_clock::time_point deadline;
+    const CancelToken* cancel;
+      // Tiled maps only: the tiles the search crosses are added to these and
+      // stay resident for as long as the caller holds them, as a planner does
+      // for its legs (see TiledMap.h); null to hold them just for the query.
+    TilePins* tiles;
+};
+
+  // What a PointToPointRouter query actually did
+struct RouteStats
+{
+    RouteStats()
+     : nodesSettled(0), edgesRelaxed(0), heapPushes(0), stalePops(0),
+       hashLookups(0), pathEdges(0), elapsedSeconds(0), gapBound(0), cost(0)
+    {}
+
+    int    nodesSettled;    // nodes taken off the open list for good
+    int    edgesRelaxed;    // edges tried; a whole chain (see RoadGraph.h) counts once
+    int    heapPushes;      // entries added to the open list
+    int    stalePops;       // open list entries skipped as already improved on
+    int    hashLookups;     // reads and writes of the search's per-node table
+    int    pathEdges;       // segments in the route
+    double elapsedSeconds;
+    double gapBound;        // route cost <= (1 + gapBound) * cheapest cost
+    double cost;            // route cost; its length in miles without a profile
+};
+
+  // A route as the edge IDs it follows on one version of the map, which it
+  // keeps alive.  StreetSegments are made only as they are looked at, so a
+  // route costs an int per segment instead of a list node holding two
+  // GeoCoords and a street name.
+class Route
+{
+public:
+    Route()
+     : m_miles(0)
+    {}
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const Route* route, std::size_t i)
+         : m_route(route), m_i(i)
+        {}
+        StreetSegment operator*() const { return m_route->segment(m_i); }
+        const_iterator& operator++() { m_i++; return *this; }
+        const_iterator& operator--() { m_i--; return *this; }
+        bool operator==(const const_iterator& other) const { return m_i == other.m_i; }
+        bool operator!=(const const_iterator& other) const { return m_i != other.m_i; }
+    private:
+        const Route* m_route;
+        std::size_t m_i;
+    };
+
+    std::size_t size() const { return m_edges.size(); }
+    bool empty() const { return m_edges.empty(); }
+    double miles() const { return m_miles; }
+      // The i'th segment in travel order, made from the map on demand
+    StreetSegment segment(std::size_t i) const;
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_edges.size()); }
+      // Edge IDs in travel order, on graph() (see RoadGraph.h)
+    const std::vector<int>& edges() const { return m_edges; }
+    const RoadGraph& graph() const { return *m_graph; }
+      // Appends every segment, for callers that want them all at once
+    void appendTo(std::list<StreetSegment>& segs) const;
+      // Drops the first n segments, as once they have been driven
+    void eraseFront(std::size_t n);
+      // Empties the route but keeps its memory for the next one
+    void clear();
+
+private:
+    friend class PointToPointRouterImpl;
+
+    std::shared_ptr<const RoadGraph> m_graph;
+    std::vector<int> m_edges;
+    double m_miles;
+};
+
+  // What PointToPointRouter::routeAsync delivers
+struct RouteResult
+{
+    RouteResult()
+     : result(NO_ROUTE)
+    {}
+
+    DeliveryResult result;
+    Route route;
+    RouteStats stats;
+};
+
+class RouteExecutor;
 class PointToPointRouterImpl;
 
 class PointToPointRouter
@@ -98,7 +316,34 @@ public:
         const GeoCoord& start,
         const GeoCoord& end,
         std::list<StreetSegment>& route,
-        double& totalDistanceTravelled) const;
+        double& totalDistanceTravelled,
+        const RouteOptions& options = RouteOptions(),
+        RouteStats* stats = nullptr) const;
+      // Same route as a Route, its length being route.miles()
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        Route& route,
+        const RouteOptions& options = RouteOptions(),
+        RouteStats* stats = nullptr) const;
+      // Same route as edge IDs (see RoadGraph.h and RouteOptions::graph), in travel order.
+      // Each calling thread searches in its own scratch memory, which is
+      // kept for its next query, so one router can be shared by every thread.
+    DeliveryResult generatePointToPointRoute(
+        const GeoCoord& start,
+        const GeoCoord& end,
+        std::vector<int>& edges,
+        double& totalDistanceTravelled,
+        const RouteOptions& options = RouteOptions(),
+        RouteStats* stats = nullptr) const;
+      // Queues the query on executor (see RouteExecutor.h) and returns at
+      // once.  The router, and anything options points to, must outlive the
+      // future; give options a deadline or a cancel token to bound the wait.
+    std::future<RouteResult> routeAsync(
+        RouteExecutor& executor,
+        const GeoCoord& start,
+        const GeoCoord& end,
+        const RouteOptions& options = RouteOptions()) const;
       // We prevent a PointToPointRouter object from being copied or assigned.
     PointToPointRouter(const PointToPointRouter&) = delete;
     PointToPointRouter& operator=(const PointToPointRouter&) = delete;
@@ -116,17 +361,30 @@ struct DeliveryRequest
 };
 
 class DeliveryOptimizerImpl;
+class DistanceOracle;
 
 class DeliveryOptimizer
 {
 public:
     DeliveryOptimizer(const StreetMap* sm);
+      // Orders deliveries by road distance from the oracle's hub labels
+      // rather than by crow distance (see DistanceOracle.h)
+    DeliveryOptimizer(const StreetMap* sm, const DistanceOracle* oracle);
     ~DeliveryOptimizer();
     void optimizeDeliveryOrder(
         const GeoCoord& depot,
         std::vector<DeliveryRequest>& deliveries,
         double& oldCrowDistance,
         double& newCrowDistance) const;
+      // Checks a batch before it is planned, without routing: puts in
+      // unreachable the positions in deliveries of those no tour from the
+      // depot can make, being off the map or in a part of it the depot
+      // can't reach or be reached from (see RoadGraph::mayReach).  All of
+      // them if the depot is off the map.  Returns true if there are none.
+    bool validateDeliveries(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        std::vector<int>& unreachable) const;
       // We prevent a DeliveryOptimizer object from being copied or assigned.
     DeliveryOptimizer(const DeliveryOptimizer&) = delete;
     DeliveryOptimizer& operator=(const DeliveryOptimizer&) = delete;
@@ -199,6 +457,9 @@ public:
         return oss.str();
     }
 
+      // What the command's text holds on the heap (see MemoryReport.h)
+    std::size_t heapBytes() const;
+
 private:
     enum CommandType { INVALID, PROCEED, TURN, DELIVER };
     CommandType m_type;        // turn left, turn right, proceed
@@ -208,6 +469,59 @@ private:
     double       m_distance;    // 1.92 (in miles)
 };
 
+  // One leg of a DeliveryPlan: the route from one stop to the next and the
+  // commands that drive it, ending with the delivery made there, if any
+struct DeliveryLeg
+{
+    DeliveryLeg()
+     : deliver(false)
+    {}
+
+    GeoCoord from;
+    GeoCoord to;
+    bool deliver;       // false for the way back to the depot
+    std::string item;
+    Route route;
+    std::vector<DeliveryCommand> commands;
+};
+
+  // A plan kept leg by leg, so DeliveryPlanner::replan can revise it
+struct DeliveryPlan
+{
+    DeliveryPlan()
+     : legsRouted(0)
+    {}
+
+    double miles() const
+    {
+        double total = 0;
+        for (std::size_t i = 0; i < legs.size(); i++)
+            total += legs[i].route.miles();
+        return total;
+    }
+
+    void appendCommands(std::vector<DeliveryCommand>& commands) const
+    {
+        for (std::size_t i = 0; i < legs.size(); i++)
+            commands.insert(commands.end(), legs[i].commands.begin(), legs[i].commands.end());
+    }
+
+    GeoCoord depot;
+    std::vector<DeliveryLeg> legs;
+    int legsRouted;     // legs searched for when the plan was made; the rest were reused
+};
+
+  // What DeliveryPlanner::planAsync delivers
+struct PlanResult
+{
+    PlanResult()
+     : result(NO_ROUTE)
+    {}
+
+    DeliveryResult result;
+    DeliveryPlan plan;
+};
+
 class DeliveryPlannerImpl;
 
 class DeliveryPlanner
@@ -220,6 +534,32 @@ public:
         const std::vector<DeliveryRequest>& deliveries,
         std::vector<DeliveryCommand>& commands,
         double& totalDistanceTravelled) const;
+      // The same plan, kept leg by leg for replan.  Every leg is routed with
+      // options, but on the version of the map the planner chooses; a
+      // deadline or cancel token applies to the plan as a whole.
+    DeliveryResult generateDeliveryPlan(
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        DeliveryPlan& plan,
+        const RouteOptions& options = RouteOptions()) const;
+      // Revises previous for a driver now at position with these deliveries
+      // still to make, in this order, then back to previous.depot.  A leg of
+      // previous made on the current version of the map is reused if it
+      // runs between the same two stops, or from there on if it passes
+      // through position on the way to the same stop; only the other legs
+      // are routed.  deliveries may be empty, for the way back alone.
+    DeliveryResult replan(
+        const DeliveryPlan& previous,
+        const GeoCoord& position,
+        const std::vector<DeliveryRequest>& deliveries,
+        DeliveryPlan& plan,
+        const RouteOptions& options = RouteOptions()) const;
+      // generateDeliveryPlan on executor, as PointToPointRouter::routeAsync
+    std::future<PlanResult> planAsync(
+        RouteExecutor& executor,
+        const GeoCoord& depot,
+        const std::vector<DeliveryRequest>& deliveries,
+        const RouteOptions& options = RouteOptions()) const;
       // We prevent a DeliveryPlanner object from being copied or assigned.
     DeliveryPlanner(const DeliveryPlanner&) = delete;
     DeliveryPlanner& operator=(const DeliveryPlanner&) = delete;
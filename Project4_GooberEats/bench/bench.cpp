@@ -0,0 +1,680 @@
+// bench.cpp
+// Microbenchmarks for the map and its edits, hash map, router, optimizer and planner.
+// Every workload is generated from fixed seeds, so two runs on the same map
+// time the same work and their JSON reports can be diffed directly.
+//
+// usage: goober_bench [--map mapdata.txt] [--out results.json] [--reps N]
+//                     [--filter substring] [--trace trace.json]
+//                     [--metrics metrics.prom] [--memory]
+//
+//   --memory  print what the map holds after loading it, and the map, every
+//             thread's search scratch and a 20-stop plan after the run, by
+//             part (see MemoryReport.h); both go in the JSON report too
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include "Allocators.h"
+#include "RoadGraph.h"
+#include "DistanceOracle.h"
+#include "Trace.h"
+#include "RouteMetrics.h"
+#include "RouteSearch.h"
+#include "MemoryReport.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <memory>
+#include <set>
+using namespace std;
+
+const unsigned int SEED = 20200311;
+
+struct BenchResult
+{
+	string name;
+	long long ops;			// operations per repetition
+	vector<double> nsPerOp;		// one entry per repetition
+	double check;			// sum of results, to catch changes in behaviour
+};
+
+class Bench
+{
+public:
+	Bench(int reps, string filter)
+	 : m_reps(reps), m_filter(filter)
+	{}
+
+	bool wanted(const string& name) const
+	{
+		return m_filter.empty() || name.find(m_filter) != string::npos;
+	}
+
+	// Times body() m_reps times after one warm-up call.  body performs ops
+	// operations and returns a checksum of what they produced.
+	void run(const string& name, long long ops, function<double()> body)
+	{
+		if (!wanted(name))
+			return;
+
+		BenchResult r;
+		r.name = name;
+		r.ops = ops;
+		r.check = body();
+		for (int i = 0; i < m_reps; i++)
+		{
+			auto t0 = chrono::steady_clock::now();
+			double check = body();
+			auto t1 = chrono::steady_clock::now();
+			r.nsPerOp.push_back(chrono::duration<double, nano>(t1 - t0).count() / ops);
+			if (check != r.check)
+				cerr << name << ": result changed between repetitions" << endl;
+		}
+
+		report(r);
+		m_results.push_back(r);
+	}
+
+	// Times a single call, for setup steps too slow to repeat
+	void once(const string& name, function<double()> body)
+	{
+		if (!wanted(name))
+			return;
+
+		BenchResult r;
+		r.name = name;
+		r.ops = 1;
+		auto t0 = chrono::steady_clock::now();
+		r.check = body();
+		auto t1 = chrono::steady_clock::now();
+		r.nsPerOp.push_back(chrono::duration<double, nano>(t1 - t0).count());
+
+		report(r);
+		m_results.push_back(r);
+	}
+
+	// Prints a memory report and keeps it for the JSON, under when
+	void memory(const string& when, const MemoryReport& report)
+	{
+		cerr << "memory " << when << ":" << endl;
+		report.print(cerr);
+		m_memory.push_back(make_pair(when, report));
+	}
+
+	void writeJson(ostream& out, const string& mapFile) const;
+
+private:
+	int m_reps;
+	string m_filter;
+	vector<BenchResult> m_results;
+	vector<pair<string, MemoryReport>> m_memory;
+
+	static void report(const BenchResult& r)
+	{
+		vector<double> v = r.nsPerOp;
+		sort(v.begin(), v.end());
+		cerr.setf(ios::fixed);
+		cerr.precision(1);
+		cerr << r.name << ": " << v[v.size() / 2] << " ns/op (min " << v[0] << ")" << endl;
+	}
+};
+
+static string jsonString(const string& s)
+{
+	string out = "\"";
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+			out += '\\';
+		out += c;
+	}
+	return out + "\"";
+}
+
+void Bench::writeJson(ostream& out, const string& mapFile) const
+{
+	out.precision(17);
+	out << "{\n";
+	out << "  \"map\": " << jsonString(mapFile) << ",\n";
+	out << "  \"reps\": " << m_reps << ",\n";
+	out << "  \"results\": [";
+	for (int i = 0; i < m_results.size(); i++)
+	{
+		const BenchResult& r = m_results[i];
+		vector<double> v = r.nsPerOp;
+		sort(v.begin(), v.end());
+		double mean = 0;
+		for (double x : v)
+			mean += x;
+		mean /= v.size();
+
+		out << (i == 0 ? "\n" : ",\n");
+		out << "    {\"name\": " << jsonString(r.name)
+			<< ", \"ops\": " << r.ops
+			<< ", \"min_ns\": " << v[0]
+			<< ", \"median_ns\": " << v[v.size() / 2]
+			<< ", \"mean_ns\": " << mean
+			<< ", \"max_ns\": " << v.back()
+			<< ", \"check\": " << r.check << "}";
+	}
+	out << "\n  ]";
+
+	// bytes per part, e.g. "memory": {"after_load": {"map/edges": 123, ...}}
+	if (!m_memory.empty())
+	{
+		out << ",\n  \"memory\": {";
+		for (int i = 0; i < m_memory.size(); i++)
+		{
+			out << (i == 0 ? "\n" : ",\n") << "    " << jsonString(m_memory[i].first) << ": {";
+			const auto& parts = m_memory[i].second.parts();
+			for (int j = 0; j < parts.size(); j++)
+				out << (j == 0 ? "" : ", ") << jsonString(parts[j].first) << ": " << parts[j].second;
+			out << "}";
+		}
+		out << "\n  }";
+	}
+	out << "\n}\n";
+}
+
+//******************** workloads **********************************************
+
+static void hashMapBenchmarks(Bench& bench)
+{
+	const int sizes[] = { 1000, 16000, 256000 };
+	const double loads[] = { 0.25, 0.5, 0.75 };
+
+	for (int n : sizes)
+	{
+		// keys spread like real IDs: distinct, in no particular order
+		vector<int> keys(n), missing(n);
+		mt19937 rng(SEED);
+		for (int i = 0; i < n; i++)
+		{
+			keys[i] = 2 * i;
+			missing[i] = 2 * i + 1;
+		}
+		shuffle(keys.begin(), keys.end(), rng);
+		shuffle(missing.begin(), missing.end(), rng);
+
+		for (double load : loads)
+		{
+			ostringstream suffix;
+			suffix << "/n=" << n << "/load=" << load;
+
+			bench.run("hashmap/insert" + suffix.str(), n, [&]() {
+				ExpandableHashMap<int, int> m(load);
+				for (int i = 0; i < n; i++)
+					m.associate(keys[i], i);
+				return (double)m.size();
+			});
+
+			ExpandableHashMap<int, int> m(load);
+			for (int i = 0; i < n; i++)
+				m.associate(keys[i], i);
+
+			bench.run("hashmap/find_hit" + suffix.str(), n, [&]() {
+				double sum = 0;
+				for (int i = 0; i < n; i++)
+					sum += *m.find(keys[i]);
+				return sum;
+			});
+			bench.run("hashmap/find_miss" + suffix.str(), n, [&]() {
+				double found = 0;
+				for (int i = 0; i < n; i++)
+					found += m.find(missing[i]) != nullptr;
+				return found;
+			});
+		}
+	}
+}
+
+// Fills and destroys a map with the given keys, drawing nodes from the policy's
+// allocator: "std" (the heap), "arena" (one arena per map, freed in one go) or
+// "pool" (a node pool per map).
+static double fillAndDrop(const vector<int>& keys, const string& policy)
+{
+	if (policy == "arena")
+	{
+		Arena arena;
+		ExpandableHashMap<int, int, ArenaAllocator<char>> m(0.5, ArenaAllocator<char>(&arena));
+		for (int i = 0; i < keys.size(); i++)
+			m.associate(keys[i], i);
+		return m.size();
+	}
+	if (policy == "pool")
+	{
+		NodePool pool;
+		ExpandableHashMap<int, int, PoolAllocator<char>> m(0.5, PoolAllocator<char>(&pool));
+		for (int i = 0; i < keys.size(); i++)
+			m.associate(keys[i], i);
+		return m.size();
+	}
+	ExpandableHashMap<int, int> m(0.5);
+	for (int i = 0; i < keys.size(); i++)
+		m.associate(keys[i], i);
+	return m.size();
+}
+
+// Allocator policies compared: single maps of several sizes, then many small
+// short-lived maps (the pattern of per-query scratch maps) built on several
+// threads at once, where heap contention shows up.
+static void allocatorBenchmarks(Bench& bench)
+{
+	const string policies[] = { "std", "arena", "pool" };
+	const int sizes[] = { 1000, 16000, 256000 };
+
+	for (int n : sizes)
+	{
+		vector<int> keys(n);
+		for (int i = 0; i < n; i++)
+			keys[i] = 2 * i;
+		shuffle(keys.begin(), keys.end(), mt19937(SEED));
+
+		for (const string& policy : policies)
+			bench.run("hashmap/fill_drop/alloc=" + policy + "/n=" + to_string(n), n, [&]() {
+				return fillAndDrop(keys, policy);
+			});
+	}
+
+	const int MAPS = 200;
+	vector<int> keys(2000);
+	for (int i = 0; i < keys.size(); i++)
+		keys[i] = 2 * i;
+	shuffle(keys.begin(), keys.end(), mt19937(SEED));
+
+	vector<int> threadCounts = { 1 };
+	int cores = thread::hardware_concurrency();
+	if (cores > 1)
+		threadCounts.push_back(cores);
+
+	for (int threads : threadCounts)
+		for (const string& policy : policies)
+			bench.run("hashmap/churn/alloc=" + policy + "/threads=" + to_string(threads), (long long)threads * MAPS, [&]() {
+				vector<double> sums(threads, 0);
+				vector<thread> workers;
+				for (int t = 0; t < threads; t++)
+					workers.push_back(thread([&, t]() {
+						for (int k = 0; k < MAPS; k++)
+							sums[t] += fillAndDrop(keys, policy);
+					}));
+				for (thread& w : workers)
+					w.join();
+				double sum = 0;
+				for (double s : sums)
+					sum += s;
+				return sum;
+			});
+}
+
+// count random map nodes, as coordinates, from a fixed seed
+static vector<GeoCoord> randomNodes(const RoadGraph& g, int count, unsigned int seed)
+{
+	mt19937 rng(seed);
+	uniform_int_distribution<int> pick(0, g.numNodes() - 1);
+	vector<GeoCoord> out;
+	for (int i = 0; i < count; i++)
+		out.push_back(g.coord(pick(rng)));
+	return out;
+}
+
+static void routerBenchmarks(Bench& bench, const StreetMap& sm)
+{
+	const int PAIRS = 200;
+	vector<GeoCoord> from = randomNodes(sm.graph(), PAIRS, SEED);
+	vector<GeoCoord> to = randomNodes(sm.graph(), PAIRS, SEED + 1);
+	PointToPointRouter router(&sm);
+
+	const double epsilons[] = { 0, 0.5 };
+	for (double eps : epsilons)
+	{
+		ostringstream name;
+		name << "router/route/eps=" << eps;
+		RouteOptions options;
+		options.epsilon = eps;
+
+		bench.run(name.str(), PAIRS, [&]() {
+			double sum = 0;
+			for (int i = 0; i < PAIRS; i++)
+			{
+				list<StreetSegment> route;
+				double miles = 0;
+				if (router.generatePointToPointRoute(from[i], to[i], route, miles, options) == DELIVERY_SUCCESS)
+					sum += miles;
+			}
+			return sum;
+		});
+
+		// the same routes as Routes, one reused throughout as the planner does
+		ostringstream compactName;
+		compactName << "router/route_compact/eps=" << eps;
+		bench.run(compactName.str(), PAIRS, [&]() {
+			double sum = 0;
+			Route route;
+			for (int i = 0; i < PAIRS; i++)
+				if (router.generatePointToPointRoute(from[i], to[i], route, options) == DELIVERY_SUCCESS)
+					sum += route.miles();
+			return sum;
+		});
+	}
+}
+
+// pairs with no route between them, found by the component labels, routed
+// with and without the labels to turn them away
+static void noRouteBenchmarks(Bench& bench, const StreetMap& sm)
+{
+	const int PAIRS = 200;
+	shared_ptr<const RoadGraph> g = sm.snapshot();
+	mt19937 rng(SEED);
+	uniform_int_distribution<int> pick(0, g->numNodes() - 1);
+	vector<GeoCoord> from, to;
+	for (int tries = 0; from.size() < PAIRS && tries < 1000 * PAIRS; tries++)
+	{
+		int a = pick(rng), b = pick(rng);
+		if (!g->mayReach(a, b))
+		{
+			from.push_back(g->coord(a));
+			to.push_back(g->coord(b));
+		}
+	}
+	if (from.empty())
+		return;	// the map is all one piece
+
+	RoadGraph unlabelled = *g;
+	unlabelled.nodeComponent.clear();
+	unlabelled.nodeIsland.clear();
+	PointToPointRouter router(&sm);
+	for (int labels = 0; labels <= 1; labels++)
+	{
+		RouteOptions options;
+		options.graph = labels ? g.get() : &unlabelled;
+		bench.run("router/no_route/labels=" + to_string(labels), from.size(), [&]() {
+			double sum = 0;
+			Route route;
+			for (int i = 0; i < from.size(); i++)
+				sum += router.generatePointToPointRoute(from[i], to[i], route, options);
+			return sum;
+		});
+	}
+}
+
+// one search on g, from node to node, with the given heuristic
+template<typename Heuristic>
+static double policySearch(const RoadGraph& g, int source, int goal, const Heuristic& h)
+{
+	if (source == goal)
+		return 0;
+	vector<int> edges;
+	vector<GeoCoord> frontier;
+	vector<int> tiles;
+	RouteStats stats;
+	double miles = 0;
+	RouteSearch<Heuristic, LengthCost> search(g, SearchScratch::forThread(g.numNodes()), h, LengthCost(g));
+	search.run(source, goal, edges, miles, stats, false, frontier, tiles);
+	return miles;
+}
+
+// the search core instantiated directly, with and without a heuristic
+static void policyBenchmarks(Bench& bench, const StreetMap& sm)
+{
+	const int PAIRS = 200;
+	shared_ptr<const RoadGraph> g = sm.snapshot();
+	mt19937 rng(SEED);
+	uniform_int_distribution<int> pick(0, g->numNodes() - 1);
+	vector<int> from, to;
+	for (int i = 0; i < PAIRS; i++)
+	{
+		from.push_back(pick(rng));
+		to.push_back(pick(rng));
+	}
+
+	bench.run("router/policy/dijkstra", PAIRS, [&]() {
+		double sum = 0;
+		for (int i = 0; i < PAIRS; i++)
+			sum += policySearch(*g, from[i], to[i], ZeroHeuristic());
+		return sum;
+	});
+	bench.run("router/policy/astar", PAIRS, [&]() {
+		double sum = 0;
+		for (int i = 0; i < PAIRS; i++)
+			sum += policySearch(*g, from[i], to[i], ChordHeuristic(*g, to[i], 1.0));
+		return sum;
+	});
+}
+
+static vector<DeliveryRequest> deliveryBatch(const RoadGraph& g, int count, unsigned int seed)
+{
+	vector<GeoCoord> where = randomNodes(g, count, seed);
+	vector<DeliveryRequest> batch;
+	for (int i = 0; i < count; i++)
+		batch.push_back(DeliveryRequest("item" + to_string(i), where[i]));
+	return batch;
+}
+
+static void optimizerBenchmarks(Bench& bench, const StreetMap& sm)
+{
+	const int sizes[] = { 8, 32, 128 };
+	const int BATCHES = 10;
+	GeoCoord depot = randomNodes(sm.graph(), 1, SEED)[0];
+
+	DistanceOracle oracle(&sm);
+	bool haveOracle = bench.wanted("optimizer/oracle");
+	if (haveOracle)
+		bench.once("oracle/build", [&]() { oracle.build(); return (double)oracle.labelEntries(); });
+
+	for (int n : sizes)
+	{
+		vector<vector<DeliveryRequest>> batches;
+		for (int b = 0; b < BATCHES; b++)
+			batches.push_back(deliveryBatch(sm.graph(), n, SEED + 100 * n + b));
+
+		for (int useOracle = 0; useOracle <= 1; useOracle++)
+		{
+			if (useOracle && !haveOracle)
+				continue;
+			DeliveryOptimizer optimizer(&sm, useOracle ? &oracle : nullptr);
+			string name = string(useOracle ? "optimizer/oracle" : "optimizer/crow") + "/n=" + to_string(n);
+
+			bench.run(name, BATCHES, [&]() {
+				double sum = 0;
+				for (int b = 0; b < BATCHES; b++)
+				{
+					vector<DeliveryRequest> d = batches[b];
+					double oldCrow, newCrow;
+					optimizer.optimizeDeliveryOrder(depot, d, oldCrow, newCrow);
+					sum += newCrow;
+				}
+				return sum;
+			});
+		}
+	}
+}
+
+static void plannerBenchmarks(Bench& bench, const StreetMap& sm)
+{
+	const int sizes[] = { 5, 20 };
+	const int BATCHES = 5;
+	GeoCoord depot = randomNodes(sm.graph(), 1, SEED + 7)[0];
+	DeliveryPlanner planner(&sm);
+
+	for (int n : sizes)
+	{
+		vector<vector<DeliveryRequest>> batches;
+		for (int b = 0; b < BATCHES; b++)
+			batches.push_back(deliveryBatch(sm.graph(), n, SEED + 1000 * n + b));
+
+		bench.run("planner/plan/n=" + to_string(n), BATCHES, [&]() {
+			double sum = 0;
+			vector<DeliveryCommand> commands;
+			for (int b = 0; b < BATCHES; b++)
+			{
+				double miles = 0;
+				if (planner.generateDeliveryPlan(depot, batches[b], commands, miles) == DELIVERY_SUCCESS)
+					sum += miles;
+			}
+			return sum;
+		});
+
+		// one delivery cancelled once the driver is at the first stop
+		vector<DeliveryPlan> plans(BATCHES);
+		vector<vector<DeliveryRequest>> remaining;
+		for (int b = 0; b < BATCHES; b++)
+		{
+			planner.generateDeliveryPlan(depot, batches[b], plans[b]);
+			remaining.push_back(vector<DeliveryRequest>(batches[b].begin() + 1, batches[b].end()));
+			remaining[b].erase(remaining[b].begin() + remaining[b].size() / 2);
+		}
+		bench.run("planner/replan/n=" + to_string(n), BATCHES, [&]() {
+			double sum = 0;
+			for (int b = 0; b < BATCHES; b++)
+			{
+				DeliveryPlan revised;
+				if (planner.replan(plans[b], batches[b][0].location, remaining[b], revised) == DELIVERY_SUCCESS)
+					sum += revised.miles();
+			}
+			return sum;
+		});
+	}
+}
+
+// Closing a batch of segments and reopening them again: two new versions of
+// the map per run.  Reopened edges go to the back of their node's list, so
+// this runs last.
+static void editBenchmarks(Bench& bench, StreetMap& sm)
+{
+	const int sizes[] = { 1, 10, 100 };
+	for (int n : sizes)
+	{
+		mt19937 rng(SEED + n);
+		shared_ptr<const RoadGraph> g = sm.snapshot();
+		uniform_int_distribution<int> pick(0, g->numEdges() - 1);
+		vector<MapEdit> close, reopen;
+		set<pair<int, int>> chosen;
+		while (close.size() < n)
+		{
+			int e = pick(rng);
+			if (!chosen.insert(make_pair(min(g->edgeFrom[e], g->edgeTo[e]), max(g->edgeFrom[e], g->edgeTo[e]))).second)
+				continue;
+			close.push_back(MapEdit(MapEdit::CLOSE, g->segment(e)));
+			reopen.push_back(MapEdit(MapEdit::REOPEN, g->segment(e)));
+		}
+		g.reset();
+
+		bench.run("streetmap/edit/close_reopen/n=" + to_string(n), 2, [&]() {
+			bool ok = sm.applyEdits(close) && sm.applyEdits(reopen);
+			return ok ? (double)sm.graph().numEdges() : -1.0;
+		});
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	string mapFile = "mapdata.txt";
+	string outFile;
+	string filter;
+	string traceFile;
+	string metricsFile;
+	int reps = 5;
+	bool memory = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (i + 1 < argc && arg == "--map")
+			mapFile = argv[++i];
+		else if (i + 1 < argc && arg == "--out")
+			outFile = argv[++i];
+		else if (i + 1 < argc && arg == "--filter")
+			filter = argv[++i];
+		else if (i + 1 < argc && arg == "--reps")
+			reps = max(1, atoi(argv[++i]));
+		else if (i + 1 < argc && arg == "--trace")
+			traceFile = argv[++i];
+		else if (i + 1 < argc && arg == "--metrics")
+			metricsFile = argv[++i];
+		else if (arg == "--memory")
+			memory = true;
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--map mapdata.txt] [--out results.json] [--reps N] [--filter substring] [--trace trace.json] [--metrics metrics.prom] [--memory]" << endl;
+			return 1;
+		}
+	}
+
+	Bench bench(reps, filter);
+	hashMapBenchmarks(bench);
+	allocatorBenchmarks(bench);
+
+	bench.run("streetmap/load", 1, [&]() {
+		StreetMap sm;
+		return sm.load(mapFile) ? (double)sm.graph().numEdges() : -1.0;
+	});
+
+	StreetMap sm;
+	if (!sm.load(mapFile) || sm.graph().numNodes() == 0)
+	{
+		cerr << "Unable to load map data file " << mapFile << endl;
+		return 1;
+	}
+	MemoryReport report;
+	if (memory)
+	{
+		sm.reportMemory(report);
+		bench.memory("after_load", report);
+	}
+
+	routerBenchmarks(bench, sm);
+	policyBenchmarks(bench, sm);
+	noRouteBenchmarks(bench, sm);
+	optimizerBenchmarks(bench, sm);
+	plannerBenchmarks(bench, sm);
+	editBenchmarks(bench, sm);
+
+	if (memory)
+	{
+		// random stops can be off the depot's part of the map; drop those
+		GeoCoord depot = randomNodes(sm.graph(), 1, SEED + 7)[0];
+		vector<DeliveryRequest> batch = deliveryBatch(sm.graph(), 20, SEED + 20000);
+		vector<int> unreachable;
+		DeliveryOptimizer(&sm).validateDeliveries(depot, batch, unreachable);
+		for (int k = unreachable.size() - 1; k >= 0; k--)
+			batch.erase(batch.begin() + unreachable[k]);
+
+		DeliveryPlan plan;
+		DeliveryPlanner(&sm).generateDeliveryPlan(depot, batch, plan);
+		report.clear();
+		sm.reportMemory(report);
+		reportSearchMemory(report);
+		reportMemory(plan, report);
+		bench.memory("after_run", report);
+	}
+
+	// every route query made above, warm-up runs included
+	if (!metricsFile.empty())
+	{
+		ofstream metrics(metricsFile);
+		metrics << routeMetricsPrometheus();
+		if (!metrics)
+			cerr << "Unable to write " << metricsFile << endl;
+	}
+	if (!traceFile.empty() && !traceWrite(traceFile))
+		cerr << "Unable to write " << traceFile << (traceEnabled() ? "" : " (built without GOOBER_TRACE)") << endl;
+
+	if (outFile.empty())
+		bench.writeJson(cout, mapFile);
+	else
+	{
+		ofstream out(outFile);
+		if (!out)
+		{
+			cerr << "Unable to write " << outFile << endl;
+			return 1;
+		}
+		bench.writeJson(out, mapFile);
+	}
+}
@@ -0,0 +1,211 @@
+// geomath_check.cpp
+// Checks the GeoMath kernels against distanceEarthMiles.
+//
+// usage: goober_geomath_check [--pairs N] [--seed s]
+//
+// Built three times, one per kernel path GeoMath.cpp can take: the compiler's
+// default (SSE2 on x86-64), AVX2 (goober_geomath_check_avx2, skipped on a CPU
+// without it) and plain C++ (goober_geomath_check_scalar, GEOMATH_SCALAR).
+// Each routes N (default 20000) random pairs through distanceMiles,
+// distanceBatchMiles from a point and from a GeoCoord, and
+// distanceMatrixMiles: local pairs a few feet to a few miles apart and
+// long-range pairs anywhere on the globe, including near-antipodal ones.  Every
+// distance must agree with distanceEarthMiles, and distanceLowerBoundMiles and
+// distanceLowerBoundBatchMiles must never exceed it.
+//
+// Exits with status 1 on any disagreement.  `cmake --build build --target
+// geomath_check` runs all three.
+
+#include "provided.h"
+#include "GeoMath.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+
+// as GeoMath.cpp chooses
+#if defined(GEOMATH_SCALAR)
+static const char* const KERNEL = "scalar";
+#elif defined(__AVX2__)
+static const char* const KERNEL = "avx2";
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+static const char* const KERNEL = "sse2";
+#else
+static const char* const KERNEL = "scalar";
+#endif
+
+// distanceEarthMiles works in degrees from the text, so the points are made as
+// text first, with enough digits that the text is the point
+static GeoCoord coordAt(double lat, double lon)
+{
+	char latText[32];
+	char lonText[32];
+	snprintf(latText, sizeof(latText), "%.10f", lat);
+	snprintf(lonText, sizeof(lonText), "%.10f", lon);
+	return GeoCoord(latText, lonText);
+}
+
+struct Tally
+{
+	Tally() : checked(0), failed(0), worst(0) {}
+
+	long long checked;
+	long long failed;
+	double worst;	// largest difference from distanceEarthMiles, in miles
+
+	// Exact kernels agree with distanceEarthMiles to within rounding: a few
+	// 1e-13 miles from the unit-sphere positions, and up to about 1e-6 miles
+	// near the antipode, where both formulas' asin is at its steepest
+	void exact(const char* what, double got, double want)
+	{
+		checked++;
+		double diff = fabs(got - want);
+		worst = max(worst, diff);
+		if (diff <= 1e-9 + 1e-10 * want)
+			return;
+		if (failed++ < 10)
+			printf("  %s: %.15g, distanceEarthMiles %.15g\n", what, got, want);
+	}
+
+	// The chord is the A* heuristic, so it must not overestimate at all
+	void lowerBound(const char* what, double got, double exact)
+	{
+		checked++;
+		if (got <= exact)
+			return;
+		if (failed++ < 10)
+			printf("  %s: %.15g above the exact %.15g\n", what, got, exact);
+	}
+};
+
+int main(int argc, char* argv[])
+{
+	int pairs = 20000;
+	unsigned seed = 1;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--pairs" && i + 1 < argc)
+			pairs = atoi(argv[++i]);
+		else if (arg == "--seed" && i + 1 < argc)
+			seed = strtoul(argv[++i], nullptr, 10);
+		else
+		{
+			cerr << "usage: " << argv[0] << " [--pairs N] [--seed s]" << endl;
+			return 2;
+		}
+	}
+
+#if defined(__AVX2__) && (defined(__GNUC__) || defined(__clang__))
+	if (!__builtin_cpu_supports("avx2"))
+	{
+		cout << "avx2: skipped, this CPU has no AVX2" << endl;
+		return 0;
+	}
+#endif
+
+	// points in pairs, 2k and 2k + 1, half of them local and half anywhere
+	mt19937 rng(seed);
+	uniform_real_distribution<double> unit(0, 1);
+	vector<GeoCoord> points;
+	for (int k = 0; k < pairs; k++)
+	{
+		double lat = asin(2 * unit(rng) - 1) * 180 / M_PI;
+		double lon = 360 * unit(rng) - 180;
+		points.push_back(coordAt(lat, lon));
+		if (k % 2 == 0)
+		{
+			// up to about 5 miles away, down to a few feet
+			double miles = 5 * pow(10.0, -4 * unit(rng));
+			double heading = 2 * M_PI * unit(rng);
+			double dLat = miles * cos(heading) / 69.0;
+			double dLon = miles * sin(heading) / (69.0 * max(cos(deg2rad(lat)), 0.01));
+			points.push_back(coordAt(max(-89.9, min(89.9, lat + dLat)), lon + dLon));
+		}
+		else if (k % 10 == 1)
+			points.push_back(coordAt(-lat + unit(rng) * 0.01, (lon > 0 ? lon - 180 : lon + 180) + unit(rng) * 0.01));
+		else
+			points.push_back(coordAt(asin(2 * unit(rng) - 1) * 180 / M_PI, 360 * unit(rng) - 180));
+	}
+
+	CoordArrays c;
+	c.reserve(points.size());
+	for (const GeoCoord& g : points)
+		c.add(g);
+
+	Tally local;
+	Tally far;
+	for (int k = 0; k < pairs; k++)
+	{
+		int a = 2 * k;
+		int b = 2 * k + 1;
+		Tally& t = k % 2 == 0 ? local : far;
+		double want = distanceEarthMiles(points[a], points[b]);
+
+		t.exact("distanceMiles", distanceMiles(c, a, b), want);
+		t.lowerBound("distanceLowerBoundMiles", distanceLowerBoundMiles(c, a, b), want);
+		t.lowerBound("distanceLowerBoundMiles", distanceLowerBoundMiles(c, a, b), distanceMiles(c, a, b));
+	}
+
+	// the batches in SIMD widths and their scalar tails: every point from
+	// each of a few origins, nearby ones and the rest of the world alike
+	vector<int> all(points.size());
+	for (int i = 0; i < all.size(); i++)
+		all[i] = i;
+	vector<double> out(points.size());
+	vector<double> bound(points.size());
+	for (int k = 0; k < min(pairs, 50); k++)
+	{
+		int from = 2 * k;
+		for (int count = all.size() - 3; count <= all.size(); count++)
+		{
+			distanceBatchMiles(c, from, all.data(), count, out.data());
+			distanceLowerBoundBatchMiles(c, from, all.data(), count, bound.data());
+			for (int i = 0; i < count; i++)
+			{
+				double want = distanceEarthMiles(points[from], points[i]);
+				Tally& t = want < 10 ? local : far;
+				t.exact("distanceBatchMiles", out[i], want);
+				t.lowerBound("distanceLowerBoundBatchMiles", bound[i], want);
+				t.lowerBound("distanceLowerBoundBatchMiles", bound[i], out[i]);
+			}
+		}
+
+		distanceBatchMiles(c, points[from], all.data(), all.size(), out.data());
+		for (int i = 0; i < all.size(); i++)
+		{
+			double want = distanceEarthMiles(points[from], points[i]);
+			(want < 10 ? local : far).exact("distanceBatchMiles from a GeoCoord", out[i], want);
+		}
+	}
+
+	// the matrix of 23 of the local pairs, which are far from one another
+	CoordArrays m;
+	vector<GeoCoord> mPoints;
+	for (int i = 0; i < 23 && 2 * i + 1 < points.size(); i++)
+	{
+		mPoints.push_back(points[4 * i % points.size()]);
+		mPoints.push_back(points[(4 * i + 1) % points.size()]);
+	}
+	for (const GeoCoord& g : mPoints)
+		m.add(g);
+	vector<double> matrix;
+	distanceMatrixMiles(m, matrix);
+	for (int i = 0; i < m.size(); i++)
+		for (int j = 0; j < m.size(); j++)
+		{
+			double want = distanceEarthMiles(mPoints[i], mPoints[j]);
+			(want < 10 ? local : far).exact("distanceMatrixMiles", matrix[i * m.size() + j], want);
+		}
+
+	printf("%s: local %lld checks, %lld failed, worst %.3g miles; long-range %lld checks, %lld failed, worst %.3g miles\n",
+		KERNEL, local.checked, local.failed, local.worst, far.checked, far.failed, far.worst);
+	bool ok = local.failed == 0 && far.failed == 0;
+	cout << (ok ? "PASS" : "FAIL") << endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,367 @@
+// load_driver.cpp
+// Throughput of delivery planning as threads are added.  Generates a pool of
+// delivery batches from the nodes of a loaded map, then for each thread count
+// runs that many threads for a fixed time, each optimizing and planning
+// batches with its own DeliveryOptimizer and DeliveryPlanner over the one
+// shared StreetMap.  Reports plans per second, latency percentiles and scaling
+// efficiency (throughput / (threads * single-thread throughput)); efficiency
+// well below 1 points at contention on something the threads share.
+//
+// usage: goober_load [--map mapdata.txt] [--threads 1,2,4,8] [--seconds 5]
+//                    [--stops 3-12] [--cluster miles] [--depots K] [--skew s]
+//                    [--oracle] [--deadline ms] [--seed s] [--json results.json]
+//
+//   --cluster  stops fall within this crow distance of a random centre
+//              (0, the default, spreads them over the whole map)
+//   --depots   number of distinct depots batches start from
+//   --skew     Zipf exponent for choosing the depot; 0 is uniform, larger
+//              values send most batches from a few hot depots
+//   --oracle   order stops by road distance from a shared DistanceOracle
+//   --deadline give each plan this long (RouteOptions::deadline); plans that
+//              run out count as timed out rather than failed
+
+#include "provided.h"
+#include "RoadGraph.h"
+#include "GeoMath.h"
+#include "DistanceOracle.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+struct WorkloadOptions
+{
+	int minStops = 3;
+	int maxStops = 12;
+	double clusterMiles = 0;
+	int depots = 20;
+	double skew = 1.0;
+	int poolSize = 2000;
+	unsigned int seed = 1;
+};
+
+static int findRoot(vector<int>& parent, int x)
+{
+	while (parent[x] != x)
+		x = parent[x] = parent[parent[x]];
+	return x;
+}
+
+struct Batch
+{
+	GeoCoord depot;
+	vector<DeliveryRequest> stops;
+};
+
+// Samples batches of map nodes as described by the options.  Depots and stops
+// all come from the map's largest connected piece, as real customers would be
+// reachable; otherwise most batches would contain an unroutable stop.
+static void generateWorkload(const StreetMap& sm, const WorkloadOptions& w, vector<Batch>& pool)
+{
+	const RoadGraph& g = sm.graph();
+	mt19937 rng(w.seed);
+
+	vector<int> parent(g.numNodes());
+	for (int x = 0; x < g.numNodes(); x++)
+		parent[x] = x;
+	for (int e = 0; e < g.numEdges(); e++)
+		parent[findRoot(parent, g.edgeFrom[e])] = findRoot(parent, g.edgeTo[e]);
+	vector<int> size(g.numNodes(), 0);
+	for (int x = 0; x < g.numNodes(); x++)
+		size[findRoot(parent, x)]++;
+	int largest = max_element(size.begin(), size.end()) - size.begin();
+	vector<int> nodes;
+	for (int x = 0; x < g.numNodes(); x++)
+		if (findRoot(parent, x) == largest)
+			nodes.push_back(x);
+
+	uniform_int_distribution<int> pickNode(0, nodes.size() - 1);
+	auto anyNode = [&]() { return nodes[pickNode(rng)]; };
+	uniform_int_distribution<int> stopCount(w.minStops, max(w.minStops, w.maxStops));
+
+	vector<int> depots;
+	vector<double> depotWeight;
+	for (int i = 0; i < max(1, w.depots); i++)
+	{
+		depots.push_back(anyNode());
+		depotWeight.push_back(1.0 / pow(i + 1, w.skew));
+	}
+	discrete_distribution<int> pickDepot(depotWeight.begin(), depotWeight.end());
+
+	vector<double> crow(nodes.size());
+
+	pool.clear();
+	for (int b = 0; b < w.poolSize; b++)
+	{
+		Batch batch;
+		batch.depot = g.coord(depots[pickDepot(rng)]);
+
+		// nodes the stops may be drawn from
+		vector<int> candidates;
+		if (w.clusterMiles > 0)
+		{
+			int centre = anyNode();
+			distanceBatchMiles(g.coords, centre, nodes.data(), nodes.size(), crow.data());
+			for (int i = 0; i < nodes.size(); i++)
+				if (crow[i] <= w.clusterMiles)
+					candidates.push_back(nodes[i]);
+		}
+
+		int n = stopCount(rng);
+		for (int i = 0; i < n; i++)
+		{
+			int node = candidates.empty() ? anyNode() : candidates[rng() % candidates.size()];
+			batch.stops.push_back(DeliveryRequest("item" + to_string(i), g.coord(node)));
+		}
+		pool.push_back(batch);
+	}
+}
+
+struct RunResult
+{
+	int threads;
+	double seconds;
+	long long plans;
+	long long failed;	// plans that came back NO_ROUTE or BAD_COORD
+	long long timedOut;
+	vector<long long> perThread;
+	vector<double> latencyNs;	// every plan, sorted
+
+	double throughput() const { return plans / seconds; }
+	double percentile(double p) const
+	{
+		if (latencyNs.empty())
+			return 0;
+		size_t i = min(latencyNs.size() - 1, (size_t)(p * latencyNs.size()));
+		return latencyNs[i];
+	}
+};
+
+static RunResult drive(const StreetMap& sm, const DistanceOracle* oracle, const vector<Batch>& pool, int threads, double seconds, double deadlineMs)
+{
+	struct PerThread
+	{
+		long long plans = 0;
+		long long failed = 0;
+		long long timedOut = 0;
+		vector<double> latencyNs;
+	};
+	vector<PerThread> work(threads);
+	atomic<int> ready(0);
+	atomic<bool> go(false);
+	Clock::time_point deadline;
+
+	auto body = [&](int t) {
+		DeliveryOptimizer optimizer(&sm, oracle);
+		DeliveryPlanner planner(&sm);
+		vector<DeliveryCommand> commands;
+		PerThread& mine = work[t];
+		mine.latencyNs.reserve(1 << 16);
+
+		ready++;
+		while (!go.load())
+			this_thread::yield();
+
+		// threads start at different places in the pool so they aren't
+		// working on the same batch in lockstep
+		size_t next = (size_t)t * pool.size() / threads;
+		while (Clock::now() < deadline)
+		{
+			const Batch& batch = pool[next];
+			next = (next + 1) % pool.size();
+
+			auto t0 = Clock::now();
+			vector<DeliveryRequest> stops = batch.stops;
+			double oldCrow, newCrow, miles;
+			optimizer.optimizeDeliveryOrder(batch.depot, stops, oldCrow, newCrow);
+			commands.clear();
+			DeliveryResult result;
+			if (deadlineMs > 0)
+			{
+				RouteOptions options;
+				options.deadline = t0 + chrono::duration_cast<Clock::duration>(chrono::duration<double, milli>(deadlineMs));
+				DeliveryPlan plan;
+				result = planner.generateDeliveryPlan(batch.depot, stops, plan, options);
+				plan.appendCommands(commands);
+			}
+			else
+				result = planner.generateDeliveryPlan(batch.depot, stops, commands, miles);
+			auto t1 = Clock::now();
+
+			mine.latencyNs.push_back(chrono::duration<double, nano>(t1 - t0).count());
+			mine.plans++;
+			if (result == TIMED_OUT)
+				mine.timedOut++;
+			else if (result != DELIVERY_SUCCESS)
+				mine.failed++;
+		}
+	};
+
+	vector<thread> workers;
+	for (int t = 0; t < threads; t++)
+		workers.push_back(thread(body, t));
+	while (ready.load() < threads)
+		this_thread::yield();
+
+	auto started = Clock::now();
+	deadline = started + chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds));
+	go.store(true);
+	for (thread& th : workers)
+		th.join();
+
+	RunResult r;
+	r.threads = threads;
+	r.seconds = chrono::duration<double>(Clock::now() - started).count();
+	r.plans = 0;
+	r.failed = 0;
+	r.timedOut = 0;
+	for (const PerThread& p : work)
+	{
+		r.plans += p.plans;
+		r.failed += p.failed;
+		r.timedOut += p.timedOut;
+		r.perThread.push_back(p.plans);
+		r.latencyNs.insert(r.latencyNs.end(), p.latencyNs.begin(), p.latencyNs.end());
+	}
+	sort(r.latencyNs.begin(), r.latencyNs.end());
+	return r;
+}
+
+static bool parseThreads(const string& list, vector<int>& out)
+{
+	out.clear();
+	stringstream ss(list);
+	string item;
+	while (getline(ss, item, ','))
+	{
+		int n = atoi(item.c_str());
+		if (n <= 0)
+			return false;
+		out.push_back(n);
+	}
+	return !out.empty();
+}
+
+int main(int argc, char* argv[])
+{
+	string mapFile = "mapdata.txt";
+	string jsonFile;
+	vector<int> threadCounts;
+	double seconds = 5;
+	double deadlineMs = 0;
+	bool useOracle = false;
+	WorkloadOptions w;
+
+	unsigned int cores = max(1u, thread::hardware_concurrency());
+	for (unsigned int n = 1; n <= cores; n *= 2)
+		threadCounts.push_back(n);
+	if (threadCounts.back() != cores)
+		threadCounts.push_back(cores);
+
+	bool ok = true;
+	for (int i = 1; i < argc && ok; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (hasValue && arg == "--map")
+			mapFile = argv[++i];
+		else if (hasValue && arg == "--threads")
+			ok = parseThreads(argv[++i], threadCounts);
+		else if (hasValue && arg == "--seconds")
+			seconds = atof(argv[++i]);
+		else if (hasValue && arg == "--stops")
+			ok = sscanf(argv[++i], "%d-%d", &w.minStops, &w.maxStops) == 2 && w.minStops > 0;
+		else if (hasValue && arg == "--cluster")
+			w.clusterMiles = atof(argv[++i]);
+		else if (hasValue && arg == "--depots")
+			w.depots = atoi(argv[++i]);
+		else if (hasValue && arg == "--skew")
+			w.skew = atof(argv[++i]);
+		else if (hasValue && arg == "--seed")
+			w.seed = atoi(argv[++i]);
+		else if (hasValue && arg == "--deadline")
+			deadlineMs = atof(argv[++i]);
+		else if (hasValue && arg == "--json")
+			jsonFile = argv[++i];
+		else if (arg == "--oracle")
+			useOracle = true;
+		else
+			ok = false;
+	}
+	if (!ok)
+	{
+		cerr << "Usage: " << argv[0] << " [--map mapdata.txt] [--threads 1,2,4,8] [--seconds 5] [--stops 3-12]" << endl
+			<< "       [--cluster miles] [--depots K] [--skew s] [--oracle] [--deadline ms] [--seed s] [--json results.json]" << endl;
+		return 1;
+	}
+
+	StreetMap sm;
+	if (!sm.load(mapFile) || sm.graph().numNodes() == 0)
+	{
+		cerr << "Unable to load map data file " << mapFile << endl;
+		return 1;
+	}
+
+	DistanceOracle oracle(&sm);
+	if (useOracle)
+		oracle.build();
+
+	vector<Batch> pool;
+	generateWorkload(sm, w, pool);
+
+	cout << "threads  plans/s   p50 ms   p99 ms  p999 ms  efficiency  failed  timed out" << endl;
+	vector<RunResult> results;
+	for (int n : threadCounts)
+	{
+		RunResult r = drive(sm, useOracle ? &oracle : nullptr, pool, n, seconds, deadlineMs);
+		results.push_back(r);
+
+		double single = results[0].throughput() / results[0].threads;
+		char line[160];
+		snprintf(line, sizeof(line), "%7d %8.1f %8.3f %8.3f %8.3f %11.2f %7lld %10lld",
+			n, r.throughput(), r.percentile(0.5) / 1e6, r.percentile(0.99) / 1e6, r.percentile(0.999) / 1e6,
+			r.throughput() / (n * single), r.failed, r.timedOut);
+		cout << line << endl;
+	}
+
+	if (!jsonFile.empty())
+	{
+		ofstream out(jsonFile);
+		out.precision(9);
+		out << "{\n  \"map\": \"" << mapFile << "\", \"seconds\": " << seconds
+			<< ", \"stops\": [" << w.minStops << ", " << w.maxStops << "], \"cluster_miles\": " << w.clusterMiles
+			<< ", \"depots\": " << w.depots << ", \"skew\": " << w.skew << ", \"oracle\": " << (useOracle ? "true" : "false")
+			<< ", \"deadline_ms\": " << deadlineMs
+			<< ",\n  \"runs\": [";
+		double single = results[0].throughput() / results[0].threads;
+		for (int i = 0; i < results.size(); i++)
+		{
+			const RunResult& r = results[i];
+			out << (i == 0 ? "\n" : ",\n") << "    {\"threads\": " << r.threads
+				<< ", \"plans\": " << r.plans << ", \"failed\": " << r.failed << ", \"timed_out\": " << r.timedOut
+				<< ", \"plans_per_second\": " << r.throughput()
+				<< ", \"p50_ns\": " << r.percentile(0.5) << ", \"p99_ns\": " << r.percentile(0.99) << ", \"p999_ns\": " << r.percentile(0.999)
+				<< ", \"efficiency\": " << r.throughput() / (r.threads * single) << ", \"per_thread_plans\": [";
+			for (int t = 0; t < r.perThread.size(); t++)
+				out << (t == 0 ? "" : ", ") << r.perThread[t];
+			out << "]}";
+		}
+		out << "\n  ]\n}\n";
+		if (!out)
+		{
+			cerr << "Unable to write " << jsonFile << endl;
+			return 1;
+		}
+	}
+}
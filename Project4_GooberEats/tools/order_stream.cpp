@@ -0,0 +1,194 @@
+// order_stream.cpp
+// Streams an order log through the delivery pipeline a batch at a time:
+// RequestReader hands over each batch, DeliveryOptimizer::validateDeliveries
+// drops the stops no tour from the depot can make, and the rest are ordered
+// and planned.  Reports lines per second and the process's peak memory, which
+// should depend on --batch and the map, not on the size of the log.
+//
+// usage: goober_orders --orders log.txt [--map mapdata.txt] [--batch 20]
+//                      [--read] [--parse-only] [--generate N] [--seed s]
+//
+//   --generate  first write a log of N orders at random nodes of the map,
+//               from a random depot, to the --orders file
+//   --read      read the log through a buffer instead of memory-mapping it
+//   --parse-only  only read the log, to time ingestion by itself
+
+#include "provided.h"
+#include "RoadGraph.h"
+#include "RequestReader.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// peak resident memory of the process so far, or -1 where unknown
+static long peakMemoryKB()
+{
+#if defined(_WIN32)
+	return -1;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024;		// bytes there
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static bool generateLog(const RoadGraph& g, const string& file, long long orders, unsigned int seed)
+{
+	ofstream out(file, ios::binary);
+	if (!out)
+		return false;
+	mt19937 rng(seed);
+	uniform_int_distribution<int> pick(0, g.numNodes() - 1);
+	GeoCoord depot = g.coord(pick(rng));
+	out << depot.latitudeText << ' ' << depot.longitudeText << '\n';
+
+	string chunk;
+	for (long long i = 0; i < orders; i++)
+	{
+		GeoCoord c = g.coord(pick(rng));
+		chunk += c.latitudeText;
+		chunk += ' ';
+		chunk += c.longitudeText;
+		chunk += ":order ";
+		chunk += to_string(i);
+		chunk += '\n';
+		if (chunk.size() >= (1 << 20))
+		{
+			out << chunk;
+			chunk.clear();
+		}
+	}
+	out << chunk;
+	return bool(out);
+}
+
+int main(int argc, char* argv[])
+{
+	string mapFile = "mapdata.txt";
+	string ordersFile;
+	int batchSize = 20;
+	bool useMap = true;
+	bool parseOnly = false;
+	long long generate = 0;
+	unsigned int seed = 1;
+
+	bool ok = true;
+	for (int i = 1; i < argc && ok; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (hasValue && arg == "--map")
+			mapFile = argv[++i];
+		else if (hasValue && arg == "--orders")
+			ordersFile = argv[++i];
+		else if (hasValue && arg == "--batch")
+			batchSize = atoi(argv[++i]);
+		else if (hasValue && arg == "--generate")
+			generate = atoll(argv[++i]);
+		else if (hasValue && arg == "--seed")
+			seed = atoi(argv[++i]);
+		else if (arg == "--read")
+			useMap = false;
+		else if (arg == "--parse-only")
+			parseOnly = true;
+		else
+			ok = false;
+	}
+	if (!ok || ordersFile.empty() || batchSize <= 0)
+	{
+		cerr << "Usage: " << argv[0] << " --orders log.txt [--map mapdata.txt] [--batch 20] [--read]" << endl
+			<< "       [--parse-only] [--generate N] [--seed s]" << endl;
+		return 1;
+	}
+
+	StreetMap sm;
+	if ((!parseOnly || generate > 0) && (!sm.load(mapFile) || sm.graph().numNodes() == 0))
+	{
+		cerr << "Unable to load map data file " << mapFile << endl;
+		return 1;
+	}
+	if (generate > 0)
+	{
+		auto t0 = Clock::now();
+		if (!generateLog(sm.graph(), ordersFile, generate, seed))
+		{
+			cerr << "Cannot write " << ordersFile << endl;
+			return 1;
+		}
+		printf("%s: %lld orders written (%.0f ms)\n", ordersFile.c_str(), generate,
+			1e3 * chrono::duration<double>(Clock::now() - t0).count());
+	}
+	long memoryBefore = peakMemoryKB();
+
+	RequestReader reader;
+	if (!reader.open(ordersFile, useMap))
+	{
+		cerr << "Unable to load delivery request file " << ordersFile << endl;
+		return 1;
+	}
+
+	DeliveryOptimizer optimizer(&sm);
+	DeliveryPlanner planner(&sm);
+	vector<DeliveryRequest> batch, reachable;
+	vector<int> unreachable;
+	DeliveryPlan plan;
+	long long batches = 0, requests = 0, dropped = 0, planned = 0, failed = 0;
+	double miles = 0;
+
+	auto started = Clock::now();
+	while (reader.next(batch, batchSize))
+	{
+		batches++;
+		requests += batch.size();
+		if (parseOnly)
+			continue;
+
+		optimizer.validateDeliveries(reader.depot(), batch, unreachable);
+		reachable.clear();
+		for (int i = 0, k = 0; i < batch.size(); i++)
+		{
+			if (k < unreachable.size() && unreachable[k] == i)
+				k++;
+			else
+				reachable.push_back(batch[i]);
+		}
+		dropped += unreachable.size();
+		if (reachable.empty())
+			continue;
+
+		double oldCrow, newCrow;
+		optimizer.optimizeDeliveryOrder(reader.depot(), reachable, oldCrow, newCrow);
+		if (planner.generateDeliveryPlan(reader.depot(), reachable, plan) == DELIVERY_SUCCESS)
+		{
+			planned++;
+			miles += plan.miles();
+		}
+		else
+			failed++;
+	}
+	double seconds = chrono::duration<double>(Clock::now() - started).count();
+
+	printf("%s (%s): %lld lines, %lld bad, %lld requests in %lld batches of up to %d\n", ordersFile.c_str(),
+		reader.mapped() ? "mapped" : "read", reader.linesRead(), reader.badLines(), requests, batches, batchSize);
+	if (!parseOnly)
+		printf("  %lld unreachable dropped, %lld tours planned (%.1f miles), %lld failed\n", dropped, planned, miles, failed);
+	printf("  %.3f s, %.0f lines/s\n", seconds, reader.linesRead() / max(seconds, 1e-9));
+	printf("  peak memory %ld KB (%ld KB before reading)\n", peakMemoryKB(), memoryBefore);
+	return 0;
+}
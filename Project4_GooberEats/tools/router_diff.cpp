@@ -0,0 +1,873 @@
+// router_diff.cpp
+// Differential test of PointToPointRouter against ReferenceRouter.  Runs both
+// on random node pairs, on hand-picked awkward pairs (same node, neighbours,
+// both ends inside one chain, dead ends, separate components, coordinates not
+// on the map) and on generated grid maps, and reports every pair where the
+// router's result or distance disagrees with the reference or its route is
+// not a connected chain of real segments from start to end.
+//
+// usage: goober_router_diff [--map mapdata.txt] [--sources N] [--targets N]
+//                           [--grids N] [--epsilon e] [--seed s] [--threads N]
+//                           [--edits N]
+//
+// Random pairs are checked sources * targets at a time against one full
+// reference search per source, so millions of pairs are practical, e.g.
+// --sources 2000 --targets 1000.
+//
+// With --threads N (N > 1), N threads then share one router and one planner
+// and repeat the random pairs and a set of plans concurrently, each result
+// compared with the single-threaded one.  Build with -DGOOBER_TSAN=ON to run
+// this under ThreadSanitizer.
+//
+// Random pairs are also run through PointToPointRouter::routeAsync, plain,
+// cancelled and past their deadline.
+//
+// Tours are then planned, changed as deliveries are cancelled and added
+// mid-route, and re-planned with DeliveryPlanner::replan, against re-planning
+// from scratch.
+//
+// --edits N (default 100) then closes N segments of the loaded map, and a few
+// more in one direction only, and adds a few, some of them one-way into the
+// middle of a chain, checking routes on the edited map, queries pinned to the
+// old version, and, with --threads, queries racing a stream of edits.
+//
+// Exits with status 1 if anything disagrees.
+
+#include "provided.h"
+#include "ReferenceRouter.h"
+#include "RouteExecutor.h"
+#include "RoadGraph.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <set>
+#include <future>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+struct Tally
+{
+	long long pairs = 0;
+	long long distanceMismatches = 0;	// including a route where there should be none
+	long long brokenRoutes = 0;
+	double routerSeconds = 0;
+	double referenceSeconds = 0;	// point-to-point reference searches only
+	long long referencePairs = 0;
+	double routerSecondsOnReferencePairs = 0;
+};
+
+class Differ
+{
+public:
+	Differ(const StreetMap& sm, double epsilon)
+	 : m_map(sm), m_router(&sm), m_reference(&sm)
+	{
+		m_options.epsilon = epsilon;
+	}
+
+	// random pairs: each source against many targets
+	void randomPairs(Tally& t, mt19937& rng, int sources, int targets)
+	{
+		const RoadGraph& g = m_map.graph();
+		uniform_int_distribution<int> pick(0, g.numNodes() - 1);
+		map<GeoCoord, double> dist;
+		for (int i = 0; i < sources; i++)
+		{
+			GeoCoord start = g.coord(pick(rng));
+			m_reference.distancesFrom(start, dist);
+			for (int j = 0; j < targets; j++)
+			{
+				GeoCoord end = g.coord(pick(rng));
+				auto it = dist.find(end);
+				check(t, start, end, it == dist.end() ? DeliveryResult(NO_ROUTE) : DELIVERY_SUCCESS, it == dist.end() ? 0 : it->second, -1);
+			}
+		}
+	}
+
+	// one pair, checked against a point-to-point reference search
+	void pair(Tally& t, const GeoCoord& start, const GeoCoord& end)
+	{
+		list<StreetSegment> route;
+		double d = 0;
+		auto t0 = Clock::now();
+		DeliveryResult expected = m_reference.generatePointToPointRoute(start, end, route, d);
+		t.referenceSeconds += chrono::duration<double>(Clock::now() - t0).count();
+		t.referencePairs++;
+		check(t, start, end, expected, d, t.referencePairs);
+	}
+
+private:
+	const StreetMap& m_map;
+	PointToPointRouter m_router;
+	ReferenceRouter m_reference;
+	RouteOptions m_options;
+	int m_reported = 0;
+
+	// referencePair >= 0 when the pair's time counts toward the speedup
+	void check(Tally& t, const GeoCoord& start, const GeoCoord& end, DeliveryResult expected, double expectedMiles, long long referencePair)
+	{
+		list<StreetSegment> route;
+		double d = -1;
+		auto t0 = Clock::now();
+		DeliveryResult result = m_router.generatePointToPointRoute(start, end, route, d, m_options);
+		double seconds = chrono::duration<double>(Clock::now() - t0).count();
+		t.routerSeconds += seconds;
+		if (referencePair >= 0)
+			t.routerSecondsOnReferencePairs += seconds;
+		t.pairs++;
+
+		if (result != expected)
+		{
+			t.distanceMismatches++;
+			report(start, end, "result " + to_string(result) + ", expected " + to_string(expected));
+			return;
+		}
+		if (result != DELIVERY_SUCCESS)
+			return;
+
+		double tolerance = 1e-9 * max(1.0, expectedMiles);
+		if (d < expectedMiles - tolerance || d > expectedMiles * (1 + m_options.epsilon) + tolerance)
+		{
+			t.distanceMismatches++;
+			report(start, end, "distance " + to_string(d) + ", expected " + to_string(expectedMiles));
+		}
+
+		string problem = validate(start, end, route, d);
+		if (!problem.empty())
+		{
+			t.brokenRoutes++;
+			report(start, end, problem);
+		}
+	}
+
+	// Every segment must be a real map segment and start where the last one
+	// ended; the route must run from start to end; its lengths must add up.
+	string validate(const GeoCoord& start, const GeoCoord& end, const list<StreetSegment>& route, double miles) const
+	{
+		if (route.empty())
+			return start == end ? "" : "empty route";
+		if (route.front().start != start)
+			return "route does not begin at the start";
+		if (route.back().end != end)
+			return "route does not finish at the end";
+
+		double total = 0;
+		const StreetSegment* last = nullptr;
+		vector<StreetSegment> segs;
+		for (const StreetSegment& s : route)
+		{
+			if (last != nullptr && last->end != s.start)
+				return "gap between consecutive segments";
+			m_map.getSegmentsThatStartWith(s.start, segs);
+			bool real = false;
+			for (const StreetSegment& m : segs)
+				if (m.end == s.end && m.name == s.name)
+					real = true;
+			if (!real)
+				return "segment not on the map";
+			total += distanceEarthMiles(s.start, s.end);
+			last = &s;
+		}
+		if (fabs(total - miles) > 1e-9 * max(1.0, miles))
+			return "segment lengths add up to " + to_string(total) + ", not the reported distance";
+		return "";
+	}
+
+	void report(const GeoCoord& start, const GeoCoord& end, const string& what)
+	{
+		if (++m_reported > 20)
+			return;
+		cout << "  MISMATCH " << start.latitudeText << "," << start.longitudeText << " -> "
+			<< end.latitudeText << "," << end.longitudeText << ": " << what << endl;
+	}
+};
+
+//******************** concurrent use *****************************************
+
+struct Expected
+{
+	GeoCoord start;
+	GeoCoord end;
+	DeliveryResult result;
+	vector<StreetSegment> route;
+	double miles;
+};
+
+// Repeats every query of `work` and `plans` from several threads sharing one
+// router and one planner, and counts results that differ from `work`'s.
+static long long concurrentRun(const StreetMap& sm, const vector<Expected>& work, const vector<vector<DeliveryRequest>>& plans,
+	const vector<double>& planMiles, const GeoCoord& depot, int threads, int rounds)
+{
+	PointToPointRouter router(&sm);
+	DeliveryPlanner planner(&sm);
+	atomic<long long> mismatches(0);
+
+	auto body = [&](int t) {
+		list<StreetSegment> route;
+		vector<DeliveryCommand> commands;
+		for (int r = 0; r < rounds; r++)
+		{
+			// each thread walks the work from a different place
+			for (int k = 0; k < work.size(); k++)
+			{
+				const Expected& e = work[(k + t * work.size() / threads) % work.size()];
+				double miles = -1;
+				route.clear();
+				DeliveryResult result = router.generatePointToPointRoute(e.start, e.end, route, miles);
+				if (result != e.result || miles != e.miles || !equal(route.begin(), route.end(), e.route.begin(), e.route.end()))
+					mismatches++;
+			}
+			for (int k = 0; k < plans.size(); k++)
+			{
+				int i = (k + t) % plans.size();
+				double miles = -1;
+				commands.clear();
+				planner.generateDeliveryPlan(depot, plans[i], commands, miles);
+				if (miles != planMiles[i])
+					mismatches++;
+			}
+		}
+	};
+
+	vector<thread> workers;
+	for (int t = 0; t < threads; t++)
+		workers.push_back(thread(body, t));
+	for (thread& th : workers)
+		th.join();
+	return mismatches;
+}
+
+static bool concurrentCheck(const StreetMap& sm, mt19937& rng, int pairs, int threads)
+{
+	const RoadGraph& g = sm.graph();
+	uniform_int_distribution<int> pick(0, g.numNodes() - 1);
+
+	// single-threaded answers to compare against
+	PointToPointRouter router(&sm);
+	vector<Expected> work;
+	for (int i = 0; i < pairs; i++)
+	{
+		Expected e;
+		e.start = g.coord(pick(rng));
+		e.end = g.coord(pick(rng));
+		list<StreetSegment> route;
+		e.miles = -1;
+		e.result = router.generatePointToPointRoute(e.start, e.end, route, e.miles);
+		e.route.assign(route.begin(), route.end());
+		work.push_back(e);
+	}
+
+	DeliveryPlanner planner(&sm);
+	GeoCoord depot = g.coord(pick(rng));
+	vector<vector<DeliveryRequest>> plans;
+	vector<double> planMiles;
+	for (int i = 0; i < 20; i++)
+	{
+		vector<DeliveryRequest> stops;
+		for (int k = 0; k < 5; k++)
+			stops.push_back(DeliveryRequest("item" + to_string(k), g.coord(pick(rng))));
+		vector<DeliveryCommand> commands;
+		double miles = -1;
+		planner.generateDeliveryPlan(depot, stops, commands, miles);
+		plans.push_back(stops);
+		planMiles.push_back(miles);
+	}
+
+	auto t0 = Clock::now();
+	long long mismatches = concurrentRun(sm, work, plans, planMiles, depot, threads, 3);
+	double seconds = chrono::duration<double>(Clock::now() - t0).count();
+	cout << threads << " threads sharing one router and planner: " << threads * 3 * (work.size() + plans.size())
+		<< " queries in " << seconds << " s, " << mismatches << " differ from single-threaded results" << endl;
+	return mismatches == 0;
+}
+
+//******************** async queries ******************************************
+
+// Runs random pairs through routeAsync on an executor: as they are, against
+// the same queries made directly; again with a token cancelled as soon as
+// they are queued, when each must be cancelled or else finished correctly;
+// and with a deadline already past, when each must time out.
+static bool asyncCheck(const StreetMap& sm, mt19937& rng, int pairs, int threads)
+{
+	const RoadGraph& g = sm.graph();
+	uniform_int_distribution<int> pick(0, g.numNodes() - 1);
+	PointToPointRouter router(&sm);
+	vector<GeoCoord> from, to;
+	vector<DeliveryResult> results;
+	vector<double> miles;
+	for (int i = 0; i < pairs; i++)
+	{
+		from.push_back(g.coord(pick(rng)));
+		to.push_back(g.coord(pick(rng)));
+		Route route;
+		results.push_back(router.generatePointToPointRoute(from[i], to[i], route));
+		miles.push_back(route.miles());
+	}
+
+	RouteExecutor executor(threads);
+	long long mismatches = 0, cancelled = 0, timedOut = 0;
+	CancelToken token;
+	RouteOptions cancellable;
+	cancellable.cancel = &token;
+	RouteOptions expired;
+	expired.deadline = Clock::now();
+
+	for (int pass = 0; pass < 3; pass++)
+	{
+		const RouteOptions& options = pass == 0 ? RouteOptions() : pass == 1 ? cancellable : expired;
+		vector<future<RouteResult>> answers;
+		for (int i = 0; i < pairs; i++)
+			answers.push_back(router.routeAsync(executor, from[i], to[i], options));
+		if (pass == 1)
+			token.cancel();
+
+		for (int i = 0; i < pairs; i++)
+		{
+			RouteResult r = answers[i].get();
+			if (pass == 1 && r.result == CANCELLED)
+				cancelled++;
+			else if (pass == 2 && r.result == TIMED_OUT)
+				timedOut++;
+			else if (pass == 2 || r.result != results[i] || r.route.miles() != miles[i])
+				mismatches++;
+		}
+	}
+
+	cout << "async on " << executor.threads() << " threads: " << pairs << " pairs each plain, cancelled once queued ("
+		<< cancelled << " stopped early) and past their deadline (" << timedOut << " timed out), "
+		<< mismatches << " wrong answers" << endl;
+	return mismatches == 0;
+}
+
+//******************** re-planning ********************************************
+
+// Plans tours, then changes each as a day's events would (a delivery
+// cancelled, one added, the driver partway along the first leg) and checks
+// that DeliveryPlanner::replan, reusing what it can, comes to the same miles
+// as re-planning with nothing to reuse.
+static bool replanCheck(const StreetMap& sm, mt19937& rng, int tours)
+{
+	const RoadGraph& g = sm.graph();
+	uniform_int_distribution<int> pick(0, g.numNodes() - 1);
+	DeliveryPlanner planner(&sm);
+	GeoCoord depot = g.coord(pick(rng));
+
+	int mismatches = 0, planned = 0, legs = 0, routed = 0;
+	double replanSeconds = 0, freshSeconds = 0;
+	for (int t = 0; t < tours; t++)
+	{
+		vector<DeliveryRequest> stops;
+		for (int k = 0; k < 8; k++)
+			stops.push_back(DeliveryRequest("item" + to_string(k), g.coord(pick(rng))));
+		DeliveryPlan plan;
+		if (planner.generateDeliveryPlan(depot, stops, plan) != DELIVERY_SUCCESS || plan.legs[0].route.size() < 2)
+			continue;
+		planned++;
+
+		// partway along the first leg, one delivery cancelled, one added
+		const Route& first = plan.legs[0].route;
+		GeoCoord position = first.segment(rng() % first.size()).start;
+		vector<DeliveryRequest> remaining(stops.begin(), stops.end());
+		remaining.erase(remaining.begin() + 1 + rng() % (remaining.size() - 1));
+		remaining.insert(remaining.begin() + 1 + rng() % remaining.size(), DeliveryRequest("added", g.coord(pick(rng))));
+
+		DeliveryPlan revised, fresh, nothing;
+		nothing.depot = depot;
+		auto t0 = Clock::now();
+		DeliveryResult r1 = planner.replan(plan, position, remaining, revised);
+		auto t1 = Clock::now();
+		DeliveryResult r2 = planner.replan(nothing, position, remaining, fresh);
+		auto t2 = Clock::now();
+		replanSeconds += chrono::duration<double>(t1 - t0).count();
+		freshSeconds += chrono::duration<double>(t2 - t1).count();
+
+		if (r1 != r2 || fabs(revised.miles() - fresh.miles()) > 1e-6)
+		{
+			if (mismatches < 10)
+				cout << "REPLAN MISMATCH tour " << t << ": " << r1 << " " << revised.miles() << " miles, fresh " << r2 << " " << fresh.miles() << endl;
+			mismatches++;
+		}
+		legs += revised.legs.size();
+		routed += revised.legsRouted;
+	}
+
+	cout << "re-planning " << planned << " changed tours: " << routed << " of " << legs << " legs routed, "
+		<< 1e3 * replanSeconds / max(planned, 1) << " ms against " << 1e3 * freshSeconds / max(planned, 1)
+		<< " ms from scratch, " << mismatches << " mismatches" << endl;
+	return mismatches == 0;
+}
+
+//******************** awkward pairs ******************************************
+
+static int findRoot(vector<int>& parent, int x)
+{
+	while (parent[x] != x)
+		x = parent[x] = parent[parent[x]];
+	return x;
+}
+
+static void awkwardPairs(const RoadGraph& g, mt19937& rng, vector<pair<GeoCoord, GeoCoord>>& out)
+{
+	int n = g.numNodes();
+	if (n == 0)
+		return;
+	uniform_int_distribution<int> pick(0, n - 1);
+	const int EACH = 50;
+
+	for (int i = 0; i < EACH; i++)
+	{
+		int a = pick(rng);
+		out.push_back(make_pair(g.coord(a), g.coord(a)));
+		if (g.edgesBegin(a) != g.edgesEnd(a))
+		{
+			int b = g.edgeTo[g.edgesBegin(a)];
+			out.push_back(make_pair(g.coord(a), g.coord(b)));
+		}
+	}
+
+	// both ends inside one chain, in both orders, and from inside to its ends
+	vector<int> interior;
+	for (int x = 0; x < n; x++)
+		if (g.nodeChain[x] != -1)
+			interior.push_back(x);
+	for (int i = 0; i < EACH && !interior.empty(); i++)
+	{
+		int x = interior[rng() % interior.size()];
+		int c = g.nodeChain[x];
+		int m = g.chainEdgeCount(c);
+		int y = g.edgeTo[g.chainEdges[g.chainEdgeBegin[c] + rng() % (m - 1)]];
+		out.push_back(make_pair(g.coord(x), g.coord(y)));
+		out.push_back(make_pair(g.coord(y), g.coord(x)));
+		out.push_back(make_pair(g.coord(x), g.coord(g.chainFrom[c])));
+		out.push_back(make_pair(g.coord(g.chainTo[c]), g.coord(x)));
+	}
+
+	// dead ends
+	vector<int> deadEnds;
+	for (int x = 0; x < n; x++)
+		if (g.edgesEnd(x) - g.edgesBegin(x) == 1)
+			deadEnds.push_back(x);
+	for (int i = 0; i < EACH && !deadEnds.empty(); i++)
+	{
+		int x = deadEnds[rng() % deadEnds.size()];
+		out.push_back(make_pair(g.coord(x), g.coord(pick(rng))));
+		out.push_back(make_pair(g.coord(pick(rng)), g.coord(x)));
+	}
+
+	// between and within the components that aren't the largest
+	vector<int> parent(n);
+	for (int x = 0; x < n; x++)
+		parent[x] = x;
+	for (int e = 0; e < g.numEdges(); e++)
+		parent[findRoot(parent, g.edgeFrom[e])] = findRoot(parent, g.edgeTo[e]);
+	vector<int> size(n, 0);
+	for (int x = 0; x < n; x++)
+		size[findRoot(parent, x)]++;
+	int largest = max_element(size.begin(), size.end()) - size.begin();
+	vector<int> outside;
+	for (int x = 0; x < n; x++)
+		if (findRoot(parent, x) != largest)
+			outside.push_back(x);
+	for (int i = 0; i < EACH && !outside.empty(); i++)
+	{
+		int x = outside[rng() % outside.size()];
+		int y = outside[rng() % outside.size()];
+		out.push_back(make_pair(g.coord(x), g.coord(pick(rng))));
+		out.push_back(make_pair(g.coord(x), g.coord(y)));
+	}
+
+	// the map's extremes, each to each
+	int extreme[4] = { 0, 0, 0, 0 };
+	for (int x = 1; x < n; x++)
+	{
+		if (g.coords.latDeg[x] < g.coords.latDeg[extreme[0]]) extreme[0] = x;
+		if (g.coords.latDeg[x] > g.coords.latDeg[extreme[1]]) extreme[1] = x;
+		if (g.coords.lonDeg[x] < g.coords.lonDeg[extreme[2]]) extreme[2] = x;
+		if (g.coords.lonDeg[x] > g.coords.lonDeg[extreme[3]]) extreme[3] = x;
+	}
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			out.push_back(make_pair(g.coord(extreme[i]), g.coord(extreme[j])));
+
+	// not on the map at all
+	GeoCoord nowhere("0.0000001", "0.0000001");
+	out.push_back(make_pair(nowhere, g.coord(0)));
+	out.push_back(make_pair(g.coord(0), nowhere));
+	out.push_back(make_pair(nowhere, nowhere));
+}
+
+//******************** synthetic grids ****************************************
+
+static string coordText(double v)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.7f", v);
+	return buf;
+}
+
+// Writes a jittered grid of streets in mapdata.txt format: full-length rows and
+// columns with some segments missing (making chains, dead ends and separate
+// pieces), a few diagonals, repeated segments, a closed loop street with no
+// junctions, and a detached island.
+static void writeGrid(const string& file, mt19937& rng, int width, int height)
+{
+	uniform_real_distribution<double> jitter(-0.0002, 0.0002);
+	uniform_real_distribution<double> coin(0, 1);
+	vector<vector<string>> lat(height, vector<string>(width)), lon(height, vector<string>(width));
+	for (int i = 0; i < height; i++)
+		for (int j = 0; j < width; j++)
+		{
+			lat[i][j] = coordText(34.0 + 0.001 * i + jitter(rng));
+			lon[i][j] = coordText(-118.5 + 0.001 * j + jitter(rng));
+		}
+
+	ofstream out(file);
+	auto street = [&](const string& name, const vector<string>& segments) {
+		if (segments.empty())
+			return;
+		out << name << "\n" << segments.size() << "\n";
+		for (const string& s : segments)
+			out << s << "\n";
+	};
+	auto segment = [&](int i1, int j1, int i2, int j2) {
+		return lat[i1][j1] + " " + lon[i1][j1] + " " + lat[i2][j2] + " " + lon[i2][j2];
+	};
+
+	for (int i = 0; i < height; i++)
+	{
+		vector<string> segs;
+		for (int j = 0; j + 1 < width; j++)
+			if (coin(rng) > 0.15)
+				segs.push_back(segment(i, j, i, j + 1));
+		if (!segs.empty() && coin(rng) < 0.2)
+			segs.push_back(segs[0]);
+		street("Row " + to_string(i), segs);
+	}
+	for (int j = 0; j < width; j++)
+	{
+		vector<string> segs;
+		for (int i = 0; i + 1 < height; i++)
+			if (coin(rng) > 0.15)
+				segs.push_back(segment(i, j, i + 1, j));
+		street("Column " + to_string(j), segs);
+	}
+	for (int k = 0; k < width / 2; k++)
+	{
+		int i = rng() % (height - 1), j = rng() % (width - 1);
+		street("Diagonal " + to_string(k), vector<string>(1, segment(i, j, i + 1, j + 1)));
+	}
+
+	auto point = [](double la, double lo) { return coordText(la) + " " + coordText(lo); };
+	vector<string> loop;
+	const int SIDES = 7;
+	for (int k = 0; k < SIDES; k++)
+	{
+		double a1 = 2 * M_PI * k / SIDES, a2 = 2 * M_PI * (k + 1) / SIDES;
+		loop.push_back(point(33.9 + 0.002 * sin(a1), -118.6 + 0.002 * cos(a1)) + " " + point(33.9 + 0.002 * sin(a2), -118.6 + 0.002 * cos(a2)));
+	}
+	street("Loop Road", loop);
+
+	vector<string> island;
+	for (int k = 0; k < 5; k++)
+		island.push_back(point(35.0, -117.0 + 0.001 * k) + " " + point(35.0, -117.0 + 0.001 * (k + 1)));
+	street("Island Way", island);
+}
+
+//******************** main ***************************************************
+
+static void summarize(const string& what, const Tally& t)
+{
+	cout << what << ": " << t.pairs << " pairs, " << t.distanceMismatches << " distance mismatches, "
+		<< t.brokenRoutes << " broken routes";
+	if (t.referencePairs > 0 && t.routerSecondsOnReferencePairs > 0)
+		cout << "; router " << t.referenceSeconds / t.routerSecondsOnReferencePairs << "x faster than the reference";
+	cout << endl;
+}
+
+static bool clean(const Tally& t)
+{
+	return t.distanceMismatches == 0 && t.brokenRoutes == 0;
+}
+
+//******************** edited maps ********************************************
+
+// Closes `count` random segments and a few in one direction only, adds a few
+// new ones (some through new nodes, some one-way into the middle of a
+// chain), and checks that (a) routes on the edited map agree with the
+// reference, which reads it through getSegmentsThatStartWith, (b) a query
+// pinned to the version from before the edits still gets the old answers,
+// and (c) reopening everything brings the old distances back.  With threads
+// > 1, routing threads then race a writer that keeps closing and reopening
+// the same segments; every answer must be the old one or the closed one.
+static bool editCheck(StreetMap& sm, mt19937& rng, double epsilon, int count, int pairs, int threads)
+{
+	shared_ptr<const RoadGraph> before = sm.snapshot();
+	const RoadGraph& g = *before;
+	uniform_int_distribution<int> pickNode(0, g.numNodes() - 1);
+	uniform_int_distribution<int> pickEdge(0, g.numEdges() - 1);
+
+	vector<MapEdit> close, reopen;
+	set<std::pair<int, int>> chosen;
+	while (close.size() < count && chosen.size() < g.numEdges() / 2)
+	{
+		int e = pickEdge(rng);
+		if (!chosen.insert(make_pair(min(g.edgeFrom[e], g.edgeTo[e]), max(g.edgeFrom[e], g.edgeTo[e]))).second)
+			continue;
+		close.push_back(MapEdit(MapEdit::CLOSE, g.segment(e)));
+		reopen.push_back(MapEdit(MapEdit::REOPEN, g.segment(e)));
+	}
+
+	// one-way edits at chain interiors: a street closed in one direction
+	// only, and (below) a one-way street ending at an interior node
+	vector<int> interior;
+	for (int x = 0; x < g.numNodes(); x++)
+		if (g.nodeChain[x] != -1)
+			interior.push_back(x);
+	shuffle(interior.begin(), interior.end(), rng);
+	vector<std::pair<GeoCoord, GeoCoord>> oneWayWork;
+	for (int i = 0; i < 5 && i < interior.size(); i++)
+	{
+		int x = interior[i];
+		int e = g.edgesBegin(x);
+		int from = g.edgeTo[e];
+		int beyond = g.edgeTo[e + 1];
+		if (!chosen.insert(make_pair(min(from, x), max(from, x))).second)
+			continue;
+		StreetSegment in(g.coord(from), g.coord(x), g.streetName(e));
+		close.push_back(MapEdit(MapEdit::CLOSE, in, true));
+		reopen.push_back(MapEdit(MapEdit::REOPEN, in, true));
+		oneWayWork.push_back(make_pair(g.coord(from), g.coord(beyond)));
+		oneWayWork.push_back(make_pair(g.coord(beyond), g.coord(from)));
+		oneWayWork.push_back(make_pair(g.coord(from), g.coord(x)));
+	}
+
+	vector<std::pair<GeoCoord, GeoCoord>> work;
+	for (int i = 0; i < pairs; i++)
+		work.push_back(make_pair(g.coord(pickNode(rng)), g.coord(pickNode(rng))));
+
+	PointToPointRouter router(&sm);
+	RouteOptions pinned;
+	pinned.graph = before.get();
+	auto distances = [&](const RouteOptions& options, vector<double>& out) {
+		out.clear();
+		for (const auto& p : work)
+		{
+			double miles = -1;
+			vector<int> edges;
+			out.push_back(router.generatePointToPointRoute(p.first, p.second, edges, miles, options) == DELIVERY_SUCCESS ? miles : -1);
+		}
+	};
+	vector<double> old;
+	distances(pinned, old);
+
+	auto t0 = Clock::now();
+	bool applied = sm.applyEdits(close);
+	double closeSeconds = chrono::duration<double>(Clock::now() - t0).count();
+
+	// new streets: between existing nodes, and out to a point off the map
+	vector<MapEdit> adds;
+	for (int i = 0; i < 5; i++)
+	{
+		GeoCoord a = g.coord(pickNode(rng));
+		GeoCoord b = g.coord(pickNode(rng));
+		adds.push_back(MapEdit(MapEdit::ADD, StreetSegment(a, b, "Router Diff Connector")));
+		GeoCoord spur(to_string(a.latitude + 0.0001), to_string(a.longitude));
+		adds.push_back(MapEdit(MapEdit::ADD, StreetSegment(a, spur, "Router Diff Spur")));
+		work.push_back(make_pair(spur, b));
+	}
+	for (int i = 5; i < 10 && i < interior.size(); i++)
+	{
+		int x = interior[i];
+		int e = g.edgesBegin(x);
+		GeoCoord at = g.coord(x);
+		GeoCoord entry(to_string(at.latitude + 0.0002), to_string(at.longitude + 0.0002));
+		adds.push_back(MapEdit(MapEdit::ADD, StreetSegment(entry, at, g.streetName(e)), true));
+		work.push_back(make_pair(entry, at));
+		work.push_back(make_pair(entry, g.coord(g.edgeTo[e])));
+		work.push_back(make_pair(entry, g.coord(g.edgeTo[e + 1])));
+	}
+	work.insert(work.end(), oneWayWork.begin(), oneWayWork.end());
+	applied = applied && sm.applyEdits(adds);
+
+	Tally edited;
+	{
+		Differ differ(sm, epsilon);
+		for (const auto& p : work)
+			differ.pair(edited, p.first, p.second);
+		differ.randomPairs(edited, rng, 20, 100);
+	}
+	work.resize(pairs);
+
+	vector<double> again;
+	distances(pinned, again);
+	long long stale = 0;
+	for (int i = 0; i < pairs; i++)
+		if (again[i] != old[i])
+			stale++;
+
+	// with the connectors removed and everything reopened the distances are
+	// the old ones, though ties may now be broken along other routes
+	for (MapEdit& a : adds)
+		a.kind = MapEdit::REMOVE;
+	applied = applied && sm.applyEdits(adds) && sm.applyEdits(reopen);
+	vector<double> restored;
+	distances(RouteOptions(), restored);
+	long long unrestored = 0;
+	for (int i = 0; i < pairs; i++)
+		if (fabs(restored[i] - old[i]) > 1e-9 * max(1.0, old[i]))
+			unrestored++;
+
+	cout << "edited map: " << close.size() << " closures applied in " << closeSeconds * 1000 << " ms; ";
+	summarize("routes", edited);
+	cout << "  " << stale << " pinned queries changed by the edits, " << unrestored << " distances not restored by reopening" << endl;
+	bool ok = applied && clean(edited) && stale == 0 && unrestored == 0;
+
+	if (threads > 1 && ok)
+	{
+		vector<double> closed;
+		sm.applyEdits(close);
+		distances(RouteOptions(), closed);
+		sm.applyEdits(reopen);
+		int affected = 0;
+		for (int i = 0; i < pairs; i++)
+			if (closed[i] != old[i])
+				affected++;
+
+		atomic<bool> done(false);
+		atomic<long long> mismatches(0), queries(0);
+		auto body = [&](int t) {
+			vector<int> edges;
+			while (!done.load())
+			{
+				for (int i = t; i < pairs && !done.load(); i += threads)
+				{
+					double miles = -1;
+					DeliveryResult r = router.generatePointToPointRoute(work[i].first, work[i].second, edges, miles);
+					double d = r == DELIVERY_SUCCESS ? miles : -1;
+					if (fabs(d - old[i]) > 1e-9 * max(1.0, old[i]) && fabs(d - closed[i]) > 1e-9 * max(1.0, closed[i]))
+						mismatches++;
+					queries++;
+				}
+			}
+		};
+		vector<thread> workers;
+		for (int t = 0; t < threads; t++)
+			workers.push_back(thread(body, t));
+		int versions = 0;
+		for (int round = 0; round < 20; round++)
+		{
+			sm.applyEdits(close);
+			sm.applyEdits(reopen);
+			versions += 2;
+		}
+		done.store(true);
+		for (thread& th : workers)
+			th.join();
+
+		cout << "  " << threads << " threads routing through " << versions << " new versions: " << queries.load()
+			<< " queries (" << affected << " of " << pairs << " pairs change), " << mismatches.load() << " matching neither version" << endl;
+		ok = mismatches.load() == 0;
+	}
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	string mapFile = "mapdata.txt";
+	int sources = 100, targets = 100, grids = 5, threads = 1, edits = 100;
+	double epsilon = 0;
+	unsigned int seed = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (i + 1 < argc && arg == "--map")
+			mapFile = argv[++i];
+		else if (i + 1 < argc && arg == "--sources")
+			sources = atoi(argv[++i]);
+		else if (i + 1 < argc && arg == "--targets")
+			targets = atoi(argv[++i]);
+		else if (i + 1 < argc && arg == "--grids")
+			grids = atoi(argv[++i]);
+		else if (i + 1 < argc && arg == "--epsilon")
+			epsilon = atof(argv[++i]);
+		else if (i + 1 < argc && arg == "--seed")
+			seed = atoi(argv[++i]);
+		else if (i + 1 < argc && arg == "--threads")
+			threads = atoi(argv[++i]);
+		else if (i + 1 < argc && arg == "--edits")
+			edits = atoi(argv[++i]);
+		else
+		{
+			cerr << "Usage: " << argv[0] << " [--map mapdata.txt] [--sources N] [--targets N] [--grids N] [--epsilon e] [--seed s] [--threads N] [--edits N]" << endl;
+			return 1;
+		}
+	}
+
+	mt19937 rng(seed);
+	bool ok = true;
+
+	StreetMap sm;
+	if (!sm.load(mapFile))
+	{
+		cerr << "Unable to load map data file " << mapFile << endl;
+		return 1;
+	}
+	{
+		Differ differ(sm, epsilon);
+
+		Tally awkward;
+		vector<pair<GeoCoord, GeoCoord>> pairs;
+		awkwardPairs(sm.graph(), rng, pairs);
+		for (const auto& p : pairs)
+			differ.pair(awkward, p.first, p.second);
+		summarize(mapFile + " awkward", awkward);
+
+		Tally random;
+		differ.randomPairs(random, rng, sources, targets);
+		summarize(mapFile + " random", random);
+
+		ok = ok && clean(awkward) && clean(random);
+	}
+	if (threads > 1)
+		ok = concurrentCheck(sm, rng, sources * targets / 10, threads) && ok;
+	ok = asyncCheck(sm, rng, 2000, max(threads, 2)) && ok;
+	ok = replanCheck(sm, rng, 50) && ok;
+	if (edits > 0)
+		ok = editCheck(sm, rng, epsilon, edits, 500, threads) && ok;
+
+	Tally grid;
+	const string gridFile = "router_diff_grid.txt";
+	for (int k = 0; k < grids; k++)
+	{
+		writeGrid(gridFile, rng, 10 + rng() % 30, 10 + rng() % 30);
+		StreetMap gm;
+		gm.load(gridFile);
+		Differ differ(gm, epsilon);
+
+		vector<pair<GeoCoord, GeoCoord>> pairs;
+		awkwardPairs(gm.graph(), rng, pairs);
+		for (const auto& p : pairs)
+			differ.pair(grid, p.first, p.second);
+		differ.randomPairs(grid, rng, 20, 50);
+	}
+	remove(gridFile.c_str());
+	if (grids > 0)
+		summarize(to_string(grids) + " synthetic grids", grid);
+	ok = ok && clean(grid);
+
+	cout << (ok ? "PASS" : "FAIL") << endl;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,219 @@
+// tile_pack.cpp
+// Writes a tile pack (see TiledMap.h) from one or more map files and checks
+// routing on it.
+//
+// usage: goober_tile --map a.txt [--map b.txt ...] --out map.tiles
+//                    [--tile-nodes N] [--verify N] [--radius miles]
+//                    [--budget bytes] [--seed s]
+//
+// Several --map files, e.g. one per metro area, go into one pack.  --verify N
+// (default 200) then opens the pack with the given memory budget (default
+// unlimited) and routes N random pairs of nodes that lie within --radius miles
+// (default 3) of one spot, comparing each distance with the same route on the
+// whole map, and reports how much of the map had to be made resident.  The
+// same pairs are then routed again with a budget of four tiles, as measured
+// in the first run, so tiles are evicted between and during queries.
+//
+// Exits with status 1 if a tiled route disagrees, or if the decoded tiles
+// left resident once the queries are done exceed the budget.  A query may
+// take the cache over budget while it holds its tiles, but not after.
+
+#include "provided.h"
+#include "RoadGraph.h"
+#include "TiledMap.h"
+#include "MemoryReport.h"
+#include <iostream>
+#include <iterator>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// several maps become one by putting their files end to end
+static bool concatenate(const vector<string>& files, const string& out)
+{
+	ofstream o(out, ios::binary);
+	for (int i = 0; i < files.size(); i++)
+	{
+		ifstream in(files[i], ios::binary);
+		if (!in)
+		{
+			cerr << "Cannot open " << files[i] << endl;
+			return false;
+		}
+		string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+		o << text;
+		if (!text.empty() && text.back() != '\n')
+			o << '\n';
+	}
+	return bool(o);
+}
+
+// Returns the number of mismatches, plus one if the cache ends over budget,
+// or -1 if the pack can't be opened.
+// tileBytes gets the mean decoded size of the tiles left resident.
+static int verify(const StreetMap& whole, const string& pack, size_t budget, int pairs, double radius, unsigned seed, size_t& tileBytes)
+{
+	StreetMap tiled;
+	if (!tiled.loadTiles(pack, budget))
+	{
+		cerr << "Cannot open " << pack << endl;
+		return -1;
+	}
+
+	const RoadGraph& g = whole.graph();
+	mt19937 rng(seed);
+	uniform_int_distribution<int> pick(0, g.numNodes() - 1);
+	GeoCoord center = g.coord(pick(rng));
+	vector<int> nearby;
+	for (int i = 0; i < g.numNodes(); i++)
+		if (distanceEarthMiles(center, g.coord(i)) <= radius)
+			nearby.push_back(i);
+	uniform_int_distribution<int> pickNear(0, (int)nearby.size() - 1);
+
+	PointToPointRouter wholeRouter(&whole);
+	PointToPointRouter tiledRouter(&tiled);
+	int mismatches = 0;
+	double wholeSeconds = 0, tiledSeconds = 0;
+	int peakNodes = 0;
+	for (int i = 0; i < pairs; i++)
+	{
+		GeoCoord a = g.coord(nearby[pickNear(rng)]);
+		GeoCoord b = g.coord(nearby[pickNear(rng)]);
+		vector<int> edges;
+		double expected = 0, got = 0;
+
+		auto t0 = Clock::now();
+		DeliveryResult r1 = wholeRouter.generatePointToPointRoute(a, b, edges, expected);
+		auto t1 = Clock::now();
+		DeliveryResult r2 = tiledRouter.generatePointToPointRoute(a, b, edges, got);
+		auto t2 = Clock::now();
+		wholeSeconds += chrono::duration<double>(t1 - t0).count();
+		tiledSeconds += chrono::duration<double>(t2 - t1).count();
+
+		if (r1 != r2 || fabs(expected - got) > 1e-9 * max(1.0, expected))
+		{
+			if (mismatches < 10)
+				cerr << "MISMATCH " << a.latitudeText << "," << a.longitudeText << " -> " << b.latitudeText << "," << b.longitudeText
+					<< ": whole " << r1 << " " << expected << ", tiled " << r2 << " " << got << endl;
+			mismatches++;
+		}
+		peakNodes = max(peakNodes, tiled.graph().numNodes());
+	}
+
+	shared_ptr<const RoadGraph> resident = tiled.snapshot();
+	set<int> tiles(resident->nodeTile.begin(), resident->nodeTile.end());
+	MemoryReport memory;
+	tiled.reportMemory(memory);
+	size_t decoded = 0;
+	for (const auto& part : memory.parts())
+		if (part.first == "tiles/decoded")
+			decoded = part.second;
+	tileBytes = decoded / max<size_t>(tiles.size(), 1);
+
+	printf("%d pairs within %.1f miles of %s,%s (%d nodes in reach), ", pairs, radius,
+		center.latitudeText.c_str(), center.longitudeText.c_str(), (int)nearby.size());
+	if (budget == (size_t)-1)
+		printf("no memory budget\n");
+	else
+		printf("memory budget %zu bytes\n", budget);
+	printf("  mismatches     %d\n", mismatches);
+	printf("  resident       %d of %d nodes, %d of %d edges, %d tiles (peak %d nodes)\n",
+		resident->numNodes(), g.numNodes(), resident->numEdges(), g.numEdges(), (int)tiles.size(), peakNodes);
+	printf("  route time     whole %.1f us, tiled %.1f us per pair (tiled includes tile loads)\n",
+		1e6 * wholeSeconds / max(pairs, 1), 1e6 * tiledSeconds / max(pairs, 1));
+	printf("  decoded tiles  %zu bytes at the end\n", decoded);
+	if (budget != (size_t)-1 && decoded > budget)
+	{
+		cerr << "OVER BUDGET: " << decoded << " bytes of tiles resident after the queries, budget " << budget << endl;
+		return mismatches + 1;
+	}
+	return mismatches;
+}
+
+int main(int argc, char* argv[])
+{
+	vector<string> maps;
+	string out;
+	int nodesPerTile = 4096;
+	int pairs = 200;
+	double radius = 3;
+	size_t budget = (size_t)-1;
+	unsigned seed = 1;
+
+	bool ok = true;
+	for (int i = 1; i < argc && ok; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (hasValue && arg == "--map")
+			maps.push_back(argv[++i]);
+		else if (hasValue && arg == "--out")
+			out = argv[++i];
+		else if (hasValue && arg == "--tile-nodes")
+			nodesPerTile = atoi(argv[++i]);
+		else if (hasValue && arg == "--verify")
+			pairs = atoi(argv[++i]);
+		else if (hasValue && arg == "--radius")
+			radius = atof(argv[++i]);
+		else if (hasValue && arg == "--budget")
+			budget = strtoull(argv[++i], nullptr, 10);
+		else if (hasValue && arg == "--seed")
+			seed = atoi(argv[++i]);
+		else
+			ok = false;
+	}
+	if (!ok || maps.empty() || out.empty() || nodesPerTile <= 0)
+	{
+		cerr << "Usage: " << argv[0] << " --map a.txt [--map b.txt ...] --out map.tiles [--tile-nodes N]" << endl
+			<< "       [--verify N] [--radius miles] [--budget bytes] [--seed s]" << endl;
+		return 1;
+	}
+
+	string mapFile = maps[0];
+	if (maps.size() > 1)
+	{
+		mapFile = out + ".map";
+		if (!concatenate(maps, mapFile))
+			return 1;
+	}
+	StreetMap whole;
+	bool loaded = whole.load(mapFile);
+	if (maps.size() > 1)
+		remove(mapFile.c_str());
+	if (!loaded)
+	{
+		cerr << "Cannot load " << mapFile << endl;
+		return 1;
+	}
+
+	auto t0 = Clock::now();
+	if (!writeTilePack(whole.graph(), out, nodesPerTile))
+	{
+		cerr << "Cannot write " << out << endl;
+		return 1;
+	}
+	const RoadGraph& g = whole.graph();
+	printf("%s: %d nodes, %d edges in %d tiles of %d nodes (%.0f ms)\n", out.c_str(), g.numNodes(), g.numEdges(),
+		(g.numNodes() + nodesPerTile - 1) / nodesPerTile, nodesPerTile,
+		1e3 * chrono::duration<double>(Clock::now() - t0).count());
+
+	if (pairs <= 0)
+		return 0;
+	size_t tileBytes = 0;
+	int mismatches = verify(whole, out, budget, pairs, radius, seed, tileBytes);
+	if (mismatches != 0)
+		return 1;
+	size_t tight = 4 * max<size_t>(tileBytes, 1);
+	if (tight < budget)
+		mismatches = verify(whole, out, tight, pairs, radius, seed, tileBytes);
+	return mismatches == 0 ? 0 : 1;
+}